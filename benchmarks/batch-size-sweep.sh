@@ -0,0 +1,70 @@
+#!/bin/sh
+# Measure client-call throughput as a function of the daemon's --batch-size.
+#
+# For every batch size this starts a fresh three-node cluster on localhost
+# with that --batch-size, creates the echo object, and drives it with
+# replicant-benchmark.  Each run prints one line of the form
+#
+#     <batch-size> <ops/s>
+#
+# which may be plotted directly.  Per-call latencies for each run are kept in
+# batch-<batch-size>.dat.bz2 in the working directory.
+#
+# usage: batch-size-sweep.sh <echo library> [batch sizes...]
+#
+# The offered load, run length, and linger may be set with THROUGHPUT
+# (default: 100000 ops/s), RUNTIME (default: 30 s) and LINGER (default: 1 ms).
+# replicant and replicant-benchmark must be on the PATH.
+
+set -e
+
+if test $# -lt 1; then
+    echo "usage: $0 <echo library> [batch sizes...]" >&2
+    exit 1
+fi
+
+LIBRARY="$1"
+shift
+SIZES="${*:-1 2 4 8 16 32 64 128}"
+THROUGHPUT="${THROUGHPUT:-100000}"
+RUNTIME="${RUNTIME:-30}"
+LINGER="${LINGER:-1}"
+WORKDIR="$(mktemp -d)"
+PIDS=""
+
+cleanup() {
+    if test -n "${PIDS}"; then
+        kill ${PIDS} 2>/dev/null || true
+        wait ${PIDS} 2>/dev/null || true
+    fi
+
+    PIDS=""
+}
+
+trap 'cleanup; rm -rf "${WORKDIR}"' EXIT
+
+for size in ${SIZES}; do
+    rm -rf "${WORKDIR}"/replica*
+    mkdir "${WORKDIR}"/replica0 "${WORKDIR}"/replica1 "${WORKDIR}"/replica2
+    replicant daemon --foreground --data="${WORKDIR}"/replica0 \
+        --listen 127.0.0.1 --listen-port 1982 \
+        --batch-size "${size}" --batch-linger "${LINGER}" 2>/dev/null &
+    PIDS="$!"
+    sleep 1
+    replicant daemon --foreground --data="${WORKDIR}"/replica1 \
+        --listen 127.0.0.1 --listen-port 1983 --connect-port 1982 \
+        --batch-size "${size}" --batch-linger "${LINGER}" 2>/dev/null &
+    PIDS="${PIDS} $!"
+    replicant daemon --foreground --data="${WORKDIR}"/replica2 \
+        --listen 127.0.0.1 --listen-port 1984 --connect-port 1982 \
+        --batch-size "${size}" --batch-linger "${LINGER}" 2>/dev/null &
+    PIDS="${PIDS} $!"
+    sleep 2
+    replicant new-object --host 127.0.0.1 --port 1982 echo "${LIBRARY}"
+    ops=$(replicant-benchmark --host 127.0.0.1 --port 1982 \
+              --output "batch-${size}.dat.bz2" \
+              --throughput "${THROUGHPUT}" --runtime "${RUNTIME}" |
+          sed -n 's/.*: \([0-9.e+]*\) ops\/s$/\1/p')
+    echo "${size} ${ops}"
+    cleanup
+done
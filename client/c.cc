@@ -214,7 +214,18 @@ replicant_client_new_object(struct replicant_client* _cl,
                             replicant_returncode* status)
 {
     C_WRAP_EXCEPT(
-    return cl->new_object(object, path, status);
+    return cl->new_object(object, path, false, status);
+    );
+}
+
+REPLICANT_API int64_t
+replicant_client_new_object_in_process(struct replicant_client* _cl,
+                                       const char* object,
+                                       const char* path,
+                                       replicant_returncode* status)
+{
+    C_WRAP_EXCEPT(
+    return cl->new_object(object, path, true, status);
     );
 }
 
@@ -284,6 +295,21 @@ replicant_client_call(struct replicant_client* _cl,
     );
 }
 
+REPLICANT_API int64_t
+replicant_client_call_stale(struct replicant_client* _cl,
+                            const char* object,
+                            const char* func,
+                            const char* input, size_t input_sz,
+                            uint64_t max_staleness_ms,
+                            replicant_returncode* status,
+                            char** output, size_t* output_sz,
+                            uint64_t* slot)
+{
+    C_WRAP_EXCEPT(
+    return cl->call_stale(object, func, input, input_sz, max_staleness_ms, status, output, output_sz, slot);
+    );
+}
+
 REPLICANT_API int64_t
 replicant_client_cond_wait(struct replicant_client* _cl,
                            const char* object,
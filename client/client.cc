@@ -78,6 +78,7 @@ client :: client(const char* coordinator, uint16_t port)
     , m_busybee_controller(&m_config)
     , m_busybee(busybee_client::create(&m_busybee_controller))
     , m_random_token(0)
+    , m_spread(0)
     , m_last_bootstrap_attempt(0)
     , m_config_state(0)
     , m_config_data(NULL)
@@ -122,6 +123,7 @@ client :: client(const char* cs)
     , m_busybee_controller(&m_config)
     , m_busybee(busybee_client::create(&m_busybee_controller))
     , m_random_token(0)
+    , m_spread(0)
     , m_last_bootstrap_attempt(0)
     , m_config_state(0)
     , m_config_data(NULL)
@@ -195,6 +197,7 @@ client :: generate_unique_number(replicant_returncode* status,
 int64_t
 client :: new_object(const char* object,
                      const char* path,
+                     bool in_process,
                      replicant_returncode* status)
 {
     std::string lib;
@@ -207,7 +210,7 @@ client :: new_object(const char* object,
 
     std::string cmd(object, strlen(object) + 1);
     cmd += lib;
-    return call("replicant", "new_object",
+    return call("replicant", in_process ? "new_object_in_process" : "new_object",
                 cmd.data(), cmd.size(),
                 REPLICANT_CALL_ROBUST,
                 status, NULL, 0);
@@ -287,6 +290,7 @@ client :: call(const char* object,
 
     const bool idempotent = flags & REPLICANT_CALL_IDEMPOTENT;
     const bool robust = flags & REPLICANT_CALL_ROBUST;
+    const bool readonly = flags & REPLICANT_CALL_READONLY;
     const int64_t id = m_next_client_id++;
 
     if (robust)
@@ -301,12 +305,36 @@ client :: call(const char* object,
     {
         e::intrusive_ptr<pending> p = new pending_call(id, object, func,
                                                        input, input_sz,
-                                                       idempotent, status,
+                                                       idempotent, readonly, status,
                                                        output, output_sz);
         return send(p.get());
     }
 }
 
+int64_t
+client :: call_stale(const char* object,
+                     const char* func,
+                     const char* input, size_t input_sz,
+                     uint64_t max_staleness_ms,
+                     replicant_returncode* status,
+                     char** output, size_t* output_sz,
+                     uint64_t* slot)
+{
+    if (!maintain_connection(status))
+    {
+        return -1;
+    }
+
+    const int64_t id = m_next_client_id++;
+    e::intrusive_ptr<pending_call> p = new pending_call(id, object, func,
+                                                        input, input_sz,
+                                                        true, true, status,
+                                                        output, output_sz);
+    p->set_stale(max_staleness_ms, slot);
+    // any server may answer, so take turns rather than always asking the same one
+    return send(p.get(), server_selector::round_robin(m_config.server_ids(), m_spread++));
+}
+
 int64_t
 client :: cond_wait(const char* object,
                     const char* cond,
@@ -1079,7 +1107,13 @@ client ::handle_disruption(server_id si)
 int64_t
 client :: send(pending* p)
 {
-    server_selector ss(m_config.server_ids(), m_random_token);
+    return send(p, m_random_token);
+}
+
+int64_t
+client :: send(pending* p, uint64_t token)
+{
+    server_selector ss(m_config.server_ids(), token);
     server_id si;
 
     while ((si = ss.next()) != server_id() && m_config.version() != version_id())
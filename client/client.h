@@ -71,6 +71,7 @@ class client
                                        uint64_t* number);
         int64_t new_object(const char* object,
                            const char* path,
+                           bool in_process,
                            replicant_returncode* status);
         int64_t del_object(const char* object,
                            replicant_returncode* status);
@@ -89,6 +90,13 @@ class client
                      unsigned flags,
                      replicant_returncode* status,
                      char** output, size_t* output_sz);
+        int64_t call_stale(const char* object,
+                           const char* func,
+                           const char* input, size_t input_sz,
+                           uint64_t max_staleness_ms,
+                           replicant_returncode* status,
+                           char** output, size_t* output_sz,
+                           uint64_t* slot);
         int64_t cond_wait(const char* object,
                           const char* cond,
                           uint64_t state,
@@ -130,6 +138,7 @@ class client
         bool maintain_connection(replicant_returncode* status);
         void handle_disruption(server_id si);
         int64_t send(pending* p);
+        int64_t send(pending* p, uint64_t token);
         int64_t send_robust(pending_robust* p);
         bool send(server_id si, std::auto_ptr<e::buffer> msg, replicant_returncode* status);
         void adopt_config(const configuration& c);
@@ -148,6 +157,7 @@ class client
         const std::auto_ptr<busybee_client> m_busybee;
         // server selection
         uint64_t m_random_token;
+        uint64_t m_spread;
         // configuration
         uint64_t m_last_bootstrap_attempt;
         uint64_t m_config_state;
@@ -40,6 +40,7 @@ pending_call :: pending_call(int64_t id,
                              const char* func,
                              const char* input, size_t input_sz,
                              bool idempotent,
+                             bool readonly,
                              replicant_returncode* st,
                              char** output, size_t* output_sz)
     : pending(id, st)
@@ -47,6 +48,10 @@ pending_call :: pending_call(int64_t id,
     , m_func(func)
     , m_input(input, input_sz)
     , m_idempotent(idempotent)
+    , m_readonly(readonly)
+    , m_stale(false)
+    , m_max_staleness(0)
+    , m_slot(NULL)
     , m_output(output)
     , m_output_sz(output_sz)
 {
@@ -65,28 +70,59 @@ pending_call :: ~pending_call() throw ()
 {
 }
 
+void
+pending_call :: set_stale(uint64_t max_staleness_ms, uint64_t* slot)
+{
+    m_stale = true;
+    m_max_staleness = max_staleness_ms;
+    m_slot = slot;
+
+    if (m_slot)
+    {
+        *m_slot = 0;
+    }
+}
+
 std::auto_ptr<e::buffer>
 pending_call :: request(uint64_t nonce)
 {
     e::slice obj(m_object);
     e::slice func(m_func);
     e::slice input(m_input);
+
+    if (m_stale)
+    {
+        const size_t sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(REPLNET_CALL_STALE)
+                        + sizeof(uint64_t)
+                        + sizeof(uint64_t)
+                        + pack_size(obj)
+                        + pack_size(func)
+                        + pack_size(input);
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        msg->pack_at(BUSYBEE_HEADER_SIZE)
+            << REPLNET_CALL_STALE << nonce << m_max_staleness << obj << func << input;
+        return msg;
+    }
+
+    const network_msgtype mt = m_readonly ? REPLNET_CALL_READONLY : REPLNET_CALL;
     const size_t sz = BUSYBEE_HEADER_SIZE
-                    + pack_size(REPLNET_CALL)
+                    + pack_size(mt)
                     + sizeof(uint64_t)
                     + pack_size(obj)
                     + pack_size(func)
                     + pack_size(input);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << REPLNET_CALL << nonce << obj << func << input;
+        << mt << nonce << obj << func << input;
     return msg;
 }
 
 bool
 pending_call :: resend_on_failure()
 {
-    return m_idempotent;
+    // a read changes nothing, so asking again is always safe
+    return m_idempotent || m_readonly || m_stale;
 }
 
 void
@@ -103,6 +139,13 @@ pending_call :: handle_response(client*, std::auto_ptr<e::buffer>, e::unpacker u
     else if (st == REPLICANT_SUCCESS)
     {
         this->success();
+        uint64_t slot = 0;
+
+        // reads append the slot they reflect
+        if (m_slot && !(up >> slot).error())
+        {
+            *m_slot = slot;
+        }
 
         if (output.size() && m_output)
         {
@@ -41,10 +41,16 @@ class pending_call : public pending
                      const char* func,
                      const char* input, size_t input_sz,
                      bool idempotent,
+                     bool readonly,
                      replicant_returncode* status,
                      char** output, size_t* output_sz);
         virtual ~pending_call() throw ();
 
+    public:
+        // answer from any server within max_staleness_ms of the leader,
+        // reporting the slot the answer reflects
+        void set_stale(uint64_t max_staleness_ms, uint64_t* slot);
+
     public:
         virtual std::auto_ptr<e::buffer> request(uint64_t nonce);
         virtual bool resend_on_failure();
@@ -57,6 +63,10 @@ class pending_call : public pending
         const std::string m_func;
         const std::string m_input;
         const bool m_idempotent;
+        const bool m_readonly;
+        bool m_stale;
+        uint64_t m_max_staleness;
+        uint64_t* m_slot;
         char** m_output;
         size_t* m_output_sz;
 
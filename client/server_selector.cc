@@ -48,6 +48,19 @@ server_selector :: ~server_selector() throw ()
 {
 }
 
+uint64_t
+server_selector :: round_robin(const std::vector<server_id>& _servers, uint64_t n)
+{
+    if (_servers.empty())
+    {
+        return n;
+    }
+
+    std::vector<server_id> servers(_servers);
+    std::sort(servers.begin(), servers.end());
+    return servers[n % servers.size()].get();
+}
+
 server_id
 server_selector :: next()
 {
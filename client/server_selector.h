@@ -45,6 +45,9 @@ class server_selector
 
     public:
         server_id next();
+        // a token that starts the selection at the n-th server, so that
+        // successive values of n take turns across the whole cluster
+        static uint64_t round_robin(const std::vector<server_id>& servers, uint64_t n);
 
     private:
         std::vector<server_id> m_servers;
@@ -34,6 +34,9 @@
 
 #define REPLICANT_COMMANDS_TO_LEADER (4 * REPLICANT_SLOTS_WINDOW)
 
+#define REPLICANT_BATCH_SIZE_DEFAULT 1
+#define REPLICANT_BATCH_LINGER_DEFAULT 1
+
 #define REPLICANT_NONCE_INCREMENT 65536
 #define REPLICANT_NONCE_GENERATE_WHEN_FEWER_THAN 256
 
@@ -41,4 +44,31 @@
 
 #define REPLICANT_MINIMUM_RETRANSMISSION (PO6_SECONDS)
 
+#define REPLICANT_MAX_PVALUES_PER_MESSAGE 64
+
+#define REPLICANT_IO_URING_ENTRIES 64
+
+#define REPLICANT_LOG_SEGMENT_SIZE_DEFAULT (64ULL * 1024ULL * 1024ULL)
+#define REPLICANT_LOG_SEGMENTS_RECYCLED 4
+
+#define REPLICANT_SNAPSHOT_DELTA_CHAIN 16
+#define REPLICANT_REPLAY_BUFFER_SIZE_DEFAULT (16ULL * 1024ULL * 1024ULL)
+#define REPLICANT_SNAPSHOT_CHUNK_SIZE (1U << 20)
+
+#define REPLICANT_SHM_RING_SIZE (1U << 18)
+#define REPLICANT_SHM_RING_SPIN 4096
+#define REPLICANT_SHM_RING_TIMEOUT 100
+#define REPLICANT_OBJECT_BATCH_SIZE 128
+#define REPLICANT_OBJECT_BATCH_BYTES (REPLICANT_SHM_RING_SIZE / 2)
+
+// the leader gives up this fraction (1/N) of every lease to clock drift
+#define REPLICANT_LEASE_DRIFT 8
+
+#define REPLICANT_STATE_TRANSFER_CHUNK_SIZE (1U << 20)
+#define REPLICANT_STATE_TRANSFER_PEERS 3
+#define REPLICANT_STATE_TRANSFER_TIMEOUT 10000
+#define REPLICANT_STATE_TRANSFER_RETRIES 5
+#define REPLICANT_STATE_TRANSFER_RATE (64ULL * 1024ULL * 1024ULL)
+#define REPLICANT_STATE_TRANSFER_RETAIN (30 * PO6_SECONDS)
+
 #endif // replicant_common_constants_h_
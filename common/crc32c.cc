@@ -0,0 +1,135 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define REPL_CRC32C_SSE42
+#endif
+
+// C
+#include <string.h>
+
+#ifdef REPL_CRC32C_SSE42
+// x86
+#include <nmmintrin.h>
+#endif
+
+// Replicant
+#include "common/crc32c.h"
+
+namespace
+{
+
+class crc32c_table
+{
+    public:
+        crc32c_table();
+
+    public:
+        uint32_t t[256];
+};
+
+crc32c_table :: crc32c_table()
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; ++k)
+        {
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78U : (c >> 1);
+        }
+
+        t[i] = c;
+    }
+}
+
+const crc32c_table s_table;
+
+uint32_t
+crc32c_sw(uint32_t crc, const unsigned char* data, size_t data_sz)
+{
+    for (size_t i = 0; i < data_sz; ++i)
+    {
+        crc = s_table.t[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#ifdef REPL_CRC32C_SSE42
+__attribute__ ((target("sse4.2")))
+uint32_t
+crc32c_hw(uint32_t crc, const unsigned char* data, size_t data_sz)
+{
+    uint64_t c = crc;
+
+    while (data_sz >= sizeof(uint64_t))
+    {
+        uint64_t x;
+        memcpy(&x, data, sizeof(x));
+        c = _mm_crc32_u64(c, x);
+        data += sizeof(uint64_t);
+        data_sz -= sizeof(uint64_t);
+    }
+
+    crc = c;
+
+    while (data_sz > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+        ++data;
+        --data_sz;
+    }
+
+    return crc;
+}
+
+// static initializers may run before the compiler's own CPU detection
+bool
+has_sse42()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+const bool s_has_sse42 = has_sse42();
+#endif
+
+} // namespace
+
+uint32_t
+replicant :: crc32c(const void* _data, size_t data_sz)
+{
+    const unsigned char* data = static_cast<const unsigned char*>(_data);
+#ifdef REPL_CRC32C_SSE42
+    if (s_has_sse42)
+    {
+        return ~crc32c_hw(~uint32_t(0), data, data_sz);
+    }
+#endif
+    return ~crc32c_sw(~uint32_t(0), data, data_sz);
+}
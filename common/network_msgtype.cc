@@ -42,6 +42,7 @@ replicant :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(REPLNET_PING);
         STRINGIFY(REPLNET_PONG);
         STRINGIFY(REPLNET_STATE_TRANSFER);
+        STRINGIFY(REPLNET_STATE_TRANSFER_CHUNK);
         STRINGIFY(REPLNET_WHO_ARE_YOU);
         STRINGIFY(REPLNET_IDENTITY);
         STRINGIFY(REPLNET_PAXOS_PHASE1A);
@@ -50,6 +51,13 @@ replicant :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(REPLNET_PAXOS_PHASE2B);
         STRINGIFY(REPLNET_PAXOS_LEARN);
         STRINGIFY(REPLNET_PAXOS_SUBMIT);
+        STRINGIFY(REPLNET_PAXOS_PHASE2A_MULTI);
+        STRINGIFY(REPLNET_PAXOS_PHASE2B_MULTI);
+        STRINGIFY(REPLNET_PAXOS_LEARN_MULTI);
+        STRINGIFY(REPLNET_READ_INDEX);
+        STRINGIFY(REPLNET_READ_INDEX_REPLY);
+        STRINGIFY(REPLNET_LEADER_CHECK);
+        STRINGIFY(REPLNET_LEADER_CHECK_ACK);
         STRINGIFY(REPLNET_SERVER_BECOME_MEMBER);
         STRINGIFY(REPLNET_UNIQUE_NUMBER);
         STRINGIFY(REPLNET_OBJECT_FAILED);
@@ -58,6 +66,8 @@ replicant :: operator << (std::ostream& lhs, network_msgtype rhs)
         STRINGIFY(REPLNET_CALL);
         STRINGIFY(REPLNET_GET_ROBUST_PARAMS);
         STRINGIFY(REPLNET_CALL_ROBUST);
+        STRINGIFY(REPLNET_CALL_READONLY);
+        STRINGIFY(REPLNET_CALL_STALE);
         STRINGIFY(REPLNET_CLIENT_RESPONSE);
         STRINGIFY(REPLNET_GARBAGE);
         default:
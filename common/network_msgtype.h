@@ -44,6 +44,7 @@ enum network_msgtype
     REPLNET_PING                    = 29,
     REPLNET_PONG                    = 30,
     REPLNET_STATE_TRANSFER          = 31,
+    REPLNET_STATE_TRANSFER_CHUNK    = 27,
     // 26 is dead
     REPLNET_WHO_ARE_YOU             = 25,
     REPLNET_IDENTITY                = 24,
@@ -54,6 +55,13 @@ enum network_msgtype
     REPLNET_PAXOS_PHASE2B           = 35,
     REPLNET_PAXOS_LEARN             = 36,
     REPLNET_PAXOS_SUBMIT            = 37,
+    REPLNET_PAXOS_PHASE2A_MULTI     = 38,
+    REPLNET_PAXOS_PHASE2B_MULTI     = 39,
+    REPLNET_PAXOS_LEARN_MULTI       = 40,
+    REPLNET_READ_INDEX              = 41,
+    REPLNET_READ_INDEX_REPLY        = 42,
+    REPLNET_LEADER_CHECK            = 43,
+    REPLNET_LEADER_CHECK_ACK        = 44,
 
     REPLNET_SERVER_BECOME_MEMBER    = 48,
     REPLNET_UNIQUE_NUMBER           = 63,
@@ -63,6 +71,8 @@ enum network_msgtype
     REPLNET_CALL                    = 70,
     REPLNET_GET_ROBUST_PARAMS       = 72,
     REPLNET_CALL_ROBUST             = 73,
+    REPLNET_CALL_READONLY           = 74,
+    REPLNET_CALL_STALE              = 75,
 
     REPLNET_CLIENT_RESPONSE         = 224,
 
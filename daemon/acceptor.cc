@@ -25,17 +25,29 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 // POSIX
-#include <aio.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <signal.h>
 #include <unistd.h>
 
 // STL
 #include <algorithm>
 
+#ifdef REPL_IO_URING
+// liburing
+#include <liburing.h>
+#endif
+
 // Google Log
 #include <glog/logging.h>
 
@@ -46,58 +58,152 @@
 #include <po6/threads/cond.h>
 #include <po6/threads/mutex.h>
 #include <po6/threads/thread.h>
+#include <po6/time.h>
 
 // e
+#include <e/atomic.h>
 #include <e/guard.h>
 
 // Replicant
+#include "common/constants.h"
+#include "common/crc32c.h"
 #include "daemon/acceptor.h"
+#include "daemon/daemon.h"
 
 using replicant::acceptor;
 
+// A record's type may carry this bit, in which case the type is followed by
+// the low 32 bits of the number of the segment it was written to.  Recycled
+// segments are not cleared, so this generation is what tells the records
+// written since the segment was reused from those left over from before.
+#define RECORD_GENERATION 0x80
+
+// What a segment holds, so that GC and startup can decide what to do with a
+// sealed segment without replaying it.  Written to index.N by the garbage
+// collector once every record of log.N is durable.
+struct acceptor::log_summary
+{
+    log_summary();
+    ~log_summary() throw ();
+
+    bool has_pvals() const { return min_slot <= max_slot; }
+
+    uint64_t lognum;
+    uint64_t records;
+    uint64_t min_slot;
+    uint64_t max_slot;
+    ballot highest_ballot;
+    uint64_t lowest_acceptable_slot;
+};
+
 struct acceptor::log_segment
 {
-    log_segment();
+    log_segment(writer* w);
     ~log_segment() throw ();
 
-    bool open(int fd, uint64_t lognum);
-
-    bool write_ballot(const ballot& b);
-    bool write_pval(const pvalue& pval);
-    bool write_gc(uint64_t below);
-    bool write(std::auto_ptr<e::buffer> buf);
+    bool open(int dir, uint64_t lognum, uint64_t size);
 
-    bool all_synced();
-    void maybe_sync(uint64_t opnum);
-    uint64_t sync_cut();
+    bool write_ballot(const ballot& b, uint64_t opnum);
+    bool write_pval(const pvalue& pval, uint64_t opnum);
+    bool write_gc(uint64_t below, uint64_t opnum);
+    bool write(std::auto_ptr<e::buffer> buf, uint64_t opnum);
 
+    writer* const w;
     uint64_t lognum;
+    // bytes and last operation handed to the writer
     uint64_t written;
+    uint64_t last_op;
+    log_summary summary;
+    // where the writer will append next; only touched by the writer
+    uint64_t offset;
     po6::io::fd fd;
-    bool permafail;
-    uint64_t synced;
-    uint64_t sync_op;
-    bool sync_in_progress;
-    struct aiocb afsync;
-    uint64_t in_progress_synced;
-    uint64_t in_progress_sync_op;
 
     private:
         log_segment(const log_segment&);
         log_segment& operator = (const log_segment&);
 };
 
-acceptor :: log_segment :: log_segment()
-    : lognum()
+// Appends records to the log on a dedicated thread.  Everything enqueued
+// while the previous group was on its way to disk is written with one writev
+// per segment and made durable with one fdatasync, after which the durable
+// cut advances and the daemon's event loop is woken so that messages waiting
+// on durability go out immediately.
+class acceptor::writer
+{
+    public:
+        writer(acceptor* a);
+        ~writer() throw ();
+
+    public:
+        bool append(log_segment* ls, std::auto_ptr<e::buffer> buf, uint64_t opnum);
+        uint64_t durable_cut();
+        // wait until every operation up to opnum is durable; false on failure
+        bool wait_durable(uint64_t opnum);
+        bool failed();
+        void kill();
+        void run();
+
+    private:
+        struct record;
+        bool write_group(const std::vector<record>& group);
+        bool write_run(log_segment* ls, const record* recs, size_t recs_sz);
+#ifdef REPL_IO_URING
+        bool write_group_uring(const std::vector<record>& group, bool* handled);
+#endif
+
+    private:
+        acceptor* const m_acceptor;
+        po6::threads::thread m_thread;
+        po6::threads::mutex m_mtx;
+        po6::threads::cond m_cnd;
+        po6::threads::cond m_durable_cnd;
+        std::vector<record> m_queue;
+        uint64_t m_durable;
+        bool m_failed;
+        bool m_killed;
+#ifdef REPL_IO_URING
+        struct io_uring m_ring;
+        bool m_ring_ok;
+#endif
+
+    private:
+        writer(const writer&);
+        writer& operator = (const writer&);
+};
+
+struct acceptor::writer::record
+{
+    record() : ls(NULL), buf(NULL), opnum(0) {}
+    record(log_segment* l, e::buffer* b, uint64_t o) : ls(l), buf(b), opnum(o) {}
+    ~record() throw () {}
+
+    log_segment* ls;
+    e::buffer* buf;
+    uint64_t opnum;
+};
+
+acceptor :: log_summary :: log_summary()
+    : lognum(0)
+    , records(0)
+    , min_slot(UINT64_MAX)
+    , max_slot(0)
+    , highest_ballot()
+    , lowest_acceptable_slot(0)
+{
+}
+
+acceptor :: log_summary :: ~log_summary() throw ()
+{
+}
+
+acceptor :: log_segment :: log_segment(writer* _w)
+    : w(_w)
+    , lognum()
     , written(0)
+    , last_op(0)
+    , summary()
+    , offset(0)
     , fd()
-    , permafail(false)
-    , synced(0)
-    , sync_op(0)
-    , sync_in_progress(false)
-    , afsync()
-    , in_progress_synced(0)
-    , in_progress_sync_op(0)
 {
 }
 
@@ -106,173 +212,191 @@ acceptor :: log_segment :: ~log_segment() throw ()
 }
 
 bool
-acceptor :: log_segment :: open(int dir, uint64_t s)
+acceptor :: log_segment :: open(int dir, uint64_t s, uint64_t size)
 {
     lognum = s;
+    summary.lognum = s;
     std::ostringstream ostr;
     ostr << "log." << s;
-    fd = ::openat(dir, ostr.str().c_str(), O_WRONLY|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
-    return fd.get() >= 0;
+    const std::string name(ostr.str());
+    std::string recycled;
+
+    // A recycled segment has already been written end to end, so appending
+    // to it is a pure overwrite and fdatasync has no metadata to
+    // flush.  Fresh segments are preallocated so that at least the file size
+    // doesn't change with every append.
+    if (take_recycled_log(&recycled) &&
+        renameat(dir, recycled.c_str(), dir, name.c_str()) == 0)
+    {
+        fd = ::openat(dir, name.c_str(), O_WRONLY);
+    }
+    else
+    {
+        fd = ::openat(dir, name.c_str(), O_WRONLY|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+    }
+
+    if (fd.get() < 0)
+    {
+        return false;
+    }
+
+    if (fallocate(fd.get(), 0, 0, size) < 0)
+    {
+        if (errno != EOPNOTSUPP)
+        {
+            return false;
+        }
+
+        int ret = posix_fallocate(fd.get(), 0, size);
+
+        if (ret != 0)
+        {
+            errno = ret;
+            return false;
+        }
+    }
+
+    return fsync(dir) >= 0;
 }
 
 bool
-acceptor :: log_segment :: write_ballot(const ballot& b)
+acceptor :: log_segment :: write_ballot(const ballot& b, uint64_t opnum)
 {
-    std::auto_ptr<e::buffer> buf(e::buffer::create(1 + pack_size(b)));
-    buf->pack_at(0) << uint8_t('A') << b;
-    return write(buf);
+    std::auto_ptr<e::buffer> buf(e::buffer::create(1 + 2 * sizeof(uint32_t) + pack_size(b)));
+    buf->pack_at(0) << uint8_t('a' | RECORD_GENERATION) << uint32_t(lognum) << b;
+    summary.highest_ballot = std::max(summary.highest_ballot, b);
+    return write(buf, opnum);
 }
 
 bool
-acceptor :: log_segment :: write_pval(const pvalue& pval)
+acceptor :: log_segment :: write_pval(const pvalue& pval, uint64_t opnum)
 {
-    std::auto_ptr<e::buffer> buf(e::buffer::create(1 + pack_size(pval)));
-    buf->pack_at(0) << uint8_t('B') << pval;
-    return write(buf);
+    std::auto_ptr<e::buffer> buf(e::buffer::create(1 + 2 * sizeof(uint32_t) + pack_size(pval)));
+    buf->pack_at(0) << uint8_t('b' | RECORD_GENERATION) << uint32_t(lognum) << pval;
+    summary.highest_ballot = std::max(summary.highest_ballot, pval.b);
+    summary.min_slot = std::min(summary.min_slot, pval.s);
+    summary.max_slot = std::max(summary.max_slot, pval.s);
+    return write(buf, opnum);
 }
 
 bool
-acceptor :: log_segment :: write_gc(uint64_t below)
+acceptor :: log_segment :: write_gc(uint64_t below, uint64_t opnum)
 {
-    std::auto_ptr<e::buffer> buf(e::buffer::create(1 + sizeof(uint64_t)));
-    buf->pack_at(0) << uint8_t('G') << below;
-    return write(buf);
+    std::auto_ptr<e::buffer> buf(e::buffer::create(1 + 2 * sizeof(uint32_t) + sizeof(uint64_t)));
+    buf->pack_at(0) << uint8_t('g' | RECORD_GENERATION) << uint32_t(lognum) << below;
+    summary.lowest_acceptable_slot = std::max(summary.lowest_acceptable_slot, below);
+    return write(buf, opnum);
 }
 
 bool
-acceptor :: log_segment :: write(std::auto_ptr<e::buffer> buf)
+acceptor :: log_segment :: write(std::auto_ptr<e::buffer> buf, uint64_t opnum)
 {
+    buf->pack_at(buf->size()) << crc32c(buf->data(), buf->size());
     written += buf->size();
-
-    if (fd.xwrite(buf->data(), buf->size()) != ssize_t(buf->size()))
-    {
-        permafail = true;
-        return false;
-    }
-
-    return true;
+    last_op = opnum;
+    ++summary.records;
+    return w->append(this, buf, opnum);
 }
 
-bool
-acceptor :: log_segment :: all_synced()
+acceptor :: writer :: writer(acceptor* a)
+    : m_acceptor(a)
+    , m_thread(po6::threads::make_obj_func(&writer::run, this))
+    , m_mtx()
+    , m_cnd(&m_mtx)
+    , m_durable_cnd(&m_mtx)
+    , m_queue()
+    , m_durable(0)
+    , m_failed(false)
+    , m_killed(false)
+#ifdef REPL_IO_URING
+    , m_ring()
+    , m_ring_ok(false)
+#endif
 {
-    return !permafail && written == synced;
-}
+#ifdef REPL_IO_URING
+    int ret = io_uring_queue_init(REPLICANT_IO_URING_ENTRIES, &m_ring, 0);
 
-void
-acceptor :: log_segment :: maybe_sync(uint64_t opnum)
-{
-    if (permafail)
+    if (ret < 0)
     {
-        return;
+        LOG(WARNING) << "could not set up io_uring (" << po6::strerror(-ret)
+                     << "); falling back to pwritev for the acceptor log";
     }
 
-    if (sync_in_progress && aio_error(&afsync) == EINPROGRESS)
-    {
-        return;
-    }
+    m_ring_ok = ret >= 0;
+#endif
+    m_thread.start();
+}
 
-    sync_in_progress = false;
+acceptor :: writer :: ~writer() throw ()
+{
+    m_thread.join();
 
-    if (aio_return(&afsync) != 0)
+#ifdef REPL_IO_URING
+    if (m_ring_ok)
     {
-        LOG(ERROR) << "acceptor failing permanently: " << po6::strerror(errno);
-        permafail = true;
-        return;
+        io_uring_queue_exit(&m_ring);
     }
+#endif
 
-    synced = in_progress_synced;
-    sync_op = in_progress_sync_op;
-
-    if (written <= synced)
+    for (size_t i = 0; i < m_queue.size(); ++i)
     {
-        return;
+        delete m_queue[i].buf;
     }
+}
 
-    memset(&afsync, 0, sizeof(afsync));
-    afsync.aio_fildes = fd.get();
-    afsync.aio_sigevent.sigev_notify = SIGEV_NONE;
-    int ret = aio_fsync(O_SYNC, &afsync);
+bool
+acceptor :: writer :: append(log_segment* ls, std::auto_ptr<e::buffer> buf, uint64_t opnum)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
 
-    if (ret != 0)
+    if (m_failed)
     {
-        permafail = true;
-        return;
+        return false;
     }
 
-    sync_in_progress = true;
-    in_progress_synced = written;
-    in_progress_sync_op = opnum;
+    m_queue.push_back(record(ls, buf.release(), opnum));
+    m_cnd.signal();
+    return true;
 }
 
 uint64_t
-acceptor :: log_segment :: sync_cut()
+acceptor :: writer :: durable_cut()
 {
-    return sync_op;
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_durable;
 }
 
-class acceptor::garbage_collector
+bool
+acceptor :: writer :: wait_durable(uint64_t opnum)
 {
-    public:
-        garbage_collector(acceptor* a);
-        ~garbage_collector() throw ();
-
-    public:
-        void gc(uint64_t lognum, uint64_t slot);
-        void kill();
-        void run();
-        void collect(const uint64_t lognum, const uint64_t below);
-
-    private:
-        acceptor* const m_acceptor;
-        po6::threads::thread m_thread;
-        po6::threads::mutex m_mtx;
-        po6::threads::cond m_cnd;
-        uint64_t m_below_lognum;
-        uint64_t m_below_slot;
-        bool m_killed;
-
-    private:
-        garbage_collector(const garbage_collector&);
-        garbage_collector& operator = (const garbage_collector&);
-};
+    po6::threads::mutex::hold hold(&m_mtx);
 
-acceptor :: garbage_collector :: garbage_collector(acceptor* a)
-    : m_acceptor(a)
-    , m_thread(po6::threads::make_obj_func(&garbage_collector::run, this))
-    , m_mtx()
-    , m_cnd(&m_mtx)
-    , m_below_lognum(0)
-    , m_below_slot(0)
-    , m_killed(false)
-{
-    m_thread.start();
-}
+    while (m_durable < opnum && !m_failed && !m_killed)
+    {
+        m_durable_cnd.wait();
+    }
 
-acceptor :: garbage_collector :: ~garbage_collector() throw ()
-{
-    m_thread.join();
+    return m_durable >= opnum;
 }
 
-void
-acceptor :: garbage_collector :: gc(uint64_t lognum, uint64_t slot)
+bool
+acceptor :: writer :: failed()
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    m_below_lognum = lognum;
-    m_below_slot = slot;
-    m_cnd.signal();
+    return m_failed;
 }
 
 void
-acceptor :: garbage_collector :: kill()
+acceptor :: writer :: kill()
 {
     po6::threads::mutex::hold hold(&m_mtx);
     m_killed = true;
     m_cnd.signal();
+    m_durable_cnd.broadcast();
 }
 
 void
-acceptor :: garbage_collector :: run()
+acceptor :: writer :: run()
 {
     sigset_t ss;
 
@@ -290,12 +414,12 @@ acceptor :: garbage_collector :: run()
         return;
     }
 
+    std::vector<record> group;
     m_mtx.lock();
-    uint64_t gced = 0;
 
     while (true)
     {
-        while (gced >= m_below_slot && !m_killed)
+        while (m_queue.empty() && !m_killed)
         {
             m_cnd.wait();
         }
@@ -305,139 +429,968 @@ acceptor :: garbage_collector :: run()
             break;
         }
 
-        uint64_t lognum = m_below_lognum;
-        uint64_t below = m_below_slot;
+        group.swap(m_queue);
         m_mtx.unlock();
-        collect(lognum, below);
+        const bool success = write_group(group);
+        const uint64_t opnum = group.back().opnum;
+
+        for (size_t i = 0; i < group.size(); ++i)
+        {
+            delete group[i].buf;
+        }
+
+        group.clear();
         m_mtx.lock();
-        gced = below;
+
+        if (success)
+        {
+            m_durable = opnum;
+        }
+        else
+        {
+            m_failed = true;
+        }
+
+        m_durable_cnd.broadcast();
+        m_mtx.unlock();
+        m_acceptor->m_daemon->callback_acceptor_synced();
+        m_mtx.lock();
+    }
+
+    m_mtx.unlock();
+}
+
+bool
+acceptor :: writer :: write_group(const std::vector<record>& group)
+{
+#ifdef REPL_IO_URING
+    bool handled = false;
+    const bool success = write_group_uring(group, &handled);
+
+    if (handled)
+    {
+        return success;
+    }
+#endif
+
+    size_t start = 0;
+    log_segment* touched[2] = {NULL, NULL};
+
+    while (start < group.size())
+    {
+        log_segment* ls = group[start].ls;
+        size_t limit = start;
+
+        while (limit < group.size() && group[limit].ls == ls)
+        {
+            ++limit;
+        }
+
+        if (!write_run(ls, &group[start], limit - start))
+        {
+            return false;
+        }
+
+        // at most the previous and current segments are ever written
+        if (touched[0] != ls && touched[1] != ls)
+        {
+            touched[touched[0] ? 1 : 0] = ls;
+        }
+
+        start = limit;
+    }
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (touched[i] && fdatasync(touched[i]->fd.get()) < 0)
+        {
+            LOG(ERROR) << "acceptor failing permanently: " << po6::strerror(errno);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+acceptor :: writer :: write_run(log_segment* ls, const record* recs, size_t recs_sz)
+{
+    std::vector<struct iovec> iovs;
+
+    for (size_t i = 0; i < recs_sz; ++i)
+    {
+        struct iovec iov;
+        iov.iov_base = recs[i].buf->data();
+        iov.iov_len = recs[i].buf->size();
+        iovs.push_back(iov);
+    }
+
+    struct iovec* iov = &iovs[0];
+    size_t iov_sz = iovs.size();
+
+    while (iov_sz > 0)
+    {
+        ssize_t ret = ::pwritev(ls->fd.get(), iov, int(std::min(iov_sz, size_t(IOV_MAX))), ls->offset);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (ret < 0)
+        {
+            LOG(ERROR) << "acceptor failing permanently: " << po6::strerror(errno);
+            return false;
+        }
+
+        size_t amt = ret;
+        ls->offset += amt;
+
+        while (iov_sz > 0 && amt >= iov->iov_len)
+        {
+            amt -= iov->iov_len;
+            ++iov;
+            --iov_sz;
+        }
+
+        if (iov_sz > 0)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + amt;
+            iov->iov_len -= amt;
+        }
+    }
+
+    return true;
+}
+
+#ifdef REPL_IO_URING
+bool
+acceptor :: writer :: write_group_uring(const std::vector<record>& group, bool* handled)
+{
+    *handled = false;
+
+    if (!m_ring_ok)
+    {
+        return false;
+    }
+
+    // Each segment's writes are linked to its fdatasync, so the whole group
+    // goes to the kernel with one io_uring_enter.  Groups that won't fit
+    // in the submission queue take the pwritev path instead.
+    std::vector<std::pair<size_t, size_t> > runs;
+    size_t needed = 0;
+
+    for (size_t start = 0; start < group.size(); )
+    {
+        size_t limit = start;
+
+        while (limit < group.size() && group[limit].ls == group[start].ls)
+        {
+            ++limit;
+        }
+
+        runs.push_back(std::make_pair(start, limit));
+        needed += (limit - start + IOV_MAX - 1) / IOV_MAX + 1;
+        start = limit;
+    }
+
+    if (needed > io_uring_sq_space_left(&m_ring))
+    {
+        return false;
+    }
+
+    *handled = true;
+    std::vector<struct iovec> iovs(group.size());
+    std::vector<int64_t> expected;
+
+    for (size_t i = 0; i < group.size(); ++i)
+    {
+        iovs[i].iov_base = group[i].buf->data();
+        iovs[i].iov_len = group[i].buf->size();
+    }
+
+    for (size_t r = 0; r < runs.size(); ++r)
+    {
+        log_segment* ls = group[runs[r].first].ls;
+
+        for (size_t i = runs[r].first; i < runs[r].second; i += IOV_MAX)
+        {
+            const size_t n = std::min(runs[r].second - i, size_t(IOV_MAX));
+            int64_t bytes = 0;
+
+            for (size_t j = i; j < i + n; ++j)
+            {
+                bytes += iovs[j].iov_len;
+            }
+
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+            assert(sqe);
+            io_uring_prep_writev(sqe, ls->fd.get(), &iovs[i], n, ls->offset);
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(expected.size()));
+            expected.push_back(bytes);
+            ls->offset += bytes;
+        }
+
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+        assert(sqe);
+        io_uring_prep_fsync(sqe, ls->fd.get(), IORING_FSYNC_DATASYNC);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(expected.size()));
+        expected.push_back(0);
     }
 
-    m_mtx.unlock();
+    int ret = io_uring_submit_and_wait(&m_ring, expected.size());
+
+    if (ret < 0)
+    {
+        LOG(ERROR) << "acceptor failing permanently: " << po6::strerror(-ret);
+        return false;
+    }
+
+    bool success = true;
+
+    for (size_t seen = 0; seen < expected.size(); ++seen)
+    {
+        struct io_uring_cqe* cqe = NULL;
+
+        // the completions are already posted, so this doesn't enter the kernel
+        ret = io_uring_peek_cqe(&m_ring, &cqe);
+
+        if (ret == -EAGAIN)
+        {
+            ret = io_uring_wait_cqe(&m_ring, &cqe);
+        }
+
+        if (ret < 0)
+        {
+            LOG(ERROR) << "acceptor failing permanently: " << po6::strerror(-ret);
+            return false;
+        }
+
+        const size_t idx = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+
+        if (cqe->res < 0 && success)
+        {
+            LOG(ERROR) << "acceptor failing permanently: " << po6::strerror(-cqe->res);
+            success = false;
+        }
+        else if (idx < expected.size() && cqe->res != expected[idx] && success)
+        {
+            LOG(ERROR) << "acceptor failing permanently: short write to the log";
+            success = false;
+        }
+
+        io_uring_cqe_seen(&m_ring, cqe);
+    }
+
+    return success;
+}
+#endif
+
+class acceptor::garbage_collector
+{
+    public:
+        garbage_collector(acceptor* a);
+        ~garbage_collector() throw ();
+
+    public:
+        void gc(uint64_t lognum, uint64_t slot);
+        void seal(const log_summary& summary);
+        void kill();
+        void run();
+        void collect(const uint64_t lognum, const uint64_t below);
+        bool recycle(uint64_t lognum);
+        bool write_index(const log_summary& summary);
+        bool unlink_index(uint64_t lognum);
+
+    private:
+        acceptor* const m_acceptor;
+        po6::threads::thread m_thread;
+        po6::threads::mutex m_mtx;
+        po6::threads::cond m_cnd;
+        uint64_t m_below_lognum;
+        uint64_t m_below_slot;
+        std::vector<log_summary> m_sealed;
+        bool m_killed;
+
+    private:
+        garbage_collector(const garbage_collector&);
+        garbage_collector& operator = (const garbage_collector&);
+};
+
+acceptor :: garbage_collector :: garbage_collector(acceptor* a)
+    : m_acceptor(a)
+    , m_thread(po6::threads::make_obj_func(&garbage_collector::run, this))
+    , m_mtx()
+    , m_cnd(&m_mtx)
+    , m_below_lognum(0)
+    , m_below_slot(0)
+    , m_sealed()
+    , m_killed(false)
+{
+    m_thread.start();
+}
+
+acceptor :: garbage_collector :: ~garbage_collector() throw ()
+{
+    m_thread.join();
+}
+
+void
+acceptor :: garbage_collector :: gc(uint64_t lognum, uint64_t slot)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_below_lognum = lognum;
+    m_below_slot = slot;
+    m_cnd.signal();
+}
+
+void
+acceptor :: garbage_collector :: seal(const log_summary& summary)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_sealed.push_back(summary);
+    m_cnd.signal();
+}
+
+void
+acceptor :: garbage_collector :: kill()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_killed = true;
+    m_cnd.signal();
+}
+
+void
+acceptor :: garbage_collector :: run()
+{
+    sigset_t ss;
+
+    if (sigfillset(&ss) < 0)
+    {
+        PLOG(ERROR) << "sigfillset";
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    if (pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
+    {
+        PLOG(ERROR) << "could not block signals";
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
+    }
+
+    std::vector<log_summary> sealed;
+    m_mtx.lock();
+    uint64_t gced = 0;
+
+    while (true)
+    {
+        while (gced >= m_below_slot && m_sealed.empty() && !m_killed)
+        {
+            m_cnd.wait();
+        }
+
+        // segments sealed at shutdown are still indexed before exiting
+        if (m_killed && m_sealed.empty())
+        {
+            break;
+        }
+
+        const bool killed = m_killed;
+        uint64_t lognum = m_below_lognum;
+        uint64_t below = m_below_slot;
+        sealed.swap(m_sealed);
+        m_mtx.unlock();
+
+        // a missing index only costs a replay, so failures here are benign
+        for (size_t i = 0; i < sealed.size(); ++i)
+        {
+            if (!write_index(sealed[i]))
+            {
+                LOG(WARNING) << "could not write index for log." << sealed[i].lognum
+                             << ": " << po6::strerror(errno);
+            }
+        }
+
+        sealed.clear();
+
+        if (gced < below && !killed)
+        {
+            collect(lognum, below);
+        }
+
+        m_mtx.lock();
+        gced = below;
+    }
+
+    m_mtx.unlock();
+}
+
+void
+acceptor :: garbage_collector :: collect(const uint64_t lognum, const uint64_t below)
+{
+    std::vector<uint64_t> lognums;
+    std::vector<uint64_t> replicas;
+    size_t recycled = 0;
+    DIR* d = opendir(".");
+
+    if (!d)
+    {
+        return;
+    }
+
+    e::guard g_d = e::makeguard(closedir, d);
+    struct dirent* de = NULL;
+    errno = 0;
+
+    while ((de = readdir(d)))
+    {
+        if (strncmp(de->d_name, "log.", 4) == 0)
+        {
+            char* end = NULL;
+            uint64_t log = strtoull(de->d_name + 4, &end, 10);
+
+            if (*end == '\0')
+            {
+                lognums.push_back(log);
+            }
+        }
+
+        if (strncmp(de->d_name, "replica.", 8) == 0)
+        {
+            char* end = NULL;
+            uint64_t replica = strtoull(de->d_name + 8, &end, 10);
+
+            if (*end == '\0')
+            {
+                replicas.push_back(replica);
+            }
+        }
+
+        if (strncmp(de->d_name, "recycle.", 8) == 0)
+        {
+            ++recycled;
+        }
+    }
+
+    std::sort(lognums.begin(), lognums.end());
+    std::sort(replicas.begin(), replicas.end());
+
+    for (size_t i = 0; i + 2 < lognums.size(); ++i)
+    {
+        if (lognums[i] >= lognum)
+        {
+            break;
+        }
+
+        log_summary summary;
+        uint64_t highest_slot = 0;
+
+        if (read_index(m_acceptor->m_dir.get(), lognums[i], &summary))
+        {
+            highest_slot = summary.max_slot;
+        }
+        else
+        {
+            ballot ballot;
+            std::vector<pvalue> pvals;
+            uint64_t lowest_acceptable_slot = 0;
+
+            if (!replay_log(m_acceptor->m_dir.get(), lognums[i], below, &ballot, &pvals, &lowest_acceptable_slot))
+            {
+                return;
+            }
+
+            for (size_t p = 0; p < pvals.size(); ++p)
+            {
+                highest_slot = std::max(highest_slot, pvals[p].s);
+            }
+        }
+
+        if (highest_slot >= below)
+        {
+            break;
+        }
+
+        if (!unlink_index(lognums[i]))
+        {
+            return;
+        }
+
+        if (recycled < REPLICANT_LOG_SEGMENTS_RECYCLED)
+        {
+            if (!recycle(lognums[i]))
+            {
+                return;
+            }
+
+            ++recycled;
+        }
+        else
+        {
+            std::ostringstream ostr;
+            ostr << "log." << lognums[i];
+
+            if (unlink(ostr.str().c_str()) < 0)
+            {
+                return;
+            }
+        }
+    }
+
+    for (size_t i = 0; i + 5 < replicas.size(); ++i)
+    {
+        if (replicas[i] >= below)
+        {
+            break;
+        }
+
+        std::ostringstream ostr;
+        ostr << "replica." << replicas[i];
+
+        if (unlink(ostr.str().c_str()) < 0)
+        {
+            return;
+        }
+    }
+}
+
+// Set the segment aside for get_writable_log.  Its records stay where they
+// are:  they carry the segment's old number as their generation, so replay
+// stops at the first of them once the segment is reused under a new number.
+// Segments written before records carried a generation are still overwritten
+// with zeros first, because nothing else would tell their records apart.
+// Every step is made durable before the next so that a crash leaves behind
+// either a log full of records that are below the GC point anyway, or a log
+// that can no longer be replayed past its new records.
+bool
+acceptor :: garbage_collector :: recycle(uint64_t lognum)
+{
+    std::ostringstream ostr;
+    ostr << "log." << lognum;
+    const std::string name(ostr.str());
+    ostr.str("");
+    ostr << "recycle." << lognum;
+    const std::string recycled(ostr.str());
+    po6::io::fd fd(::open(name.c_str(), O_RDWR));
+    struct stat st;
+
+    // the index must be gone for good before the records it describes are
+    if (fd.get() < 0 || fstat(fd.get(), &st) < 0 ||
+        fsync(m_acceptor->m_dir.get()) < 0)
+    {
+        return false;
+    }
+
+    uint8_t t = 0;
+
+    if (pread(fd.get(), &t, 1, 0) < 0)
+    {
+        return false;
+    }
+
+    std::vector<char> zeros;
+    uint64_t size = (t & RECORD_GENERATION) ? 0 : st.st_size;
+    uint64_t offset = 0;
+
+    if (size > 0)
+    {
+        zeros.resize(1ULL << 20, 0);
+    }
+
+    while (offset < size)
+    {
+        size_t amt = std::min(size - offset, uint64_t(zeros.size()));
+        ssize_t ret = pwrite(fd.get(), &zeros[0], amt, offset);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (ret <= 0)
+        {
+            return false;
+        }
+
+        offset += ret;
+    }
+
+    if ((size > 0 && fdatasync(fd.get()) < 0) ||
+        rename(name.c_str(), recycled.c_str()) < 0 ||
+        fsync(m_acceptor->m_dir.get()) < 0)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool
+acceptor :: garbage_collector :: write_index(const log_summary& s)
+{
+    std::auto_ptr<e::buffer> buf(e::buffer::create(5 * sizeof(uint64_t) + pack_size(s.highest_ballot)));
+    buf->pack_at(0) << s.lognum << s.records
+                    << s.min_slot << s.max_slot
+                    << s.highest_ballot << s.lowest_acceptable_slot;
+    std::ostringstream ostr;
+    ostr << "index." << s.lognum;
+    const int dir = m_acceptor->m_dir.get();
+    po6::io::fd fd(openat(dir, ".index.tmp", O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+    return fd.get() >= 0 &&
+           fd.xwrite(buf->data(), buf->size()) == ssize_t(buf->size()) &&
+           fdatasync(fd.get()) >= 0 &&
+           renameat(dir, ".index.tmp", dir, ostr.str().c_str()) >= 0;
+}
+
+bool
+acceptor :: garbage_collector :: unlink_index(uint64_t lognum)
+{
+    std::ostringstream ostr;
+    ostr << "index." << lognum;
+    return unlink(ostr.str().c_str()) >= 0 || errno == ENOENT;
+}
+
+bool
+acceptor :: take_recycled_log(std::string* name)
+{
+    DIR* d = opendir(".");
+
+    if (!d)
+    {
+        return false;
+    }
+
+    e::guard g_d = e::makeguard(closedir, d);
+    struct dirent* de = NULL;
+
+    while ((de = readdir(d)))
+    {
+        if (strncmp(de->d_name, "recycle.", 8) == 0)
+        {
+            *name = de->d_name;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Replays log segments on as many threads as there are cores.  Each segment is
+// decoded and compacted on its own, and the results are merged by slot once
+// every segment is done.
+class acceptor::log_replayer
+{
+    public:
+        log_replayer(int dir, uint64_t skip_below);
+        ~log_replayer() throw ();
+
+    public:
+        void add(uint64_t lognum);
+        bool replay(ballot* highest_ballot,
+                    std::vector<pvalue>* pvals,
+                    uint64_t* lowest_acceptable_slot);
+        size_t threads() const { return m_threads; }
+
+    private:
+        struct segment;
+        void run();
+
+    private:
+        const int m_dir;
+        const uint64_t m_skip_below;
+        std::vector<segment> m_segments;
+        po6::threads::mutex m_mtx;
+        size_t m_next;
+        size_t m_threads;
+
+    private:
+        log_replayer(const log_replayer&);
+        log_replayer& operator = (const log_replayer&);
+};
+
+struct acceptor::log_replayer::segment
+{
+    segment(uint64_t l)
+        : lognum(l), highest_ballot(), pvals(), lowest_acceptable_slot(0), success(false) {}
+    ~segment() throw () {}
+
+    uint64_t lognum;
+    ballot highest_ballot;
+    std::vector<pvalue> pvals;
+    uint64_t lowest_acceptable_slot;
+    bool success;
+};
+
+acceptor :: log_replayer :: log_replayer(int dir, uint64_t skip_below)
+    : m_dir(dir)
+    , m_skip_below(skip_below)
+    , m_segments()
+    , m_mtx()
+    , m_next(0)
+    , m_threads(0)
+{
+}
+
+acceptor :: log_replayer :: ~log_replayer() throw ()
+{
+}
+
+void
+acceptor :: log_replayer :: add(uint64_t lognum)
+{
+    m_segments.push_back(segment(lognum));
+}
+
+bool
+acceptor :: log_replayer :: replay(ballot* highest_ballot,
+                                   std::vector<pvalue>* pvals,
+                                   uint64_t* lowest_acceptable_slot)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    m_threads = std::min(size_t(std::max(cores, 1L)), m_segments.size());
+    std::vector<po6::threads::thread*> threads;
+
+    for (size_t i = 1; i < m_threads; ++i)
+    {
+        threads.push_back(new po6::threads::thread(po6::threads::make_obj_func(&log_replayer::run, this)));
+        threads.back()->start();
+    }
+
+    run();
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    for (size_t i = 0; i < m_segments.size(); ++i)
+    {
+        if (!m_segments[i].success)
+        {
+            return false;
+        }
+
+        *highest_ballot = std::max(*highest_ballot, m_segments[i].highest_ballot);
+        *lowest_acceptable_slot = std::max(*lowest_acceptable_slot, m_segments[i].lowest_acceptable_slot);
+        pvals->insert(pvals->end(), m_segments[i].pvals.begin(), m_segments[i].pvals.end());
+        std::vector<pvalue>().swap(m_segments[i].pvals);
+    }
+
+    compact_pvals(*lowest_acceptable_slot, pvals);
+    return true;
+}
+
+void
+acceptor :: log_replayer :: run()
+{
+    while (true)
+    {
+        segment* seg = NULL;
+
+        {
+            po6::threads::mutex::hold hold(&m_mtx);
+
+            if (m_next >= m_segments.size())
+            {
+                return;
+            }
+
+            seg = &m_segments[m_next];
+            ++m_next;
+        }
+
+        seg->success = replay_log(m_dir, seg->lognum, m_skip_below,
+                                  &seg->highest_ballot, &seg->pvals,
+                                  &seg->lowest_acceptable_slot);
+
+        if (seg->success)
+        {
+            compact_pvals(seg->lowest_acceptable_slot, &seg->pvals);
+        }
+    }
+}
+
+// Persists replica snapshots so that the event loop never waits on them.  Only
+// the newest pending snapshot is kept; an older one that hasn't been started
+// by the time a newer one arrives is simply dropped.
+class acceptor::snapshot_writer
+{
+    public:
+        snapshot_writer(acceptor* a);
+        ~snapshot_writer() throw ();
+
+    public:
+        void enqueue(uint64_t slot, e::intrusive_ptr<snapshot> snap);
+        uint64_t durable();
+        void kill();
+        void run();
+
+    private:
+        acceptor* const m_acceptor;
+        po6::threads::thread m_thread;
+        po6::threads::mutex m_mtx;
+        po6::threads::cond m_cnd;
+        uint64_t m_pending_slot;
+        e::intrusive_ptr<snapshot> m_pending;
+        uint64_t m_durable;
+        bool m_killed;
+
+    private:
+        snapshot_writer(const snapshot_writer&);
+        snapshot_writer& operator = (const snapshot_writer&);
+};
+
+acceptor :: snapshot_writer :: snapshot_writer(acceptor* a)
+    : m_acceptor(a)
+    , m_thread(po6::threads::make_obj_func(&snapshot_writer::run, this))
+    , m_mtx()
+    , m_cnd(&m_mtx)
+    , m_pending_slot(0)
+    , m_pending()
+    , m_durable(0)
+    , m_killed(false)
+{
+    m_thread.start();
+}
+
+acceptor :: snapshot_writer :: ~snapshot_writer() throw ()
+{
+    m_thread.join();
+}
+
+void
+acceptor :: snapshot_writer :: enqueue(uint64_t slot, e::intrusive_ptr<snapshot> snap)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_pending_slot = slot;
+    m_pending = snap;
+    m_cnd.signal();
+}
+
+uint64_t
+acceptor :: snapshot_writer :: durable()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    return m_durable;
+}
+
+void
+acceptor :: snapshot_writer :: kill()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_killed = true;
+    m_cnd.signal();
 }
 
 void
-acceptor :: garbage_collector :: collect(const uint64_t lognum, const uint64_t below)
+acceptor :: snapshot_writer :: run()
 {
-    std::vector<uint64_t> lognums;
-    std::vector<uint64_t> replicas;
-    DIR* d = opendir(".");
+    sigset_t ss;
 
-    if (!d)
+    if (sigfillset(&ss) < 0)
     {
+        PLOG(ERROR) << "sigfillset";
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
         return;
     }
 
-    e::guard g_d = e::makeguard(closedir, d);
-    struct dirent* de = NULL;
-    errno = 0;
-
-    while ((de = readdir(d)))
+    if (pthread_sigmask(SIG_BLOCK, &ss, NULL) < 0)
     {
-        if (strncmp(de->d_name, "log.", 4) == 0)
-        {
-            char* end = NULL;
-            uint64_t log = strtoull(de->d_name + 4, &end, 10);
-
-            if (*end == '\0')
-            {
-                lognums.push_back(log);
-            }
-        }
-
-        if (strncmp(de->d_name, "replica.", 8) == 0)
-        {
-            char* end = NULL;
-            uint64_t replica = strtoull(de->d_name + 8, &end, 10);
-
-            if (*end == '\0')
-            {
-                replicas.push_back(replica);
-            }
-        }
+        PLOG(ERROR) << "could not block signals";
+        LOG(ERROR) << "could not successfully block signals; this could result in undefined behavior";
+        return;
     }
 
-    std::sort(lognums.begin(), lognums.end());
-    std::sort(replicas.begin(), replicas.end());
+    m_mtx.lock();
 
-    for (size_t i = 0; i + 2 < lognums.size(); ++i)
+    while (true)
     {
-        if (lognums[i] >= lognum)
-        {
-            break;
-        }
-
-        ballot ballot;
-        std::vector<pvalue> pvals;
-        uint64_t lowest_acceptable_slot;
-
-        if (!replay_log(m_acceptor->m_dir.get(), lognums[i], &ballot, &pvals, &lowest_acceptable_slot))
-        {
-            return;
-        }
-
-        uint64_t highest_slot = 0;
-
-        for (size_t p = 0; p < pvals.size(); ++p)
+        while (!m_pending && !m_killed)
         {
-            highest_slot = std::max(highest_slot, pvals[p].s);
+            m_cnd.wait();
         }
 
-        if (highest_slot >= below)
+        if (m_killed)
         {
             break;
         }
 
-        std::ostringstream ostr;
-        ostr << "log." << lognums[i];
-
-        if (unlink(ostr.str().c_str()) < 0)
-        {
-            return;
-        }
-    }
+        const uint64_t slot = m_pending_slot;
+        e::intrusive_ptr<snapshot> snap(m_pending);
+        m_pending = NULL;
+        m_mtx.unlock();
+        const bool success = write_snapshot(m_acceptor->m_dir.get(), slot, snap);
 
-    for (size_t i = 0; i + 5 < replicas.size(); ++i)
-    {
-        if (replicas[i] >= below)
+        if (!success)
         {
-            break;
+            LOG(ERROR) << "could not save snapshot: " << po6::strerror(errno);
         }
 
-        std::ostringstream ostr;
-        ostr << "replica." << replicas[i];
+        snap = NULL;
+        m_mtx.lock();
 
-        if (unlink(ostr.str().c_str()) < 0)
+        if (success)
         {
-            return;
+            m_durable = std::max(m_durable, slot);
+            m_mtx.unlock();
+            m_acceptor->m_daemon->callback_acceptor_synced();
+            m_mtx.lock();
         }
     }
+
+    m_mtx.unlock();
 }
 
-acceptor :: acceptor()
-    : m_ballot()
+acceptor :: acceptor(daemon* d)
+    : m_daemon(d)
+    , m_ballot()
     , m_pvals()
     , m_lowest_acceptable_slot(0)
     , m_dir()
     , m_lock()
     , m_opcount(0)
+    , m_segment_size(REPLICANT_LOG_SEGMENT_SIZE_DEFAULT)
     , m_permafail(true)
-    , m_current(new log_segment())
+    , m_current()
     , m_previous()
     , m_gc(new garbage_collector(this))
+    , m_writer(new writer(this))
+    , m_snapshot_writer(new snapshot_writer(this))
 {
+    m_current.reset(new log_segment(m_writer.get()));
 }
 
 acceptor :: ~acceptor() throw ()
 {
+    // Open picks a fresh segment after every existing one, so the segments
+    // still being written will never change again.  On a clean shutdown,
+    // index them once they are durable so the next start need not replay
+    // them.
+    if (!m_permafail && m_current.get() && m_current->fd.get() >= 0 &&
+        m_writer->wait_durable(m_current->last_op))
+    {
+        if (m_previous.get())
+        {
+            m_gc->seal(m_previous->summary);
+        }
+
+        m_gc->seal(m_current->summary);
+    }
+
     m_gc->kill();
+    m_writer->kill();
+    m_snapshot_writer->kill();
 }
 
 bool
 acceptor :: open(const std::string& dir,
+                 uint64_t segment_size,
                  bool* saved, server* saved_us,
                  bootstrap* saved_bootstrap)
 {
+    m_segment_size = segment_size;
     struct stat stbuf;
     int ret = stat(dir.c_str(), &stbuf);
 
@@ -546,19 +1499,52 @@ acceptor :: open(const std::string& dir,
     }
 
     std::sort(lognums.begin(), lognums.end());
+    std::vector<log_summary> summaries(lognums.size());
+    std::vector<bool> indexed(lognums.size(), false);
 
+    // Everything below the highest GC point is discarded after replay, so any
+    // indexed segment whose slots all fall below it need not be replayed.
     for (size_t i = 0; i < lognums.size(); ++i)
     {
-        if (!replay_log(m_dir.get(), lognums[i], &m_ballot, &m_pvals, &m_lowest_acceptable_slot))
+        indexed[i] = read_index(m_dir.get(), lognums[i], &summaries[i]);
+
+        if (indexed[i])
         {
-            LOG(ERROR) << "error reading acceptor state from disk";
-            return false;
+            m_lowest_acceptable_slot = std::max(m_lowest_acceptable_slot, summaries[i].lowest_acceptable_slot);
         }
+    }
+
+    const uint64_t replay_start = po6::monotonic_time();
+    log_replayer replayer(m_dir.get(), m_lowest_acceptable_slot);
+    size_t skipped = 0;
+
+    for (size_t i = 0; i < lognums.size(); ++i)
+    {
+        if (indexed[i] &&
+            (!summaries[i].has_pvals() ||
+             summaries[i].max_slot < m_lowest_acceptable_slot))
+        {
+            m_ballot = std::max(m_ballot, summaries[i].highest_ballot);
+            ++skipped;
+            continue;
+        }
+
+        replayer.add(lognums[i]);
+    }
 
-        pvals();
+    if (!replayer.replay(&m_ballot, &m_pvals, &m_lowest_acceptable_slot))
+    {
+        LOG(ERROR) << "error reading acceptor state from disk";
+        return false;
     }
 
-    if (!m_current->open(m_dir.get(), !lognums.empty() ? lognums.back() + 1 : 0))
+    const uint64_t replay_end = po6::monotonic_time();
+    LOG(INFO) << "replayed " << (lognums.size() - skipped) << "/" << lognums.size()
+              << " log segments (" << m_pvals.size() << " pvalues) using "
+              << replayer.threads() << " threads in "
+              << (replay_end - replay_start) / PO6_MILLIS << "ms";
+
+    if (!m_current->open(m_dir.get(), !lognums.empty() ? lognums.back() + 1 : 0, m_segment_size))
     {
         LOG(ERROR) << "could not open persistent log";
         return false;
@@ -584,6 +1570,12 @@ acceptor :: save(server saved_us,
     return true;
 }
 
+static bool
+compare_pvalue_slot(const replicant::pvalue& lhs, const replicant::pvalue& rhs)
+{
+    return lhs.s < rhs.s;
+}
+
 static bool
 compare_pvalue_slot_then_highest_ballot(const replicant::pvalue& lhs, const replicant::pvalue& rhs)
 {
@@ -601,30 +1593,30 @@ compare_pvalue_slot_then_highest_ballot(const replicant::pvalue& lhs, const repl
     }
 }
 
-const std::vector<replicant::pvalue>&
-acceptor :: pvals()
+void
+acceptor :: compact_pvals(uint64_t lowest_acceptable_slot,
+                          std::vector<pvalue>* pvals)
 {
     std::vector<pvalue> tmp;
-    std::sort(m_pvals.begin(), m_pvals.end(), compare_pvalue_slot_then_highest_ballot);
+    std::sort(pvals->begin(), pvals->end(), compare_pvalue_slot_then_highest_ballot);
     size_t idx = 0;
 
-    while (idx < m_pvals.size() && m_pvals[idx].s < m_lowest_acceptable_slot)
+    while (idx < pvals->size() && (*pvals)[idx].s < lowest_acceptable_slot)
     {
         ++idx;
     }
 
-    while (idx < m_pvals.size())
+    while (idx < pvals->size())
     {
-        tmp.push_back(m_pvals[idx]);
+        tmp.push_back((*pvals)[idx]);
 
-        while (idx < m_pvals.size() && m_pvals[idx].s == tmp.back().s)
+        while (idx < pvals->size() && (*pvals)[idx].s == tmp.back().s)
         {
             ++idx;
         }
     }
 
-    m_pvals.swap(tmp);
-    return m_pvals;
+    pvals->swap(tmp);
 }
 
 void
@@ -634,10 +1626,9 @@ acceptor :: adopt(const ballot& b)
     assert(b > m_ballot);
     log_segment* log = get_writable_log();
 
-    if (log && log->write_ballot(b))
+    if (log && log->write_ballot(b, ++m_opcount))
     {
         m_ballot = b;
-        log->maybe_sync(++m_opcount);
     }
     else
     {
@@ -652,10 +1643,28 @@ acceptor :: accept(const pvalue& pval)
     assert(pval.b == m_ballot);
     log_segment* log = get_writable_log();
 
-    if (log && log->write_pval(pval))
+    if (log && log->write_pval(pval, ++m_opcount))
     {
-        m_pvals.push_back(pval);
-        log->maybe_sync(++m_opcount);
+        // accepts almost always arrive in slot order; anything else is a
+        // (re)accept of a slot within the window at our current ballot
+        if (m_pvals.empty() || m_pvals.back().s < pval.s)
+        {
+            m_pvals.push_back(pval);
+        }
+        else
+        {
+            std::vector<pvalue>::iterator it;
+            it = std::lower_bound(m_pvals.begin(), m_pvals.end(), pval, compare_pvalue_slot);
+
+            if (it != m_pvals.end() && it->s == pval.s)
+            {
+                *it = pval;
+            }
+            else
+            {
+                m_pvals.insert(it, pval);
+            }
+        }
     }
     else
     {
@@ -670,10 +1679,9 @@ acceptor :: garbage_collect(uint64_t below)
     below = std::max(m_lowest_acceptable_slot, below);
     log_segment* log = get_writable_log();
 
-    if (log && log->write_gc(below))
+    if (log && log->write_gc(below, ++m_opcount))
     {
         m_lowest_acceptable_slot = below;
-        log->maybe_sync(++m_opcount);
         uint64_t lognum = log->lognum;
 
         if (m_previous.get())
@@ -682,7 +1690,10 @@ acceptor :: garbage_collect(uint64_t below)
         }
 
         m_gc->gc(lognum, below);
-        pvals();
+        pvalue bound;
+        bound.s = below;
+        m_pvals.erase(m_pvals.begin(),
+                      std::lower_bound(m_pvals.begin(), m_pvals.end(), bound, compare_pvalue_slot));
     }
     else
     {
@@ -693,37 +1704,37 @@ acceptor :: garbage_collect(uint64_t below)
 uint64_t
 acceptor :: sync_cut()
 {
-    if (m_previous.get())
+    if (m_writer->failed())
     {
-        m_previous->maybe_sync(++m_opcount);
-
-        if (m_previous->all_synced())
-        {
-            m_previous.reset();
-        }
-        else
-        {
-            return m_previous->sync_cut();
-        }
+        m_permafail = true;
     }
 
-    assert(m_current.get());
-    m_current->maybe_sync(++m_opcount);
-    return m_current->sync_cut();
+    const uint64_t cut = m_writer->durable_cut();
+    release_previous_if_durable(cut);
+    return cut;
 }
 
 bool
-acceptor :: record_snapshot(uint64_t slot, const e::slice& snapshot)
+acceptor :: record_snapshot(uint64_t slot, e::intrusive_ptr<snapshot> snap)
 {
-    std::ostringstream ostr;
-    ostr << "replica." << slot;
-    std::string tmp(snapshot.cdata(), snapshot.size());
-    return atomic_write(ostr.str().c_str(), tmp);
+    return write_snapshot(m_dir.get(), slot, snap);
+}
+
+void
+acceptor :: record_snapshot_async(uint64_t slot, e::intrusive_ptr<snapshot> snap)
+{
+    m_snapshot_writer->enqueue(slot, snap);
+}
+
+uint64_t
+acceptor :: snapshot_cut()
+{
+    return m_snapshot_writer->durable();
 }
 
 bool
 acceptor :: load_latest_snapshot(e::slice* snapshot,
-                                 std::auto_ptr<e::buffer>* snapshot_backing)
+                                 std::auto_ptr<po6::io::mmap>* snapshot_backing)
 {
     uint64_t max_replica = 0;
     std::string path;
@@ -757,17 +1768,44 @@ acceptor :: load_latest_snapshot(e::slice* snapshot,
         }
     }
 
-    std::string replica;
+    po6::io::fd fd(openat(m_dir.get(), path.c_str(), O_RDONLY));
+
+    if (fd.get() < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd.get(), &st) < 0)
+    {
+        return false;
+    }
+
+    if (st.st_size == 0)
+    {
+        LOG(ERROR) << "replica snapshot " << path << " is empty";
+        errno = EINVAL;
+        return false;
+    }
+
+    // parse straight out of the page cache rather than copying the file into
+    // a buffer; the mapping outlives the fd, which may be closed now
+    std::auto_ptr<po6::io::mmap> map(new po6::io::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0));
 
-    if (!atomic_read(path.c_str(), &replica))
+    if (!map->valid())
     {
+        errno = map->error();
         return false;
     }
 
-    snapshot_backing->reset(e::buffer::create(replica.size()));
-    (*snapshot_backing)->resize(replica.size());
-    memmove((*snapshot_backing)->data(), replica.data(), replica.size());
-    *snapshot = (*snapshot_backing)->as_slice();
+    if (madvise(map->base(), st.st_size, MADV_SEQUENTIAL) < 0)
+    {
+        PLOG(WARNING) << "could not advise sequential access to " << path;
+    }
+
+    *snapshot = e::slice(static_cast<const char*>(map->base()), st.st_size);
+    *snapshot_backing = map;
     return true;
 }
 
@@ -882,32 +1920,19 @@ acceptor :: get_writable_log()
         return NULL;
     }
 
-    if (m_current->permafail)
+    if (m_writer->failed())
     {
         m_permafail = true;
         return NULL;
     }
 
-    if (m_previous.get())
-    {
-        m_previous->maybe_sync(++m_opcount);
-
-        if (m_previous->all_synced())
-        {
-            m_previous.reset();
-        }
-        else if (m_previous->permafail)
-        {
-            m_permafail = true;
-            return NULL;
-        }
-    }
+    release_previous_if_durable(m_writer->durable_cut());
 
-    if (m_current->written >= 1ULL << 26 && !m_previous.get())
+    if (m_current->written >= m_segment_size && !m_previous.get())
     {
-        std::auto_ptr<log_segment> next(new log_segment());
+        std::auto_ptr<log_segment> next(new log_segment(m_writer.get()));
 
-        if (!next->open(m_dir.get(), m_current->lognum + 1))
+        if (!next->open(m_dir.get(), m_current->lognum + 1, m_segment_size))
         {
             LOG(ERROR) << "acceptor failing permanently while creating new log file: " << po6::strerror(errno);
             m_permafail = true;
@@ -915,16 +1940,28 @@ acceptor :: get_writable_log()
         }
 
         m_previous = m_current;
-        m_previous->maybe_sync(++m_opcount);
         m_current = next;
     }
 
     return m_current.get();
 }
 
+// The writer is done with the previous segment once all of its operations are
+// durable, and only then may an index vouch for its contents.
+void
+acceptor :: release_previous_if_durable(uint64_t cut)
+{
+    if (m_previous.get() && m_previous->last_op <= cut)
+    {
+        m_gc->seal(m_previous->summary);
+        m_previous.reset();
+    }
+}
+
 bool
 acceptor :: replay_log(int dir,
                        uint64_t lognum,
+                       uint64_t skip_below,
                        ballot* highest_ballot,
                        std::vector<pvalue>* pvals,
                        uint64_t* lowest_acceptable_slot)
@@ -959,58 +1996,210 @@ acceptor :: replay_log(int dir,
     }
 
     e::unpacker up(static_cast<const char*>(map.base()), st.st_size);
+    bool stamped = false;
 
-    while (up.remain() && !up.error())
+    while (up.remain())
     {
+        const e::slice rec(up.remainder());
         uint8_t t;
+        uint32_t generation = 0;
         up = up >> t;
 
-        if (up.error())
+        // segments are preallocated, so the first zero byte where a record
+        // would start is the end of the log
+        if (t == 0)
         {
-            LOG(ERROR) << "log errneously truncated";
-            return false;
+            return true;
         }
 
-        if (t == 'A')
+        // so is the first record left over from before the segment was
+        // recycled; once records carry a generation, the bytes of a stale
+        // record may also look like a record without one
+        if ((t & RECORD_GENERATION))
         {
-            ballot b;
-            up = up >> b;
+            up = up >> generation;
 
-            if (!up.error())
+            if (!up.error() && generation != uint32_t(lognum))
             {
-                *highest_ballot = std::max(*highest_ballot, b);
+                return true;
             }
+
+            t = uint8_t(t & ~RECORD_GENERATION);
+            stamped = true;
+        }
+        else if (stamped)
+        {
+            return true;
         }
 
-        if (t == 'B')
+        // lower case records are followed by a CRC32C of the type and body;
+        // upper case records predate checksums
+        ballot b;
+        uint64_t s = 0;
+        e::slice c;
+        bool corrupt = false;
+
+        if (t == 'A' || t == 'a')
+        {
+            up = up >> b;
+        }
+        else if (t == 'B' || t == 'b')
+        {
+            up = up >> b >> s >> c;
+        }
+        else if (t == 'G' || t == 'g')
         {
-            pvalue pval;
-            up = up >> pval;
+            up = up >> s;
+        }
 
-            if (!up.error())
-            {
-                *highest_ballot = std::max(*highest_ballot, pval.b);
-                pvals->push_back(pval);
-            }
+        if (!up.error() && (t == 'a' || t == 'b' || t == 'g'))
+        {
+            const size_t rec_sz = rec.size() - up.remain();
+            uint32_t crc = 0;
+            up = up >> crc;
+            corrupt = !up.error() && crc != crc32c(rec.data(), rec_sz);
         }
 
-        if (t == 'G')
+        // The writer acknowledges nothing in a group until the whole group is
+        // durable, and the group's writes may reach the disk in any order.
+        // Whatever follows a torn or corrupt record was therefore never
+        // acknowledged either, and the log ends just before it.
+        if (up.error() || corrupt)
         {
-            uint64_t slot;
-            up = up >> slot;
+            LOG(WARNING) << "truncating " << ostr.str()
+                         << " at offset " << (st.st_size - rec.size())
+                         << (corrupt ? ": checksum mismatch" : ": incomplete record");
+            return true;
+        }
+
+        if (t == 'A' || t == 'a')
+        {
+            *highest_ballot = std::max(*highest_ballot, b);
+        }
+        else if (t == 'B' || t == 'b')
+        {
+            *highest_ballot = std::max(*highest_ballot, b);
 
-            if (!up.error())
+            // don't bother copying commands that will be garbage collected
+            if (s >= std::max(skip_below, *lowest_acceptable_slot))
             {
-                *lowest_acceptable_slot = std::max(*lowest_acceptable_slot, slot);
+                pvals->push_back(pvalue(b, s, std::string(c.cdata(), c.size())));
             }
         }
+        else if (t == 'G' || t == 'g')
+        {
+            *lowest_acceptable_slot = std::max(*lowest_acceptable_slot, s);
+        }
     }
 
-    if (up.error() || up.remain())
+    return true;
+}
+
+// Streams the snapshot straight from its segments and makes it visible under
+// its final name only once it is durable.  The snapshot writer thread and
+// record_snapshot may both be writing at once, so every call gets its own
+// temporary file.
+bool
+acceptor :: write_snapshot(int dir, uint64_t slot, e::intrusive_ptr<snapshot> snap)
+{
+    static uint64_t tmp_counter = 0;
+    std::ostringstream ostr;
+    ostr << "replica." << slot;
+    std::ostringstream tstr;
+    tstr << ".snapshot." << slot << "."
+         << e::atomic::increment_64_nobarrier(&tmp_counter, 1) << ".tmp";
+    const std::string tmp(tstr.str());
+    po6::io::fd fd(openat(dir, tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    if (fd.get() < 0)
     {
-        LOG(ERROR) << "log errneously truncated";
         return false;
     }
 
-    return true;
+    e::guard g_tmp = e::makeguard(unlinkat, dir, tmp.c_str(), 0);
+
+    std::vector<e::slice> segs;
+
+    if (snap)
+    {
+        snap->segments(&segs);
+    }
+
+    std::vector<struct iovec> iovs;
+
+    for (size_t i = 0; i < segs.size(); ++i)
+    {
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(segs[i].cdata());
+        iov.iov_len = segs[i].size();
+        iovs.push_back(iov);
+    }
+
+    struct iovec* iov = iovs.empty() ? NULL : &iovs[0];
+    size_t iov_sz = iovs.size();
+
+    while (iov_sz > 0)
+    {
+        ssize_t ret = ::writev(fd.get(), iov, int(std::min(iov_sz, size_t(IOV_MAX))));
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (ret < 0)
+        {
+            return false;
+        }
+
+        size_t amt = ret;
+
+        while (iov_sz > 0 && amt >= iov->iov_len)
+        {
+            amt -= iov->iov_len;
+            ++iov;
+            --iov_sz;
+        }
+
+        if (iov_sz > 0)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + amt;
+            iov->iov_len -= amt;
+        }
+    }
+
+    if (fsync(fd.get()) < 0 ||
+        renameat(dir, tmp.c_str(), dir, ostr.str().c_str()) < 0)
+    {
+        return false;
+    }
+
+    g_tmp.dismiss();
+    return fsync(dir) >= 0;
+}
+
+bool
+acceptor :: read_index(int dir, uint64_t lognum, log_summary* summary)
+{
+    std::ostringstream ostr;
+    ostr << "index." << lognum;
+    po6::io::fd fd(openat(dir, ostr.str().c_str(), O_RDONLY));
+
+    if (fd.get() < 0)
+    {
+        return false;
+    }
+
+    char buf[128];
+    ssize_t amt = fd.xread(buf, sizeof(buf));
+
+    if (amt <= 0)
+    {
+        return false;
+    }
+
+    e::unpacker up(buf, amt);
+    up = up >> summary->lognum >> summary->records
+            >> summary->min_slot >> summary->max_slot
+            >> summary->highest_ballot >> summary->lowest_acceptable_slot;
+    return !up.error() && !up.remain() && summary->lognum == lognum;
 }
@@ -32,26 +32,33 @@
 #include <memory>
 
 // po6
+#include <po6/io/mmap.h>
 #include <po6/path.h>
 
+// e
+#include <e/intrusive_ptr.h>
+
 // Replicant
 #include "namespace.h"
 #include "common/bootstrap.h"
 #include "common/server.h"
 #include "daemon/ballot.h"
 #include "daemon/pvalue.h"
+#include "daemon/snapshot.h"
 
 BEGIN_REPLICANT_NAMESPACE
+class daemon;
 
 class acceptor
 {
     public:
-        acceptor();
+        acceptor(daemon* d);
         ~acceptor() throw ();
 
     public:
         // This *will* change the current directory to dir.
         bool open(const std::string& dir,
+                  uint64_t segment_size,
                   bool* saved, server* saved_us,
                   bootstrap* saved_bootstrap);
         bool save(server saved_us,
@@ -59,7 +66,8 @@ class acceptor
 
     public:
         const ballot& current_ballot() { return m_ballot; }
-        const std::vector<pvalue>& pvals();
+        // sorted by slot, holding only the highest-ballot pvalue for each
+        const std::vector<pvalue>& pvals() const { return m_pvals; }
         uint64_t lowest_acceptable_slot() const { return m_lowest_acceptable_slot; }
         bool failed() const { return m_permafail; }
         uint64_t write_cut() const { return m_opcount; }
@@ -69,36 +77,60 @@ class acceptor
         void accept(const pvalue& pval);
         void garbage_collect(uint64_t below);
         uint64_t sync_cut();
-        bool record_snapshot(uint64_t slot, const e::slice& snapshot);
+        bool record_snapshot(uint64_t slot, e::intrusive_ptr<snapshot> snap);
+        // writes the snapshot on a background thread; snapshot_cut() reports
+        // the highest slot whose snapshot is on disk
+        void record_snapshot_async(uint64_t slot, e::intrusive_ptr<snapshot> snap);
+        uint64_t snapshot_cut();
+        // the snapshot points into a read-only mapping of the file that
+        // remains valid for the lifetime of snapshot_backing
         bool load_latest_snapshot(e::slice* snapshot,
-                                  std::auto_ptr<e::buffer>* snapshot_backing);
+                                  std::auto_ptr<po6::io::mmap>* snapshot_backing);
 
     private:
         struct log_segment;
+        struct log_summary;
+        class log_replayer;
         class garbage_collector;
-        void compact_pvals(std::vector<pvalue>* pvals);
+        class writer;
+        class snapshot_writer;
+        static void compact_pvals(uint64_t lowest_acceptable_slot,
+                                  std::vector<pvalue>* pvals);
         bool atomic_read(const char* path, std::string* contents);
         bool atomic_write(const char* path, const std::string& contents);
         bool parse_identity(const std::string& ident,
                             server* saved_us, bootstrap* saved_bootstrap);
         log_segment* get_writable_log();
+        void release_previous_if_durable(uint64_t cut);
+        static bool take_recycled_log(std::string* name);
         static bool replay_log(int dir,
                                uint64_t lognum,
+                               uint64_t skip_below,
                                ballot* highest_ballot,
                                std::vector<pvalue>* pvals,
                                uint64_t* lowest_acceptable_slot);
+        static bool read_index(int dir, uint64_t lognum, log_summary* summary);
+        static bool write_snapshot(int dir, uint64_t slot, e::intrusive_ptr<snapshot> snap);
 
     private:
+        daemon* const m_daemon;
         ballot m_ballot;
         std::vector<pvalue> m_pvals;
         uint64_t m_lowest_acceptable_slot;
         po6::io::fd m_dir;
         po6::io::fd m_lock;
         uint64_t m_opcount;
+        uint64_t m_segment_size;
         bool m_permafail;
         std::auto_ptr<log_segment> m_current;
         std::auto_ptr<log_segment> m_previous;
         const std::auto_ptr<garbage_collector> m_gc;
+        const std::auto_ptr<writer> m_writer;
+        const std::auto_ptr<snapshot_writer> m_snapshot_writer;
+
+    private:
+        acceptor(const acceptor&);
+        acceptor& operator = (const acceptor&);
 };
 
 END_REPLICANT_NAMESPACE
@@ -62,6 +62,7 @@
 #include <e/guard.h>
 #include <e/error.h>
 #include <e/strescape.h>
+#include <e/varint.h>
 
 // BusyBee
 #include <busybee.h>
@@ -70,6 +71,7 @@
 #include "common/atomic_io.h"
 #include "common/bootstrap.h"
 #include "common/constants.h"
+#include "common/crc32c.h"
 #include "common/ids.h"
 #include "common/generate_token.h"
 #include "common/macros.h"
@@ -135,15 +137,35 @@ daemon :: daemon()
     , m_unordered_mtx()
     , m_unordered_cmds()
     , m_unassigned_cmds()
+    , m_batch_size(REPLICANT_BATCH_SIZE_DEFAULT)
+    , m_batch_linger(REPLICANT_BATCH_LINGER_DEFAULT * 1000000ULL)
+    , m_batch()
+    , m_batch_cmds(0)
+    , m_batch_start(0)
+    , m_batch_limit(0)
+    , m_batch_since(0)
     , m_msgs_waiting_for_persistence()
     , m_msgs_waiting_for_nonces()
-    , m_acceptor()
+    , m_acceptor(this)
     , m_scout()
     , m_scout_wait_cycles(0)
     , m_leader()
     , m_replica()
     , m_last_replica_snapshot(0)
+    , m_last_durable_snapshot(0)
     , m_last_gc_slot(0)
+    , m_fork_snapshots(false)
+    , m_replay_buffer_size(REPLICANT_REPLAY_BUFFER_SIZE_DEFAULT)
+    , m_pending_reads()
+    , m_next_read_id(1)
+    , m_lease_granted_to()
+    , m_lease_granted_until(0)
+    , m_fresh_at(0)
+    , m_leader_read_index(0)
+    , m_leader_read_index_at(0)
+    , m_transfers()
+    , m_transfer_budget(0)
+    , m_transfer_refilled(0)
 {
     po6::threads::mutex::hold hold(&m_unordered_mtx);
     m_unordered_cmds.set_empty_key(INT64_MAX);
@@ -152,10 +174,13 @@ daemon :: daemon()
     register_periodic(500, &daemon::periodic_ping_servers);
     register_periodic(1000, &daemon::periodic_generate_nonce_sequence);
     register_periodic(1000, &daemon::periodic_flush_enqueued_commands);
+    register_periodic(1, &daemon::periodic_flush_command_batch);
     register_periodic(1000, &daemon::periodic_maintain_objects);
     register_periodic(1000, &daemon::periodic_tick);
+    register_periodic(250, &daemon::periodic_retry_reads);
     register_periodic(10 * 1000, &daemon::periodic_warn_scout_stuck);
     register_periodic(10 * 1000, &daemon::periodic_check_address);
+    register_periodic(10 * 1000, &daemon::periodic_release_state_transfer);
     m_gc.register_thread(&m_gc_ts);
 }
 
@@ -175,6 +200,12 @@ daemon :: ~daemon() throw ()
         delete *it;
     }
 
+    for (pending_read_map_t::iterator it = m_pending_reads.begin();
+            it != m_pending_reads.end(); ++it)
+    {
+        delete it->second;
+    }
+
     while (!m_msgs_waiting_for_persistence.empty())
     {
         delete m_msgs_waiting_for_persistence.front().msg;
@@ -225,8 +256,22 @@ daemon :: run(bool background,
               const char* init_obj,
               const char* init_lib,
               const char* init_str,
-              const char* init_rst)
+              const char* init_rst,
+              unsigned batch_size,
+              unsigned batch_linger_ms,
+              uint64_t log_segment_size,
+              bool fork_snapshots,
+              uint64_t replay_buffer_size)
 {
+    {
+        po6::threads::mutex::hold hold(&m_unordered_mtx);
+        m_batch_size = std::max(batch_size, 1U);
+        m_batch_linger = batch_linger_ms * 1000000ULL;
+    }
+
+    m_fork_snapshots = fork_snapshots;
+    m_replay_buffer_size = replay_buffer_size;
+
     if (!e::block_all_signals())
     {
         std::cerr << "could not block signals; exiting" << std::endl;
@@ -253,7 +298,7 @@ daemon :: run(bool background,
     server saved_us;
     bootstrap saved_bootstrap;
 
-    if (!m_acceptor.open(data, &saved, &saved_us, &saved_bootstrap))
+    if (!m_acceptor.open(data, log_segment_size, &saved, &saved_us, &saved_bootstrap))
     {
         return EXIT_FAILURE;
     }
@@ -301,11 +346,10 @@ daemon :: run(bool background,
         m_replica->learn(p);
 
         uint64_t snapshot_slot;
-        e::slice snapshot;
-        std::auto_ptr<e::buffer> snapshot_backing;
-        m_replica->take_blocking_snapshot(&snapshot_slot, &snapshot, &snapshot_backing);
+        e::intrusive_ptr<snapshot> snap;
+        m_replica->take_blocking_snapshot(&snapshot_slot, &snap);
 
-        if (!m_acceptor.record_snapshot(snapshot_slot, snapshot))
+        if (!m_acceptor.record_snapshot(snapshot_slot, snap))
         {
             LOG(ERROR) << "error saving starting replica state to disk: " << po6::strerror(errno);
             return EXIT_FAILURE;
@@ -360,7 +404,7 @@ daemon :: run(bool background,
         e::atomic::store_ptr_release(&m_busybee, busybee_server::create(&m_busybee_controller, m_us.id.get(), m_us.bind_to, &m_gc));
 
         e::slice snapshot;
-        std::auto_ptr<e::buffer> snapshot_backing;
+        std::auto_ptr<po6::io::mmap> snapshot_backing;
 
         if (!m_acceptor.load_latest_snapshot(&snapshot, &snapshot_backing))
         {
@@ -375,6 +419,14 @@ daemon :: run(bool background,
             LOG(ERROR) << "could not restore replica from previous execution";
             return EXIT_FAILURE;
         }
+
+        // Grants are not written to disk, so assume that before the restart
+        // this server leased itself to the leader of the ballot it adopted
+        // (the only leader it could have leased to) and keep that lease for
+        // a full term.
+        m_lease_granted_to = m_acceptor.current_ballot();
+        m_lease_granted_until = po6::monotonic_time() +
+                                m_replica->current_settings().SUSPECT_TIMEOUT / 2;
     }
 
     if (!m_acceptor.save(m_us, saved_bootstrap))
@@ -533,6 +585,7 @@ daemon :: run(bool background,
         }
 
         flush_acceptor_messages();
+        flush_durable_snapshots();
         run_periodic();
 
         bool debug_mode = s_debug_mode;
@@ -594,6 +647,9 @@ daemon :: run(bool background,
             case REPLNET_STATE_TRANSFER:
                 process_state_transfer(si, msg, up);
                 break;
+            case REPLNET_STATE_TRANSFER_CHUNK:
+                process_state_transfer_chunk(si, msg, up);
+                break;
             case REPLNET_WHO_ARE_YOU:
                 process_who_are_you(si, msg, up);
                 break;
@@ -615,6 +671,27 @@ daemon :: run(bool background,
             case REPLNET_PAXOS_SUBMIT:
                 process_paxos_submit(si, msg, up);
                 break;
+            case REPLNET_PAXOS_PHASE2A_MULTI:
+                process_paxos_phase2a_multi(si, msg, up);
+                break;
+            case REPLNET_PAXOS_PHASE2B_MULTI:
+                process_paxos_phase2b_multi(si, msg, up);
+                break;
+            case REPLNET_PAXOS_LEARN_MULTI:
+                process_paxos_learn_multi(si, msg, up);
+                break;
+            case REPLNET_READ_INDEX:
+                process_read_index(si, msg, up);
+                break;
+            case REPLNET_READ_INDEX_REPLY:
+                process_read_index_reply(si, msg, up);
+                break;
+            case REPLNET_LEADER_CHECK:
+                process_leader_check(si, msg, up);
+                break;
+            case REPLNET_LEADER_CHECK_ACK:
+                process_leader_check_ack(si, msg, up);
+                break;
             case REPLNET_SERVER_BECOME_MEMBER:
                 process_server_become_member(si, msg, up);
                 break;
@@ -639,6 +716,12 @@ daemon :: run(bool background,
             case REPLNET_CALL_ROBUST:
                 process_call_robust(si, msg, up);
                 break;
+            case REPLNET_CALL_READONLY:
+                process_call_readonly(si, msg, up);
+                break;
+            case REPLNET_CALL_STALE:
+                process_call_stale(si, msg, up);
+                break;
             case REPLNET_PING:
                 process_ping(si, msg, up);
                 break;
@@ -836,6 +919,7 @@ daemon :: setup_replica_from_bootstrap(bootstrap current,
     configuration c;
     e::error err;
     bool has_err = false;
+    state_transfer st;
     rep->reset();
 
     for (unsigned iteration = 0; __sync_fetch_and_add(&s_interrupts, 0) == 0 && iteration < 100; ++iteration)
@@ -853,47 +937,34 @@ daemon :: setup_replica_from_bootstrap(bootstrap current,
             continue;
         }
 
-        for (size_t i = 0; !rep->get() && i < c.servers().size(); ++i)
-        {
-            std::auto_ptr<busybee_single> bbs(busybee_single::create(c.servers()[i].bind_to));
-            const size_t sz = BUSYBEE_HEADER_SIZE
-                            + pack_size(REPLNET_STATE_TRANSFER);
-            std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-            msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_STATE_TRANSFER;
-            bbs->send(msg);
-            bbs->recv(60000, &msg);
-
-            if (!msg.get())
-            {
-                continue;
-            }
+        uint64_t slot;
+        e::slice snapshot;
 
-            network_msgtype mt;
-            uint64_t slot;
-            e::slice snapshot;
-            e::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
-            up = up >> mt >> slot >> snapshot;
+        if (!st.fetch(c, &slot, &snapshot))
+        {
+            atomically_allow_pending_blocked_signals();
+            continue;
+        }
 
-            if (!up.error())
-            {
-                rep->reset(replica::from_snapshot(this, snapshot));
+        rep->reset(replica::from_snapshot(this, snapshot));
 
-                if (rep->get())
-                {
-                    uint64_t snapshot_slot;
-                    std::auto_ptr<e::buffer> snapshot_backing;
-                    (*rep)->take_blocking_snapshot(&snapshot_slot, &snapshot, &snapshot_backing);
+        if (!rep->get())
+        {
+            st.reset();
+            continue;
+        }
 
-                    if (!m_acceptor.record_snapshot(snapshot_slot, snapshot))
-                    {
-                        LOG(ERROR) << "error saving starting replica state to disk: " << po6::strerror(errno);
-                        rep->reset();
-                    }
+        uint64_t snapshot_slot;
+        e::intrusive_ptr<replicant::snapshot> snap;
+        (*rep)->take_blocking_snapshot(&snapshot_slot, &snap);
 
-                    return;
-                }
-            }
+        if (!m_acceptor.record_snapshot(snapshot_slot, snap))
+        {
+            LOG(ERROR) << "error saving starting replica state to disk: " << po6::strerror(errno);
+            rep->reset();
         }
+
+        return;
     }
 
     if (has_err)
@@ -943,9 +1014,8 @@ daemon :: process_state_transfer(server_id si,
                                  e::unpacker)
 {
     uint64_t snapshot_slot;
-    e::slice snapshot;
-    std::auto_ptr<e::buffer> snapshot_backing;
-    m_replica->get_last_snapshot(&snapshot_slot, &snapshot, &snapshot_backing);
+    e::intrusive_ptr<snapshot> snap;
+    m_replica->get_last_snapshot(&snapshot_slot, &snap);
 
     if (snapshot_slot == 0)
     {
@@ -957,16 +1027,181 @@ daemon :: process_state_transfer(server_id si,
         return;
     }
 
-    size_t sz = BUSYBEE_HEADER_SIZE
-              + pack_size(REPLNET_STATE_TRANSFER)
-              + sizeof(uint64_t)
-              + pack_size(snapshot);
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    // pack the length as e::slice would and gather the segments in behind it
+    const size_t hdr_sz = BUSYBEE_HEADER_SIZE
+                        + pack_size(REPLNET_STATE_TRANSFER)
+                        + sizeof(uint64_t)
+                        + e::varint_length(snap->size());
+    std::auto_ptr<e::buffer> msg(e::buffer::create(hdr_sz + snap->size()));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << REPLNET_STATE_TRANSFER << snapshot_slot
+        << e::pack_varint(snap->size());
+    msg->resize(hdr_sz + snap->size());
+    snap->gather(0, reinterpret_cast<char*>(msg->data()) + hdr_sz, snap->size());
+    send(si, msg);
+}
+
+struct daemon::transfer
+{
+    transfer() : snap(), readers() {}
+    ~transfer() throw () {}
+
+    e::intrusive_ptr<snapshot> snap;
+    // the servers pulling this snapshot, and when each last asked for a chunk
+    std::map<server_id, uint64_t> readers;
+};
+
+void
+daemon :: send_state_transfer_chunk(server_id si, state_transfer_status_t st,
+                                    uint64_t slot, snapshot* snap,
+                                    uint64_t offset, uint64_t chunk_sz)
+{
+    const uint64_t total = snap ? snap->size() : 0;
+    const size_t crc_off = BUSYBEE_HEADER_SIZE
+                         + pack_size(REPLNET_STATE_TRANSFER_CHUNK)
+                         + sizeof(uint8_t)
+                         + 3 * sizeof(uint64_t);
+    const size_t hdr_sz = crc_off
+                        + sizeof(uint32_t)
+                        + e::varint_length(chunk_sz);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(hdr_sz + chunk_sz));
+    msg->resize(hdr_sz + chunk_sz);
+    char* chunk = reinterpret_cast<char*>(msg->data()) + hdr_sz;
+
+    // the chunk is gathered from the shared snapshot straight into the
+    // message, and is laid out exactly as if it were packed as an e::slice
+    if (chunk_sz > 0)
+    {
+        snap->gather(offset, chunk, chunk_sz);
+    }
+
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << REPLNET_STATE_TRANSFER << snapshot_slot << snapshot;
+        << REPLNET_STATE_TRANSFER_CHUNK << uint8_t(st)
+        << slot << total << offset
+        << crc32c(chunk, chunk_sz) << e::pack_varint(chunk_sz);
     send(si, msg);
 }
 
+void
+daemon :: process_state_transfer_chunk(server_id si,
+                                       std::auto_ptr<e::buffer>,
+                                       e::unpacker up)
+{
+    uint64_t slot;
+    uint64_t offset;
+    up = up >> slot >> offset;
+    CHECK_UNPACK(STATE_TRANSFER_CHUNK, up);
+    const uint64_t now = po6::monotonic_time();
+
+    // A fresh transfer gets the latest snapshot.  One in progress keeps the
+    // snapshot it started with for as long as it keeps asking for chunks, and
+    // may also pull from a server that took the same snapshot but has not
+    // handed it out yet.
+    transfer_map_t::iterator it = m_transfers.find(slot);
+
+    if (slot == 0 || it == m_transfers.end())
+    {
+        uint64_t latest_slot = 0;
+        e::intrusive_ptr<snapshot> latest;
+        m_replica->get_last_snapshot(&latest_slot, &latest);
+
+        if (!latest)
+        {
+            send_state_transfer_chunk(si, STATE_TRANSFER_NONE, 0, NULL, 0, 0);
+            return;
+        }
+
+        if (slot == 0 || slot == latest_slot)
+        {
+            slot = latest_slot;
+            it = m_transfers.insert(std::make_pair(slot, transfer())).first;
+
+            if (!it->second.snap)
+            {
+                it->second.snap = latest;
+            }
+        }
+    }
+
+    if (it == m_transfers.end() ||
+        offset >= it->second.snap->size())
+    {
+        send_state_transfer_chunk(si, STATE_TRANSFER_STALE, 0, NULL, 0, 0);
+        return;
+    }
+
+    // a server pulls one snapshot at a time, so it no longer holds any other
+    for (transfer_map_t::iterator t = m_transfers.begin(); t != m_transfers.end(); )
+    {
+        if (t != it)
+        {
+            t->second.readers.erase(si);
+        }
+
+        if (t != it && t->second.readers.empty())
+        {
+            m_transfers.erase(t++);
+        }
+        else
+        {
+            ++t;
+        }
+    }
+
+    transfer* t = &it->second;
+    t->readers[si] = now;
+    // refill the budget, allowing at most a one second burst, so that
+    // transfers cannot crowd out Paxos traffic
+    const uint64_t elapsed = std::min(now - m_transfer_refilled, uint64_t(PO6_SECONDS));
+    m_transfer_budget = std::min(m_transfer_budget + elapsed * REPLICANT_STATE_TRANSFER_RATE / PO6_SECONDS,
+                                 uint64_t(REPLICANT_STATE_TRANSFER_RATE));
+    m_transfer_refilled = now;
+    const uint64_t sz = std::min(uint64_t(REPLICANT_STATE_TRANSFER_CHUNK_SIZE),
+                                 t->snap->size() - offset);
+
+    if (m_transfer_budget < sz)
+    {
+        send_state_transfer_chunk(si, STATE_TRANSFER_BUSY, slot, t->snap.get(), offset, 0);
+        return;
+    }
+
+    m_transfer_budget -= sz;
+    send_state_transfer_chunk(si, STATE_TRANSFER_OK, slot, t->snap.get(), offset, sz);
+}
+
+void
+daemon :: periodic_release_state_transfer(uint64_t now)
+{
+    // each server pulling a snapshot holds it until it stops asking for
+    // chunks, whether because it finished or because it gave up; the
+    // snapshot is released with its last reader
+    for (transfer_map_t::iterator t = m_transfers.begin(); t != m_transfers.end(); )
+    {
+        std::map<server_id, uint64_t>::iterator r = t->second.readers.begin();
+
+        while (r != t->second.readers.end())
+        {
+            if (r->second + REPLICANT_STATE_TRANSFER_RETAIN < now)
+            {
+                t->second.readers.erase(r++);
+            }
+            else
+            {
+                ++r;
+            }
+        }
+
+        if (t->second.readers.empty())
+        {
+            m_transfers.erase(t++);
+        }
+        else
+        {
+            ++t;
+        }
+    }
+}
+
 void
 daemon :: process_who_are_you(server_id si,
                               std::auto_ptr<e::buffer>,
@@ -1000,6 +1235,13 @@ daemon :: process_paxos_phase1a(server_id si,
     up = up >> b;
     CHECK_UNPACK(PAXOS_PHASE1A, up);
 
+    // stay quiet; the scout asks again and succeeds once the lease runs out
+    if (si == b.leader && b > m_acceptor.current_ballot() &&
+        lease_granted_elsewhere(b))
+    {
+        return;
+    }
+
     if (si == b.leader && b > m_acceptor.current_ballot())
     {
         m_acceptor.adopt(b);
@@ -1095,6 +1337,38 @@ daemon :: send_paxos_phase2a(server_id to, const pvalue& p)
     send(to, msg);
 }
 
+void
+daemon :: send_paxos_phase2a(server_id to, const pvalue* const* pvals, size_t pvals_sz)
+{
+    assert(pvals_sz > 0);
+
+    if (pvals_sz == 1)
+    {
+        send_paxos_phase2a(to, *pvals[0]);
+        return;
+    }
+
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(REPLNET_PAXOS_PHASE2A_MULTI)
+              + sizeof(uint32_t);
+
+    for (size_t i = 0; i < pvals_sz; ++i)
+    {
+        sz += pack_size(*pvals[i]);
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE);
+    pa = pa << REPLNET_PAXOS_PHASE2A_MULTI << uint32_t(pvals_sz);
+
+    for (size_t i = 0; i < pvals_sz; ++i)
+    {
+        pa = pa << *pvals[i];
+    }
+
+    send(to, msg);
+}
+
 void
 daemon :: process_paxos_phase2a(server_id si,
                                 std::auto_ptr<e::buffer>,
@@ -1119,6 +1393,61 @@ daemon :: process_paxos_phase2a(server_id si,
     LOG_IF(ERROR, si != p.b.leader) << si << " is misusing " << p.b;
 }
 
+void
+daemon :: process_paxos_phase2a_multi(server_id si,
+                                      std::auto_ptr<e::buffer>,
+                                      e::unpacker up)
+{
+    uint32_t pvals_sz;
+    up = up >> pvals_sz;
+    std::vector<pvalue> pvals;
+
+    for (uint32_t i = 0; i < pvals_sz && !up.error(); ++i)
+    {
+        pvals.push_back(pvalue());
+        up = up >> pvals.back();
+    }
+
+    CHECK_UNPACK(PAXOS_PHASE2A_MULTI, up);
+
+    if (pvals.empty())
+    {
+        return;
+    }
+
+    const ballot b(pvals[0].b);
+    uint64_t slot_start = pvals[0].s;
+    const uint64_t slot_limit = slot_start + pvals.size();
+
+    for (size_t i = 0; i < pvals.size(); ++i)
+    {
+        if (pvals[i].b != b || pvals[i].s != slot_start + i)
+        {
+            LOG(ERROR) << si << " sent a run of pvalues that is not contiguous";
+            return;
+        }
+    }
+
+    if (slot_limit <= m_acceptor.lowest_acceptable_slot())
+    {
+        return;
+    }
+
+    slot_start = std::max(slot_start, m_acceptor.lowest_acceptable_slot());
+
+    if (si == b.leader && b == m_acceptor.current_ballot())
+    {
+        for (size_t i = slot_start - pvals[0].s; i < pvals.size(); ++i)
+        {
+            m_acceptor.accept(pvals[i]);
+            LOG_IF(INFO, s_debug_mode && pvals[i].s >= m_config.first_slot()) << "p2a: " << pvals[i];
+        }
+    }
+
+    send_paxos_phase2b(b.leader, b, slot_start, slot_limit);
+    LOG_IF(ERROR, si != b.leader) << si << " is misusing " << b;
+}
+
 void
 daemon :: send_paxos_phase2b(server_id to, const pvalue& p)
 {
@@ -1131,6 +1460,22 @@ daemon :: send_paxos_phase2b(server_id to, const pvalue& p)
     send_when_acceptor_persistent(to, msg);
 }
 
+void
+daemon :: send_paxos_phase2b(server_id to, const ballot& b,
+                             uint64_t slot_start, uint64_t slot_limit)
+{
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(REPLNET_PAXOS_PHASE2B_MULTI)
+              + pack_size(m_acceptor.current_ballot())
+              + pack_size(b)
+              + 2 * sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << REPLNET_PAXOS_PHASE2B_MULTI << m_acceptor.current_ballot()
+        << b << slot_start << slot_limit;
+    send_when_acceptor_persistent(to, msg);
+}
+
 void
 daemon :: process_paxos_phase2b(server_id si,
                                 std::auto_ptr<e::buffer>,
@@ -1155,6 +1500,37 @@ daemon :: process_paxos_phase2b(server_id si,
     }
 }
 
+void
+daemon :: process_paxos_phase2b_multi(server_id si,
+                                      std::auto_ptr<e::buffer>,
+                                      e::unpacker up)
+{
+    ballot b;
+    ballot pb;
+    uint64_t slot_start;
+    uint64_t slot_limit;
+    up = up >> b >> pb >> slot_start >> slot_limit;
+    CHECK_UNPACK(PAXOS_PHASE2B_MULTI, up);
+
+    if (m_leader.get() && m_leader->current_ballot() == b && b == pb)
+    {
+        std::vector<const pvalue*> chosen;
+        m_leader->accept(si, b, slot_start, slot_limit, &chosen);
+
+        if (!chosen.empty())
+        {
+            for (size_t i = 0; i < m_config.servers().size(); ++i)
+            {
+                send_paxos_learn(m_config.servers()[i].id, &chosen[0], chosen.size());
+            }
+        }
+
+        LOG_IF(INFO, s_debug_mode) << "p2b: " << si << " accepted ["
+                                   << slot_start << ", " << slot_limit
+                                   << ") in " << b;
+    }
+}
+
 void
 daemon :: send_paxos_learn(server_id to, const pvalue& pval)
 {
@@ -1166,6 +1542,38 @@ daemon :: send_paxos_learn(server_id to, const pvalue& pval)
     send(to, msg);
 }
 
+void
+daemon :: send_paxos_learn(server_id to, const pvalue* const* pvals, size_t pvals_sz)
+{
+    assert(pvals_sz > 0);
+
+    if (pvals_sz == 1)
+    {
+        send_paxos_learn(to, *pvals[0]);
+        return;
+    }
+
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(REPLNET_PAXOS_LEARN_MULTI)
+              + sizeof(uint32_t);
+
+    for (size_t i = 0; i < pvals_sz; ++i)
+    {
+        sz += pack_size(*pvals[i]);
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    e::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE);
+    pa = pa << REPLNET_PAXOS_LEARN_MULTI << uint32_t(pvals_sz);
+
+    for (size_t i = 0; i < pvals_sz; ++i)
+    {
+        pa = pa << *pvals[i];
+    }
+
+    send(to, msg);
+}
+
 void
 daemon :: process_paxos_learn(server_id si,
                               std::auto_ptr<e::buffer>,
@@ -1179,80 +1587,127 @@ daemon :: process_paxos_learn(server_id si,
     {
         m_replica->learn(p);
         m_ft.proof_of_life(p.b.leader);
+        post_learn_hook();
+    }
+    else
+    {
+        LOG(ERROR) << si << " is misusing " << p.b;
+    }
+}
 
-        if (m_replica->config().version() > m_config.version())
-        {
-            m_config_mtx.lock();
-            m_config = m_replica->config();
-            m_config_mtx.unlock();
-            m_scout.reset();
-            m_leader.reset();
+void
+daemon :: process_paxos_learn_multi(server_id si,
+                                    std::auto_ptr<e::buffer>,
+                                    e::unpacker msg_up)
+{
+    uint32_t pvals_sz;
+    msg_up = msg_up >> pvals_sz;
+    std::vector<pvalue> pvals;
 
-            if (!post_config_change_hook())
-            {
-                return;
-            }
-        }
+    for (uint32_t i = 0; i < pvals_sz && !msg_up.error(); ++i)
+    {
+        pvals.push_back(pvalue());
+        msg_up = msg_up >> pvals.back();
+    }
 
-        uint64_t start;
-        uint64_t limit;
-        m_replica->window(&start, &limit);
+    CHECK_UNPACK(PAXOS_LEARN_MULTI, msg_up);
+    bool learned = false;
 
-        if (m_scout.get())
+    for (size_t i = 0; i < pvals.size(); ++i)
+    {
+        if (si == pvals[i].b.leader)
         {
-            m_scout->set_window(start, limit);
+            m_replica->learn(pvals[i]);
+            m_ft.proof_of_life(pvals[i].b.leader);
+            learned = true;
         }
-
-        if (m_leader.get())
+        else
         {
-            m_leader->set_window(this, start, limit);
+            LOG(ERROR) << si << " is misusing " << pvals[i].b;
+        }
+    }
 
-            if (m_replica->fill_window())
-            {
-                m_leader->fill_window(this);
-            }
-        }
+    if (learned)
+    {
+        post_learn_hook();
+    }
+}
 
-        if (m_last_replica_snapshot < m_replica->last_snapshot_num())
-        {
-            uint64_t snapshot_slot;
-            e::slice snapshot;
-            std::auto_ptr<e::buffer> snapshot_backing;
-            m_replica->get_last_snapshot(&snapshot_slot, &snapshot, &snapshot_backing);
+void
+daemon :: post_learn_hook()
+{
+    if (m_replica->config().version() > m_config.version())
+    {
+        m_config_mtx.lock();
+        m_config = m_replica->config();
+        m_config_mtx.unlock();
+        m_scout.reset();
+        m_leader.reset();
 
-            if (m_acceptor.record_snapshot(snapshot_slot, snapshot))
-            {
-                char buf[16];
-                e::pack64be(m_us.id.get(), buf);
-                e::pack64be(snapshot_slot, buf + 8);
-                std::string cmd(buf, buf + 16);
-                enqueue_paxos_command(SLOT_SERVER_SET_GC_THRESH, cmd);
-                LOG(INFO) << "snapshotting state at " << snapshot_slot;
-                m_last_replica_snapshot = snapshot_slot;
-            }
-            else
-            {
-                LOG(ERROR) << "could not save snapshot: " << po6::strerror(errno);
-            }
+        if (!post_config_change_hook())
+        {
+            return;
         }
+    }
+
+    uint64_t start;
+    uint64_t limit;
+    m_replica->window(&start, &limit);
+
+    if (m_scout.get())
+    {
+        m_scout->set_window(start, limit);
+    }
 
-        if (m_last_gc_slot < m_replica->gc_up_to())
+    if (m_leader.get())
+    {
+        m_leader->set_window(this, start, limit);
+
+        if (m_replica->fill_window())
         {
-            m_last_gc_slot = m_replica->gc_up_to();
-            m_acceptor.garbage_collect(m_last_gc_slot);
+            m_leader->fill_window(this);
+        }
+    }
 
-            if (m_leader.get())
-            {
-                m_leader->garbage_collect(m_last_gc_slot);
-            }
+    // reaching the leader's last read index brings the replica up to date as
+    // of when the leader reported it, and no later
+    if (m_leader_read_index > 0 && m_leader_read_index <= start)
+    {
+        m_fresh_at = std::max(m_fresh_at, m_leader_read_index_at);
+    }
+
+    if (!m_pending_reads.empty())
+    {
+        serve_reads();
+    }
+
+    if (m_last_replica_snapshot < m_replica->last_snapshot_num())
+    {
+        uint64_t snapshot_slot;
+        e::intrusive_ptr<snapshot> snap;
+        m_replica->get_last_snapshot(&snapshot_slot, &snap);
+
+        // flush_durable_snapshots picks this up once it is on disk
+        if (snap)
+        {
+            m_acceptor.record_snapshot_async(snapshot_slot, snap);
         }
 
-        e::atomic::store_32_nobarrier(&m_bootstrap_stop, 1);
+        m_last_replica_snapshot = snapshot_slot;
     }
-    else
+
+    if (m_last_gc_slot < m_replica->gc_up_to())
     {
-        LOG(ERROR) << si << " is misusing " << p.b;
+        m_last_gc_slot = m_replica->gc_up_to();
+        m_acceptor.garbage_collect(m_last_gc_slot);
+
+        if (m_leader.get())
+        {
+            m_leader->garbage_collect(m_last_gc_slot);
+        }
     }
+
+    e::atomic::store_32_nobarrier(&m_bootstrap_stop, 1);
 }
 
 void
@@ -1436,7 +1891,13 @@ daemon :: send_unordered_command(unordered_command* uc)
     cmd.append(nbuf, 8);
     cmd.append(uc->command());
 
-    if (m_leader.get())
+    if (m_batch_size > 1 && !uc->robust() && uc->type() == SLOT_CALL)
+    {
+        uc->set_last_used_ballot(m_leader.get() ? m_leader->current_ballot()
+                                                : m_acceptor.current_ballot());
+        batch_command(start, limit, cmd);
+    }
+    else if (m_leader.get())
     {
         uc->set_last_used_ballot(m_leader->current_ballot());
         m_leader->propose(this, start, limit, cmd);
@@ -1448,6 +1909,80 @@ daemon :: send_unordered_command(unordered_command* uc)
     }
 }
 
+void
+daemon :: batch_command(uint64_t slot_start,
+                        uint64_t slot_limit,
+                        const std::string& cmd)
+{
+    if (m_batch_cmds > 0 && slot_start >= m_batch_limit)
+    {
+        flush_command_batch();
+    }
+
+    if (m_batch_cmds == 0)
+    {
+        m_batch.clear();
+        char c = static_cast<char>(SLOT_BATCH);
+        m_batch.append(&c, 1);
+        c = 0;
+        m_batch.append(&c, 1);
+        char nbuf[8];
+        e::pack64be(uint64_t(0), nbuf);
+        m_batch.append(nbuf, 8);
+        m_batch_start = slot_start;
+        m_batch_limit = slot_limit;
+        m_batch_since = po6::monotonic_time();
+    }
+
+    // every command in the batch must be able to land in the chosen slot
+    m_batch_start = std::max(m_batch_start, slot_start);
+    m_batch_limit = std::min(m_batch_limit, slot_limit);
+    e::packer pa(&m_batch, m_batch.size());
+    pa = pa << e::slice(cmd);
+    ++m_batch_cmds;
+
+    if (m_batch_cmds >= m_batch_size)
+    {
+        flush_command_batch();
+    }
+}
+
+void
+daemon :: flush_command_batch()
+{
+    if (m_batch_cmds == 0)
+    {
+        return;
+    }
+
+    LOG_IF(INFO, s_debug_mode) << "proposing a batch of " << m_batch_cmds << " commands";
+
+    if (m_leader.get())
+    {
+        m_leader->propose(this, m_batch_start, m_batch_limit, m_batch);
+    }
+    else if (m_acceptor.current_ballot().leader != m_us.id)
+    {
+        send_paxos_submit(m_batch_start, m_batch_limit, e::slice(m_batch));
+    }
+
+    // commands that don't make it to a leader stay in m_unordered_cmds and
+    // will be retransmitted like any other unordered command
+    m_batch.clear();
+    m_batch_cmds = 0;
+}
+
+void
+daemon :: periodic_flush_command_batch(uint64_t now)
+{
+    po6::threads::mutex::hold hold(&m_unordered_mtx);
+
+    if (m_batch_cmds > 0 && m_batch_since + m_batch_linger <= now)
+    {
+        flush_command_batch();
+    }
+}
+
 void
 daemon :: periodic_maintain(uint64_t)
 {
@@ -1482,6 +2017,7 @@ daemon :: periodic_maintain_leader()
 {
     assert(m_leader.get());
     m_leader->send_all_proposals(this);
+    m_leader->send_read_checks(this);
 }
 
 void
@@ -1818,6 +2354,24 @@ daemon :: callback_enqueued(uint64_t command_nonce,
     delete uc;
 }
 
+void
+daemon :: callback_acceptor_synced()
+{
+    busybee_server* bb = e::atomic::load_ptr_acquire(&m_busybee);
+
+    if (!bb)
+    {
+        return;
+    }
+
+    // wake the main loop so that it acts on whatever just became durable
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(REPLNET_NOP);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_NOP;
+    bb->deliver(m_us.id.get(), msg);
+}
+
 void
 daemon :: callback_client(server_id si, uint64_t nonce,
                           replicant_returncode status,
@@ -1835,6 +2389,25 @@ daemon :: callback_client(server_id si, uint64_t nonce,
     send_from_non_main_thread(si, msg);
 }
 
+void
+daemon :: callback_client(server_id si, uint64_t nonce,
+                          replicant_returncode status,
+                          const std::string& result,
+                          uint64_t slot)
+{
+    e::slice output(result);
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(REPLNET_CLIENT_RESPONSE)
+                    + sizeof(uint64_t)
+                    + pack_size(status)
+                    + pack_size(output)
+                    + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << REPLNET_CLIENT_RESPONSE << nonce << status << output << slot;
+    send_from_non_main_thread(si, msg);
+}
+
 void
 daemon :: process_poke(server_id si,
                        std::auto_ptr<e::buffer>,
@@ -1954,13 +2527,244 @@ daemon :: periodic_tick(uint64_t)
 }
 
 void
-daemon :: send_ping(server_id to)
+daemon :: process_call_readonly(server_id si,
+                                std::auto_ptr<e::buffer>,
+                                e::unpacker up)
+{
+    uint64_t client_nonce;
+    e::slice obj;
+    e::slice func;
+    e::slice input;
+    up = up >> client_nonce >> obj >> func >> input;
+    CHECK_UNPACK(CALL_READONLY, up);
+    const uint64_t read_id = m_next_read_id;
+    ++m_next_read_id;
+    pending_read* pr = new pending_read(si, client_nonce, obj.str(), func.str(), input.str());
+    m_pending_reads.insert(std::make_pair(read_id, pr));
+    request_read_index(read_id, pr);
+}
+
+void
+daemon :: request_read_index(uint64_t read_id, pending_read* pr)
+{
+    const uint64_t now = po6::monotonic_time();
+    pr->set_requested_at(now);
+
+    // a leased leader answers from its own replica with no round trips
+    if (m_leader.get() && m_leader->has_lease(now))
+    {
+        pr->set_index(m_leader->current_read_index());
+        serve_reads();
+        return;
+    }
+
+    if (m_leader.get())
+    {
+        m_leader->read_index(this, m_us.id, read_id);
+        return;
+    }
+
+    // with no leader in sight, periodic_retry_reads asks again later
+    const server_id leader = m_acceptor.current_ballot().leader;
+
+    if (leader == server_id())
+    {
+        return;
+    }
+
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(REPLNET_READ_INDEX)
+              + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_READ_INDEX << read_id;
+    send(leader, msg);
+}
+
+void
+daemon :: process_read_index(server_id si,
+                             std::auto_ptr<e::buffer>,
+                             e::unpacker up)
+{
+    uint64_t read_id;
+    up = up >> read_id;
+    CHECK_UNPACK(READ_INDEX, up);
+
+    // a server that is not leading stays quiet; the requester will retry
+    if (m_leader.get())
+    {
+        m_leader->read_index(this, si, read_id);
+    }
+}
+
+void
+daemon :: send_read_index_reply(server_id to, uint64_t read_id, uint64_t index)
+{
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(REPLNET_READ_INDEX_REPLY)
+              + sizeof(uint64_t)
+              + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_READ_INDEX_REPLY << read_id << index;
+    send(to, msg);
+}
+
+void
+daemon :: process_read_index_reply(server_id,
+                                   std::auto_ptr<e::buffer>,
+                                   e::unpacker up)
+{
+    uint64_t read_id;
+    uint64_t index;
+    up = up >> read_id >> index;
+    CHECK_UNPACK(READ_INDEX_REPLY, up);
+    pending_read_map_t::iterator it = m_pending_reads.find(read_id);
+
+    // retries may draw more than one reply; the first one wins
+    if (it == m_pending_reads.end() || it->second->has_index())
+    {
+        return;
+    }
+
+    it->second->set_index(index);
+    serve_reads();
+}
+
+void
+daemon :: send_leader_check(server_id to, const ballot& b, uint64_t seq)
+{
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(REPLNET_LEADER_CHECK)
+              + pack_size(b)
+              + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_LEADER_CHECK << b << seq;
+    send(to, msg);
+}
+
+void
+daemon :: process_leader_check(server_id si,
+                               std::auto_ptr<e::buffer>,
+                               e::unpacker up)
+{
+    ballot b;
+    uint64_t seq;
+    up = up >> b >> seq;
+    CHECK_UNPACK(LEADER_CHECK, up);
+
+    // Answer with the ballot we have adopted.  The leader counts us only if
+    // it matches its own, which means no later leader could have used us to
+    // form a quorum before now.
+    const ballot& ours(m_acceptor.current_ballot());
+    size_t sz = BUSYBEE_HEADER_SIZE
+              + pack_size(REPLNET_LEADER_CHECK_ACK)
+              + pack_size(ours)
+              + sizeof(uint64_t);
+    std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_LEADER_CHECK_ACK << ours << seq;
+    send(si, msg);
+}
+
+void
+daemon :: process_leader_check_ack(server_id si,
+                                   std::auto_ptr<e::buffer>,
+                                   e::unpacker up)
+{
+    ballot b;
+    uint64_t seq;
+    up = up >> b >> seq;
+    CHECK_UNPACK(LEADER_CHECK_ACK, up);
+
+    if (m_leader.get())
+    {
+        m_leader->read_index_ack(this, si, b, seq);
+    }
+}
+
+void
+daemon :: serve_reads()
+{
+    uint64_t start;
+    uint64_t limit;
+    m_replica->window(&start, &limit);
+    pending_read_map_t::iterator it = m_pending_reads.begin();
+
+    while (it != m_pending_reads.end())
+    {
+        pending_read* pr = it->second;
+
+        if (!pr->has_index() || pr->index() > start)
+        {
+            ++it;
+            continue;
+        }
+
+        m_replica->call_readonly(pr->on_behalf_of(), pr->request_nonce(),
+                                 e::slice(pr->obj()), e::slice(pr->func()),
+                                 e::slice(pr->input()));
+        delete pr;
+        m_pending_reads.erase(it++);
+    }
+}
+
+void
+daemon :: process_call_stale(server_id si,
+                             std::auto_ptr<e::buffer>,
+                             e::unpacker up)
+{
+    uint64_t client_nonce;
+    uint64_t max_staleness_ms;
+    e::slice obj;
+    e::slice func;
+    e::slice input;
+    up = up >> client_nonce >> max_staleness_ms >> obj >> func >> input;
+    CHECK_UNPACK(CALL_STALE, up);
+    const uint64_t now = po6::monotonic_time();
+    const uint64_t bound = max_staleness_ms * PO6_MILLIS;
+    const bool leased = m_leader.get() && m_leader->has_lease(now);
+
+    if (leased || (m_fresh_at > 0 && m_fresh_at + bound >= now))
+    {
+        m_replica->call_readonly(si, client_nonce, obj, func, input);
+        return;
+    }
+
+    // too far behind to answer alone; a read index is never stale
+    const uint64_t read_id = m_next_read_id;
+    ++m_next_read_id;
+    pending_read* pr = new pending_read(si, client_nonce, obj.str(), func.str(), input.str());
+    m_pending_reads.insert(std::make_pair(read_id, pr));
+    request_read_index(read_id, pr);
+}
+
+void
+daemon :: periodic_retry_reads(uint64_t now)
+{
+    for (pending_read_map_t::iterator it = m_pending_reads.begin();
+            it != m_pending_reads.end(); ++it)
+    {
+        pending_read* pr = it->second;
+
+        if (!pr->has_index() &&
+            pr->requested_at() + REPLICANT_MINIMUM_RETRANSMISSION < now)
+        {
+            request_read_index(it->first, pr);
+        }
+    }
+}
+
+void
+daemon :: send_ping(server_id to, uint64_t lease_seq, uint64_t lease_duration,
+                    uint64_t caught_up)
 {
     size_t sz = BUSYBEE_HEADER_SIZE
               + pack_size(REPLNET_PING)
-              + pack_size(m_acceptor.current_ballot());
+              + pack_size(m_acceptor.current_ballot())
+              + sizeof(uint64_t)
+              + sizeof(uint64_t)
+              + sizeof(uint64_t);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_PING << m_acceptor.current_ballot();
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_PING << m_acceptor.current_ballot()
+                                      << lease_seq << lease_duration << caught_up;
     send(to, msg);
 }
 
@@ -1970,46 +2774,128 @@ daemon :: process_ping(server_id si,
                        e::unpacker up)
 {
     ballot b;
+    uint64_t lease_seq = 0;
+    uint64_t lease_duration = 0;
+    uint64_t caught_up = 0;
     up = up >> b;
     CHECK_UNPACK(PING, up);
-    send_pong(si);
+
+    // older servers send only the ballot
+    if (up.remain())
+    {
+        up = up >> lease_seq >> lease_duration >> caught_up;
+        CHECK_UNPACK(PING, up);
+    }
+
+    if (lease_seq > 0)
+    {
+        grant_lease(si, b, lease_duration);
+    }
+
+    // an idle cluster learns only a tick a second; the leader's word that
+    // nothing lies past our window keeps the replica fresh in between
+    uint64_t start;
+    uint64_t limit;
+    m_replica->window(&start, &limit);
+
+    if (caught_up > 0 && si == m_acceptor.current_ballot().leader)
+    {
+        m_leader_read_index = caught_up;
+        m_leader_read_index_at = po6::monotonic_time();
+
+        if (caught_up <= start)
+        {
+            m_fresh_at = m_leader_read_index_at;
+        }
+    }
+
+    send_pong(si, lease_seq);
 }
 
 void
-daemon :: send_pong(server_id to)
+daemon :: send_pong(server_id to, uint64_t lease_seq)
 {
     size_t sz = BUSYBEE_HEADER_SIZE
-              + pack_size(REPLNET_PONG);
+              + pack_size(REPLNET_PONG)
+              + pack_size(m_acceptor.current_ballot())
+              + sizeof(uint64_t);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_PONG;
+    msg->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_PONG << m_acceptor.current_ballot() << lease_seq;
     send(to, msg);
 }
 
 void
 daemon :: process_pong(server_id si,
                        std::auto_ptr<e::buffer>,
-                       e::unpacker)
+                       e::unpacker up)
 {
     if (si != m_acceptor.current_ballot().leader)
     {
         m_ft.proof_of_life(si);
     }
+
+    ballot b;
+    uint64_t lease_seq = 0;
+    up = up >> b >> lease_seq;
+
+    // the pong carries the ballot the sender adopted, which vouches for
+    // our leadership only if it is still our own
+    if (!up.error() && lease_seq > 0 && m_leader.get())
+    {
+        m_leader->lease_ack(si, b, lease_seq);
+    }
 }
 
 void
-daemon :: periodic_ping_servers(uint64_t)
+daemon :: periodic_ping_servers(uint64_t now)
 {
     const std::vector<server>& servers(m_config.servers());
+    const uint64_t lease_duration = m_replica->current_settings().SUSPECT_TIMEOUT / 2;
+    uint64_t lease_seq = 0;
+    uint64_t caught_up = 0;
+
+    // The leader renews its lease with every round of pings.  Half the
+    // suspect timeout keeps a lease from outliving the point at which the
+    // other servers would start looking for a new leader.
+    if (m_leader.get())
+    {
+        lease_seq = m_leader->start_lease_round(now, lease_duration);
+        grant_lease(m_us.id, m_acceptor.current_ballot(), lease_duration);
+        m_leader->lease_ack(m_us.id, m_acceptor.current_ballot(), lease_seq);
+        caught_up = m_leader->current_read_index();
+    }
 
     for (size_t i = 0; i < servers.size(); ++i)
     {
         if (servers[i].id != m_us.id)
         {
-            send_ping(servers[i].id);
+            send_ping(servers[i].id, lease_seq, lease_duration, caught_up);
         }
     }
 }
 
+void
+daemon :: grant_lease(server_id si, const ballot& b, uint64_t duration)
+{
+    // only the leader of the ballot we adopted gets a lease, so grants from
+    // this server never overlap for two different leaders
+    if (b != m_acceptor.current_ballot() || b.leader != si)
+    {
+        return;
+    }
+
+    m_lease_granted_to = b;
+    m_lease_granted_until = std::max(m_lease_granted_until,
+                                     po6::monotonic_time() + duration);
+}
+
+bool
+daemon :: lease_granted_elsewhere(const ballot& b)
+{
+    return b.leader != m_lease_granted_to.leader &&
+           po6::monotonic_time() < m_lease_granted_until;
+}
+
 void
 daemon :: rebootstrap(bootstrap bs)
 {
@@ -2186,6 +3072,25 @@ daemon :: flush_acceptor_messages()
     }
 }
 
+void
+daemon :: flush_durable_snapshots()
+{
+    const uint64_t snapshot_slot = m_acceptor.snapshot_cut();
+
+    if (snapshot_slot <= m_last_durable_snapshot)
+    {
+        return;
+    }
+
+    char buf[16];
+    e::pack64be(m_us.id.get(), buf);
+    e::pack64be(snapshot_slot, buf + 8);
+    std::string cmd(buf, buf + 16);
+    enqueue_paxos_command(SLOT_SERVER_SET_GC_THRESH, cmd);
+    LOG(INFO) << "snapshotting state at " << snapshot_slot;
+    m_last_durable_snapshot = snapshot_slot;
+}
+
 void
 daemon :: debug_dump()
 {
@@ -2262,6 +3167,7 @@ daemon :: debug_dump()
         m_replica->window(&start, &limit);
         LOG(INFO) << "window: [" << start << ", " << limit << ")";
         LOG(INFO) << "gc: " << m_replica->gc_up_to();
+        LOG(INFO) << m_replica->snapshots();
         LOG(INFO) << "discontinuous: " << (m_replica->discontinuous() ? "yes" : "no");
         std::vector<configuration> configs(m_replica->configs().begin(),
                                            m_replica->configs().end());
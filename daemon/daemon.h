@@ -33,6 +33,7 @@
 #include <queue>
 #include <functional>
 #include <list>
+#include <map>
 #include <memory>
 #include <set>
 #include <utility>
@@ -59,10 +60,12 @@
 #include "daemon/controller.h"
 #include "daemon/deferred_msg.h"
 #include "daemon/failure_tracker.h"
+#include "daemon/pending_read.h"
 #include "daemon/pvalue.h"
 #include "daemon/replica.h"
 #include "daemon/settings.h"
 #include "daemon/slot_type.h"
+#include "daemon/state_transfer.h"
 #include "daemon/unordered_command.h"
 
 BEGIN_REPLICANT_NAMESPACE
@@ -88,8 +91,15 @@ class daemon
                 const char* init_obj,
                 const char* init_lib,
                 const char* init_str,
-                const char* init_rst);
+                const char* init_rst,
+                unsigned batch_size,
+                unsigned batch_linger_ms,
+                uint64_t log_segment_size,
+                bool fork_snapshots,
+                uint64_t replay_buffer_size);
         const server_id id() const { return m_us.id; }
+        bool fork_snapshots() const { return m_fork_snapshots; }
+        uint64_t replay_buffer_size() const { return m_replay_buffer_size; }
 
     // getting to steady state
     public:
@@ -103,6 +113,13 @@ class daemon
         void process_state_transfer(server_id si,
                                     std::auto_ptr<e::buffer> msg,
                                     e::unpacker up);
+        void send_state_transfer_chunk(server_id si, state_transfer_status_t st,
+                                       uint64_t slot, snapshot* snap,
+                                       uint64_t offset, uint64_t chunk_sz);
+        void process_state_transfer_chunk(server_id si,
+                                          std::auto_ptr<e::buffer> msg,
+                                          e::unpacker up);
+        void periodic_release_state_transfer(uint64_t now);
         void process_who_are_you(server_id si,
                                  std::auto_ptr<e::buffer> msg,
                                  e::unpacker up);
@@ -118,17 +135,31 @@ class daemon
                                    std::auto_ptr<e::buffer> msg,
                                    e::unpacker up);
         void send_paxos_phase2a(server_id to, const pvalue& pval);
+        void send_paxos_phase2a(server_id to, const pvalue* const* pvals, size_t pvals_sz);
         void process_paxos_phase2a(server_id si,
                                    std::auto_ptr<e::buffer> msg,
                                    e::unpacker up);
+        void process_paxos_phase2a_multi(server_id si,
+                                         std::auto_ptr<e::buffer> msg,
+                                         e::unpacker up);
         void send_paxos_phase2b(server_id to, const pvalue& pval);
+        void send_paxos_phase2b(server_id to, const ballot& b,
+                                uint64_t slot_start, uint64_t slot_limit);
         void process_paxos_phase2b(server_id si,
                                    std::auto_ptr<e::buffer> msg,
                                    e::unpacker up);
+        void process_paxos_phase2b_multi(server_id si,
+                                         std::auto_ptr<e::buffer> msg,
+                                         e::unpacker up);
         void send_paxos_learn(server_id to, const pvalue& pval);
+        void send_paxos_learn(server_id to, const pvalue* const* pvals, size_t pvals_sz);
         void process_paxos_learn(server_id si,
                                  std::auto_ptr<e::buffer> msg,
                                  e::unpacker up);
+        void process_paxos_learn_multi(server_id si,
+                                       std::auto_ptr<e::buffer> msg,
+                                       e::unpacker up);
+        void post_learn_hook();
         void send_paxos_submit(uint64_t slot_start, uint64_t slot_limit, const e::slice& command);
         void process_paxos_submit(server_id si,
                                   std::auto_ptr<e::buffer> msg,
@@ -149,6 +180,9 @@ class daemon
         void periodic_flush_enqueued_commands(uint64_t now);
         void convert_unassigned_to_unordered();
         void send_unordered_command(unordered_command* uc);
+        void batch_command(uint64_t slot_start, uint64_t slot_limit, const std::string& cmd);
+        void flush_command_batch();
+        void periodic_flush_command_batch(uint64_t now);
         void periodic_maintain(uint64_t now);
         void periodic_maintain_scout();
         void periodic_maintain_leader();
@@ -194,6 +228,15 @@ class daemon
         void callback_client(server_id si, uint64_t nonce,
                              replicant_returncode status,
                              const std::string& result);
+        // reads also report the last slot their replica had learned
+        void callback_client(server_id si, uint64_t nonce,
+                             replicant_returncode status,
+                             const std::string& result,
+                             uint64_t slot);
+
+    // Callbacks from the acceptor
+    public:
+        void callback_acceptor_synced();
 
     // Client-library calls
     public:
@@ -214,17 +257,48 @@ class daemon
                                  e::unpacker up);
         void periodic_tick(uint64_t now);
 
+    // Read-only calls, served without going through the log
+    public:
+        void process_call_readonly(server_id si,
+                                   std::auto_ptr<e::buffer> msg,
+                                   e::unpacker up);
+        void request_read_index(uint64_t read_id, pending_read* pr);
+        void process_read_index(server_id si,
+                                std::auto_ptr<e::buffer> msg,
+                                e::unpacker up);
+        void send_read_index_reply(server_id to, uint64_t read_id, uint64_t index);
+        void process_read_index_reply(server_id si,
+                                      std::auto_ptr<e::buffer> msg,
+                                      e::unpacker up);
+        void send_leader_check(server_id to, const ballot& b, uint64_t seq);
+        void process_leader_check(server_id si,
+                                  std::auto_ptr<e::buffer> msg,
+                                  e::unpacker up);
+        void process_leader_check_ack(server_id si,
+                                      std::auto_ptr<e::buffer> msg,
+                                      e::unpacker up);
+        void serve_reads();
+        void periodic_retry_reads(uint64_t now);
+        void process_call_stale(server_id si,
+                                std::auto_ptr<e::buffer> msg,
+                                e::unpacker up);
+
     // Pinging to overthrow the leaders
     public:
-        void send_ping(server_id si);
+        // lease_seq is zero unless the ping asks for a lease; a leader also
+        // sends the slot below which a replica is caught up
+        void send_ping(server_id si, uint64_t lease_seq, uint64_t lease_duration,
+                       uint64_t caught_up);
         void process_ping(server_id si,
                           std::auto_ptr<e::buffer> msg,
                           e::unpacker up);
-        void send_pong(server_id si);
+        void send_pong(server_id si, uint64_t lease_seq);
         void process_pong(server_id si,
                           std::auto_ptr<e::buffer> msg,
                           e::unpacker up);
         void periodic_ping_servers(uint64_t now);
+        void grant_lease(server_id si, const ballot& b, uint64_t duration);
+        bool lease_granted_elsewhere(const ballot& b);
 
     public:
         void rebootstrap(bootstrap b);
@@ -234,6 +308,7 @@ class daemon
         bool send_from_non_main_thread(server_id si, std::auto_ptr<e::buffer> msg);
         bool send_when_acceptor_persistent(server_id si, std::auto_ptr<e::buffer> msg);
         void flush_acceptor_messages();
+        void flush_durable_snapshots();
 
     public:
         void debug_dump();
@@ -278,6 +353,16 @@ class daemon
         unordered_map_t m_unordered_cmds;
         unordered_list_t m_unassigned_cmds;
 
+        // SLOT_CALL commands packed together to be proposed as one slot;
+        // protected by m_unordered_mtx
+        size_t m_batch_size;
+        uint64_t m_batch_linger;
+        std::string m_batch;
+        size_t m_batch_cmds;
+        uint64_t m_batch_start;
+        uint64_t m_batch_limit;
+        uint64_t m_batch_since;
+
         // messages enqueued to wait for persistence
         std::list<deferred_msg> m_msgs_waiting_for_persistence;
 
@@ -294,7 +379,37 @@ class daemon
         std::auto_ptr<leader> m_leader;
         std::auto_ptr<replica> m_replica;
         uint64_t m_last_replica_snapshot; // XXX remove
+        uint64_t m_last_durable_snapshot;
         uint64_t m_last_gc_slot; // XXX remove
+        bool m_fork_snapshots;
+        uint64_t m_replay_buffer_size;
+
+        // read-only calls waiting on a read index, or for the replica to
+        // learn every slot below it; keyed by an id local to this server
+        typedef std::map<uint64_t, pending_read*> pending_read_map_t;
+        pending_read_map_t m_pending_reads;
+        uint64_t m_next_read_id;
+
+        // the leader this server promised not to overthrow, and until when
+        ballot m_lease_granted_to;
+        uint64_t m_lease_granted_until;
+
+        // when the replica last had learned every slot below the leader's
+        // read index; bounds stale reads
+        uint64_t m_fresh_at;
+        // the read index the leader last sent with a ping, and when
+        uint64_t m_leader_read_index;
+        uint64_t m_leader_read_index_at;
+
+        // the snapshots handed out to joining servers in chunks, by slot; each
+        // is kept for as long as some server pulling it has asked for a chunk
+        // recently, so that slow and concurrent transfers keep the snapshot
+        // they started with
+        struct transfer;
+        typedef std::map<uint64_t, transfer> transfer_map_t;
+        transfer_map_t m_transfers;
+        uint64_t m_transfer_budget;
+        uint64_t m_transfer_refilled;
 };
 
 END_REPLICANT_NAMESPACE
@@ -47,6 +47,16 @@ leader :: leader(const scout& s)
     , m_start(s.window_start())
     , m_limit(s.window_limit())
     , m_next(m_start)
+    , m_reads()
+    , m_reads_next()
+    , m_read_seq(0)
+    , m_read_index(0)
+    , m_read_acks()
+    , m_lease_seq(0)
+    , m_lease_sent(0)
+    , m_lease_duration(0)
+    , m_lease_acks()
+    , m_lease_until(0)
 {
     for (size_t i = 0; i < s.pvals().size(); ++i)
     {
@@ -115,16 +125,7 @@ leader :: ~leader() throw ()
 void
 leader :: send_all_proposals(daemon* d)
 {
-    for (commander_map_t::iterator it = m_commanders.lower_bound(m_start);
-            it != m_commanders.end(); ++it)
-    {
-        send_proposal(d, &it->second);
-
-        if (it->second.pval().s >= m_limit)
-        {
-            return;
-        }
-    }
+    send_proposals(d, m_start, m_limit);
 }
 
 bool
@@ -151,6 +152,35 @@ leader :: accept(server_id si, const pvalue& p)
     return it->second.accepted() >= m_quorum;
 }
 
+void
+leader :: accept(server_id si, const ballot& b,
+                 uint64_t slot_start, uint64_t slot_limit,
+                 std::vector<const pvalue*>* chosen)
+{
+    if (std::find(m_acceptors.begin(), m_acceptors.end(), si) == m_acceptors.end())
+    {
+        return;
+    }
+
+    // Within one ballot there is exactly one proposal per slot, so the ballot
+    // and the slot range identify the accepted pvalues unambiguously.
+    for (commander_map_t::iterator it = m_commanders.lower_bound(slot_start);
+            it != m_commanders.end() && it->first < slot_limit; ++it)
+    {
+        if (it->second.pval().b != b)
+        {
+            continue;
+        }
+
+        it->second.accept(si);
+
+        if (it->second.accepted() >= m_quorum)
+        {
+            chosen->push_back(&it->second.pval());
+        }
+    }
+}
+
 void
 leader :: propose(daemon* d, uint64_t slot_start, uint64_t slot_limit, const std::string& c)
 {
@@ -208,47 +238,166 @@ leader :: set_window(daemon* d, uint64_t start, uint64_t limit)
     const uint64_t old_limit = m_limit;
     m_start = start;
     m_limit = limit;
+    send_proposals(d, old_limit, m_limit);
+    adjust_next();
+}
 
-    for (uint64_t i = old_limit; i < m_limit; ++i)
+void
+leader :: fill_window(daemon* d)
+{
+    for (uint64_t i = m_start; i < m_limit; ++i)
     {
         commander_map_t::iterator it = m_commanders.find(i);
 
         if (it == m_commanders.end())
         {
-            continue;
+            pvalue pval(current_ballot(), i, std::string());
+            m_commanders.insert(std::make_pair(i, commander(pval)));
         }
-
-        send_proposal(d, &it->second);
     }
 
+    send_proposals(d, m_start, m_limit);
     adjust_next();
 }
 
 void
-leader :: fill_window(daemon* d)
+leader :: garbage_collect(uint64_t below)
 {
-    for (uint64_t i = m_start; i < m_limit; ++i)
+    while (!m_commanders.empty() && m_commanders.begin()->first < below)
     {
-        commander_map_t::iterator it = m_commanders.find(i);
+        m_commanders.erase(m_commanders.begin());
+    }
+}
 
-        if (it == m_commanders.end())
+void
+leader :: read_index(daemon* d, server_id requester, uint64_t read_id)
+{
+    if (has_lease(po6::monotonic_time()))
+    {
+        d->send_read_index_reply(requester, read_id, current_read_index());
+        return;
+    }
+
+    if (!m_reads.empty())
+    {
+        m_reads_next.push_back(std::make_pair(requester, read_id));
+        return;
+    }
+
+    m_reads.push_back(std::make_pair(requester, read_id));
+    start_read_round(d);
+}
+
+void
+leader :: read_index_ack(daemon* d, server_id si, const ballot& b, uint64_t seq)
+{
+    // an acceptor that has moved past our ballot answers with its own, and
+    // the reads wait for whichever leader takes over
+    if (m_reads.empty() || seq != m_read_seq || b != m_ballot ||
+        std::find(m_acceptors.begin(), m_acceptors.end(), si) == m_acceptors.end() ||
+        std::find(m_read_acks.begin(), m_read_acks.end(), si) != m_read_acks.end())
+    {
+        return;
+    }
+
+    m_read_acks.push_back(si);
+
+    if (m_read_acks.size() < m_quorum)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_reads.size(); ++i)
+    {
+        d->send_read_index_reply(m_reads[i].first, m_reads[i].second, m_read_index);
+    }
+
+    m_reads.clear();
+    m_reads.swap(m_reads_next);
+
+    if (!m_reads.empty())
+    {
+        start_read_round(d);
+    }
+}
+
+void
+leader :: send_read_checks(daemon* d)
+{
+    if (m_reads.empty())
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_acceptors.size(); ++i)
+    {
+        if (std::find(m_read_acks.begin(), m_read_acks.end(), m_acceptors[i]) == m_read_acks.end())
         {
-            insert_nop(d, i);
+            d->send_leader_check(m_acceptors[i], m_ballot, m_read_seq);
         }
     }
+}
 
-    adjust_next();
+uint64_t
+leader :: current_read_index() const
+{
+    // Every slot that may have been chosen has a commander, either proposed
+    // by this leader or recovered by its scout, so nothing past the last one
+    // can have been learned by anyone.
+    uint64_t index = m_next;
+
+    if (!m_commanders.empty())
+    {
+        index = std::max(index, m_commanders.rbegin()->first + 1);
+    }
+
+    return index;
+}
+
+uint64_t
+leader :: start_lease_round(uint64_t now, uint64_t duration)
+{
+    // acks for older rounds are dropped; the rounds come often enough that
+    // the lease is renewed long before it runs out
+    ++m_lease_seq;
+    m_lease_sent = now;
+    m_lease_duration = duration;
+    m_lease_acks.clear();
+    return m_lease_seq;
 }
 
 void
-leader :: garbage_collect(uint64_t below)
+leader :: lease_ack(server_id si, const ballot& b, uint64_t seq)
 {
-    while (!m_commanders.empty() && m_commanders.begin()->first < below)
+    if (seq != m_lease_seq || b != m_ballot ||
+        std::find(m_acceptors.begin(), m_acceptors.end(), si) == m_acceptors.end() ||
+        std::find(m_lease_acks.begin(), m_lease_acks.end(), si) != m_lease_acks.end())
     {
-        m_commanders.erase(m_commanders.begin());
+        return;
+    }
+
+    m_lease_acks.push_back(si);
+
+    // Each acceptor starts its grant when the ping arrives, which is no
+    // earlier than when it was sent; counting from the send leaves only
+    // clock drift to guard against.
+    if (m_lease_acks.size() >= m_quorum)
+    {
+        const uint64_t until = m_lease_sent + m_lease_duration
+                             - m_lease_duration / REPLICANT_LEASE_DRIFT;
+        m_lease_until = std::max(m_lease_until, until);
     }
 }
 
+void
+leader :: start_read_round(daemon* d)
+{
+    ++m_read_seq;
+    m_read_index = current_read_index();
+    m_read_acks.clear();
+    send_read_checks(d);
+}
+
 void
 leader :: adjust_next()
 {
@@ -296,6 +445,49 @@ leader :: send_proposal(daemon* d, commander* c)
     }
 }
 
+void
+leader :: send_proposals(daemon* d, uint64_t start, uint64_t limit)
+{
+    start = std::max(start, m_start);
+    limit = std::min(limit, m_limit);
+    uint64_t now = po6::monotonic_time();
+
+    // Send each acceptor its outstanding proposals as contiguous runs, so
+    // that it may acknowledge a whole run with one message.
+    for (size_t i = 0; i < m_acceptors.size(); ++i)
+    {
+        std::vector<const pvalue*> run;
+
+        for (commander_map_t::iterator it = m_commanders.lower_bound(start);
+                it != m_commanders.end() && it->first < limit; ++it)
+        {
+            commander* c = &it->second;
+
+            if (c->accepted_by(m_acceptors[i]) ||
+                c->timestamp(i) + REPLICANT_MINIMUM_RETRANSMISSION >= now)
+            {
+                continue;
+            }
+
+            if (!run.empty() &&
+                (run.back()->s + 1 != c->pval().s ||
+                 run.size() >= REPLICANT_MAX_PVALUES_PER_MESSAGE))
+            {
+                d->send_paxos_phase2a(m_acceptors[i], &run[0], run.size());
+                run.clear();
+            }
+
+            run.push_back(&c->pval());
+            c->timestamp(i, now);
+        }
+
+        if (!run.empty())
+        {
+            d->send_paxos_phase2a(m_acceptors[i], &run[0], run.size());
+        }
+    }
+}
+
 std::ostream&
 replicant :: operator << (std::ostream& lhs, const leader& rhs)
 {
@@ -30,6 +30,7 @@
 
 // STL
 #include <map>
+#include <vector>
 
 // Replicant
 #include "namespace.h"
@@ -54,6 +55,9 @@ class leader
         size_t quorum_size() const { return m_quorum; }
         void send_all_proposals(daemon* d);
         bool accept(server_id si, const pvalue& p);
+        void accept(server_id si, const ballot& b,
+                    uint64_t slot_start, uint64_t slot_limit,
+                    std::vector<const pvalue*>* chosen);
         void propose(daemon* d,
                      uint64_t slot_start,
                      uint64_t slot_limit,
@@ -64,10 +68,32 @@ class leader
         uint64_t window_limit() const { return m_limit; }
         void garbage_collect(uint64_t below);
 
+    // read indices: a read may be served once the requester has learned
+    // every slot below the index, provided a quorum of acceptors confirms
+    // this ballot after the read arrived
+    public:
+        void read_index(daemon* d, server_id requester, uint64_t read_id);
+        void read_index_ack(daemon* d, server_id si, const ballot& b, uint64_t seq);
+        void send_read_checks(daemon* d);
+        uint64_t current_read_index() const;
+
+    // leases: acceptors that answer a lease round adopt no other leader's
+    // ballot for "duration", so while a quorum's grants last, the leader may
+    // hand out read indices without a leader check
+    public:
+        // returns the sequence number to carry on this round's pings
+        uint64_t start_lease_round(uint64_t now, uint64_t duration);
+        void lease_ack(server_id si, const ballot& b, uint64_t seq);
+        bool has_lease(uint64_t now) const { return now < m_lease_until; }
+
+    private:
+        void start_read_round(daemon* d);
+
     private:
         void adjust_next();
         void insert_nop(daemon* d, uint64_t slot);
         void send_proposal(daemon* d, commander* c);
+        void send_proposals(daemon* d, uint64_t start, uint64_t limit);
 
     private:
         typedef std::map<uint64_t, commander> commander_map_t;
@@ -78,6 +104,19 @@ class leader
         uint64_t m_start;
         uint64_t m_limit;
         uint64_t m_next;
+        // reads covered by the check in flight, and those that arrived after
+        // it was sent and must wait for the next one
+        typedef std::vector<std::pair<server_id, uint64_t> > read_list_t;
+        read_list_t m_reads;
+        read_list_t m_reads_next;
+        uint64_t m_read_seq;
+        uint64_t m_read_index;
+        std::vector<server_id> m_read_acks;
+        uint64_t m_lease_seq;
+        uint64_t m_lease_sent;
+        uint64_t m_lease_duration;
+        std::vector<server_id> m_lease_acks;
+        uint64_t m_lease_until;
 
     private:
         leader(const leader&);
@@ -45,6 +45,7 @@
 
 // Replicant
 #include "common/bootstrap.h"
+#include "common/constants.h"
 #include "daemon/daemon.h"
 
 extern bool s_debug_mode;
@@ -78,6 +79,11 @@ main(int argc, const char* argv[])
     const char* init_str = NULL;
     const char* init_rst = NULL;
     bool log_immediate = false;
+    long batch_size = REPLICANT_BATCH_SIZE_DEFAULT;
+    long batch_linger = REPLICANT_BATCH_LINGER_DEFAULT;
+    long log_segment_size = REPLICANT_LOG_SEGMENT_SIZE_DEFAULT >> 20;
+    bool fork_snapshots = false;
+    long replay_buffer_size = REPLICANT_REPLAY_BUFFER_SIZE_DEFAULT >> 20;
     sigset_t ss;
 
     if (sigfillset(&ss) < 0 ||
@@ -131,6 +137,21 @@ main(int argc, const char* argv[])
     ap.arg().long_name("restore")
             .description("initialize a new cluster by restoring object/library with this backup")
             .metavar("restore").as_string(&init_rst).hidden();
+    ap.arg().long_name("batch-size")
+            .description("propose up to this many client calls in a single slot (default: 1)")
+            .metavar("calls").as_long(&batch_size);
+    ap.arg().long_name("batch-linger")
+            .description("wait at most this long for a batch to fill (default: 1ms)")
+            .metavar("ms").as_long(&batch_linger);
+    ap.arg().long_name("log-segment-size")
+            .description("preallocate acceptor log segments of this size (default: 64MB)")
+            .metavar("MB").as_long(&log_segment_size);
+    ap.arg().long_name("fork-snapshots")
+            .description("snapshot objects from a copy-on-write fork so calls keep executing")
+            .set_true(&fork_snapshots);
+    ap.arg().long_name("replay-buffer-size")
+            .description("spill each object's calls since its last snapshot to disk past this size (default: 16MB)")
+            .metavar("MB").as_long(&replay_buffer_size);
     ap.arg().long_name("log-immediate")
             .description("immediately flush all log output")
             .set_true(&log_immediate).hidden();
@@ -162,6 +183,30 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (batch_size < 1 || batch_size > REPLICANT_COMMANDS_TO_LEADER)
+    {
+        std::cerr << "batch-size is out of range" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (batch_linger < 0 || batch_linger > 1000)
+    {
+        std::cerr << "batch-linger is out of range" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (log_segment_size < 1 || log_segment_size > 4096)
+    {
+        std::cerr << "log-segment-size is out of range" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (replay_buffer_size < 1 || replay_buffer_size > 4096)
+    {
+        std::cerr << "replay-buffer-size is out of range" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     po6::net::ipaddr listen_ip;
     po6::net::location bind_to;
 
@@ -239,7 +284,11 @@ main(int argc, const char* argv[])
                      std::string(pidfile), has_pidfile,
                      listen, bind_to,
                      connect1 || connect2, bs,
-                     init_obj, init_lib, init_str, init_rst);
+                     init_obj, init_lib, init_str, init_rst,
+                     batch_size, batch_linger,
+                     uint64_t(log_segment_size) << 20,
+                     fork_snapshots,
+                     uint64_t(replay_buffer_size) << 20);
     }
     catch (std::exception& e)
     {
@@ -29,12 +29,21 @@
 
 // C
 #include <assert.h>
+#include <string.h>
 
 // POSIX
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <sstream>
 
 // Google Log
 #include <glog/logging.h>
@@ -43,17 +52,21 @@
 #include <e/atomic.h>
 #include <e/endian.h>
 #include <e/guard.h>
+#include <e/strescape.h>
 
 // BusyBee
 #include <busybee.h>
 
 // Replicant
+#include "common/constants.h"
 #include "common/network_msgtype.h"
 #include "common/packing.h"
 #include "daemon/daemon.h"
+#include "daemon/fd_passing.h"
 #include "daemon/object.h"
 #include "daemon/object_interface.h"
 #include "daemon/replica.h"
+#include "daemon/rsm_executor.h"
 #include "daemon/snapshot.h"
 
 using replicant::object;
@@ -164,6 +177,15 @@ object :: enqueued_call :: ~enqueued_call() throw ()
 {
 }
 
+// lives in the daemon's data directory, alongside the acceptor logs
+static std::string
+spill_path(const std::string& name, uint64_t slot)
+{
+    std::ostringstream ostr;
+    ostr << "./replay-" << name << "-" << slot;
+    return ostr.str();
+}
+
 object :: object(replica* r, uint64_t slot, const std::string& n, object_t t, const std::string& init)
     : m_ref(0)
     , m_replica(r)
@@ -175,23 +197,46 @@ object :: object(replica* r, uint64_t slot, const std::string& n, object_t t, co
     , m_cond(&m_mtx)
     , m_obj_pid(0)
     , m_fd(-1)
+    , m_chan()
+    , m_exec()
     , m_has_ctor(false)
     , m_has_rtor(false)
     , m_rtor()
+    , m_rtor_deltas()
     , m_cond_waits()
     , m_calls()
     , m_snapshots()
     , m_highest_slot(0)
+    , m_open_slot(0)
     , m_fail_at(UINT64_MAX)
     , m_failed(false)
     , m_done(false)
     , m_keepalive(false)
     , m_snap_mtx()
     , m_snap()
+    , m_replay_limit(r->m_daemon->replay_buffer_size())
+    , m_replay()
+    , m_spill()
+    , m_spill_sz(0)
     , m_thread(po6::threads::make_obj_func(&object::run, this))
     , m_conditions()
     , m_tick_func()
     , m_tick_interval()
+    , m_executing(NULL)
+    , m_reading(false)
+    , m_snap_base()
+    , m_snap_deltas()
+    , m_snap_delta_bytes(0)
+    , m_snap_dirty(true)
+    , m_exec_open(0)
+    , m_exec_pending(0)
+    , m_async_thread()
+    , m_async_fd()
+    , m_async_snap()
+    , m_async_header()
+    , m_async_off(0)
+    , m_async_state()
+    , m_async_ok(false)
     , m_last_executed(0)
 {
     e::atomic::store_64_release(&m_last_executed, 0);
@@ -203,6 +248,13 @@ object :: ~object() throw ()
     fail();
     m_thread.join();
     m_fd.close();
+
+    if (m_spill.get() >= 0)
+    {
+        m_spill.close();
+        unlink(spill_path(m_obj_name, m_obj_slot).c_str());
+    }
+
     po6::threads::mutex::hold hold(&m_mtx);
 
     for (std::map<std::string, condition*>::iterator it = m_conditions.begin();
@@ -218,15 +270,16 @@ object :: last_executed() const
     return e::atomic::load_64_acquire(&m_last_executed);
 }
 
-std::string
-object :: last_state()
+bool
+object :: last_state(std::string* state)
 {
     po6::threads::mutex::hold hold(&m_snap_mtx);
-    return m_snap;
+    *state = m_snap;
+    return read_replay(0, state);
 }
 
 void
-object :: set_child(pid_t child, int fd)
+object :: set_child(pid_t child, int fd, int region)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     assert(m_obj_pid == 0);
@@ -234,6 +287,22 @@ object :: set_child(pid_t child, int fd)
     assert(child > 0);
     m_obj_pid = child;
     m_fd = fd;
+
+    if (!m_chan.attach(region, true, m_fd.get()))
+    {
+        PLOG(ERROR) << "could not map the channel to object \"" << e::strescape(m_obj_name) << "\"";
+    }
+
+    m_cond.signal();
+}
+
+void
+object :: set_executor(rsm_executor* exec)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    assert(m_obj_pid == 0);
+    assert(!m_exec.get());
+    m_exec.reset(exec);
     m_cond.signal();
 }
 
@@ -255,16 +324,16 @@ void
 object :: ctor()
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    assert(m_obj_pid > 0);
+    assert(m_obj_pid > 0 || m_exec.get());
     m_has_ctor = true;
     m_cond.signal();
 }
 
 void
-object :: rtor(e::unpacker up)
+object :: rtor(uint64_t version, e::unpacker up)
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    assert(m_obj_pid > 0);
+    assert(m_obj_pid > 0 || m_exec.get());
     e::slice tf;
     uint64_t cond_size;
     up = up >> m_fail_at >> tf >> m_tick_interval >> e::unpack_varint(cond_size);
@@ -280,8 +349,21 @@ object :: rtor(e::unpacker up)
     }
 
     e::slice state;
+    uint64_t delta_size = 0;
     up = up >> state;
 
+    if (version >= 1)
+    {
+        up = up >> e::unpack_varint(delta_size);
+    }
+
+    for (uint64_t i = 0; !up.error() && i < delta_size; ++i)
+    {
+        e::slice d;
+        up = up >> d;
+        m_rtor_deltas.push_back(d.str());
+    }
+
     while (up.remain() && !up.error())
     {
         enqueued_call c;
@@ -337,12 +419,36 @@ object :: call(const e::slice& func,
         return;
     }
 
-    assert(p.s > m_highest_slot);
+    if ((flags & OBJECT_CALL_READONLY))
+    {
+        // the read sees every call the replica has handed over so far
+        pvalue r(p.b, m_highest_slot, p.c);
+        m_calls.push_back(enqueued_call(func, input, r, flags, command_nonce, si, request_nonce));
+        m_cond.signal();
+        return;
+    }
+
+    // commands batched into a single slot share the slot number
+    assert(p.s >= m_highest_slot);
     m_highest_slot = p.s;
+    m_open_slot = (flags & OBJECT_CALL_OPEN) ? p.s : 0;
+    flags &= ~OBJECT_CALL_OPEN;
     m_calls.push_back(enqueued_call(func, input, p, flags, command_nonce, si, request_nonce));
     m_cond.signal();
 }
 
+void
+object :: close_slot(uint64_t slot)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_open_slot == slot)
+    {
+        m_open_slot = 0;
+        m_cond.signal();
+    }
+}
+
 void
 object :: take_snapshot(e::intrusive_ptr<snapshot> snap)
 {
@@ -399,12 +505,12 @@ object :: run()
     {
         po6::threads::mutex::hold hold(&m_mtx);
         // Normally, it's bad practice to have a split condition wait like this.
-        // Here, we are explicitly expecting a call to "set_child" that will
-        // trigger the first condition followed by a call to "ctor" or "rtor"
-        // that will trigger the second.  In case of a failure, we'll fall
-        // through to the return.
+        // Here, we are explicitly expecting a call to "set_child" (or
+        // "set_executor") that will trigger the first condition followed by a
+        // call to "ctor" or "rtor" that will trigger the second.  In case of a
+        // failure, we'll fall through to the return.
 
-        while (!m_failed && m_obj_pid == 0)
+        while (!m_failed && m_obj_pid == 0 && !m_exec.get())
         {
             m_cond.wait();
         }
@@ -424,87 +530,18 @@ object :: run()
     }
 
     assert(has_ctor || has_rtor);
+    const bool constructed = m_exec.get() ? do_tor_inproc(has_ctor) : do_tor(has_ctor);
 
-    if (has_ctor)
-    {
-        char c(ACTION_CTOR);
-
-        if (!write(&c, 1))
-        {
-            return;
-        }
-    }
-    else if (has_rtor)
+    if (!constructed)
     {
-        char buf[5];
-        buf[0] = ACTION_RTOR;
-        e::pack32be(m_rtor.size(), buf + 1);
-
-        if (!write(buf, 5))
-        {
-            return;
-        }
-
-        if (!write(m_rtor.data(), m_rtor.size()))
-        {
-            return;
-        }
+        return;
     }
 
-    bool tor_done = false;
-
-    while (!tor_done)
-    {
-        char buf[1];
-
-        if (!read(buf, 1))
-        {
-            return;
-        }
-
-        command_response_t cr = static_cast<command_response_t>(buf[0]);
-        enqueued_call c_log("<init>", "", pvalue(ballot(), m_obj_slot, ""), 0, 0, server_id(), 0);
-        enqueued_call c_output("", "", pvalue(), 0, 0, server_id(), 0);
-
-        switch (cr)
-        {
-            case COMMAND_RESPONSE_LOG:
-                do_call_log(c_log);
-                break;
-            case COMMAND_RESPONSE_COND_CREATE:
-                do_call_cond_create();
-                break;
-            case COMMAND_RESPONSE_COND_DESTROY:
-                do_call_cond_destroy();
-                break;
-            case COMMAND_RESPONSE_COND_BROADCAST:
-                do_call_cond_broadcast();
-                break;
-            case COMMAND_RESPONSE_COND_BROADCAST_DATA:
-                do_call_cond_broadcast_data();
-                break;
-            case COMMAND_RESPONSE_COND_CURRENT_VALUE:
-                do_call_cond_current_value();
-                break;
-            case COMMAND_RESPONSE_TICK_INTERVAL:
-                do_call_tick_interval();
-                break;
-            case COMMAND_RESPONSE_OUTPUT:
-                do_call_output(c_output);
-                tor_done = true;
-                break;
-            case COMMAND_FAILURE:
-                do_failure();
-                return;
-            default:
-                fail();
-                return;
-        }
-    }
+    m_rtor_deltas.clear();
 
     {
         std::string tmp;
-        do_snapshot(&tmp);
+        do_snapshot(&tmp, NULL);
     }
 
     std::list<enqueued_cond_wait> cond_waits;
@@ -525,7 +562,8 @@ object :: run()
                    m_cond_waits.empty() &&
                    m_snapshots.empty() &&
                    m_fail_at == UINT64_MAX &&
-                   !m_keepalive)
+                   !m_keepalive &&
+                   (m_exec_pending == 0 || m_exec_pending == m_open_slot))
             {
                 m_cond.wait();
             }
@@ -539,6 +577,7 @@ object :: run()
             calls.splice(calls.end(), m_calls);
             snapshots.splice(snapshots.end(), m_snapshots);
             failed_at = m_fail_at;
+            m_exec_open = m_open_slot;
             assert(m_cond_waits.empty());
             assert(m_calls.empty());
             assert(m_snapshots.empty());
@@ -557,21 +596,26 @@ object :: run()
                 do_snapshot(snapshots.front());
                 snapshots.pop_front();
             }
+            else if (!m_exec.get() && batchable(calls, snap_slot))
+            {
+                do_call_batch(&calls, snap_slot);
+            }
             else
             {
                 do_call(calls.front());
-
-                if (!failed())
-                {
-                    po6::threads::mutex::hold hold(&m_snap_mtx);
-                    e::packer pa(&m_snap, m_snap.size());
-                    pa = pa << calls.front();
-                }
-
+                record_call(calls.front());
                 calls.pop_front();
             }
         }
 
+        // every call of a slot that was closed when the calls were taken
+        // has now been executed
+        if (m_exec_pending != 0 && m_exec_pending != m_exec_open)
+        {
+            executed_slot(m_exec_pending);
+            m_exec_pending = 0;
+        }
+
         while (!cond_waits.empty() && cond_waits.front().slot <= e::atomic::load_64_acquire(&m_last_executed))
         {
             do_cond_wait(cond_waits.front());
@@ -580,6 +624,7 @@ object :: run()
 
         if (failed_at < UINT64_MAX)
         {
+            m_exec_pending = 0;
             e::atomic::store_64_release(&m_last_executed, failed_at);
             fail();
         }
@@ -590,6 +635,8 @@ object :: run()
         }
     }
 
+    wait_async_snapshot();
+
     for (std::list<enqueued_cond_wait>::iterator it = cond_waits.begin();
             it != cond_waits.end(); ++it)
     {
@@ -618,112 +665,92 @@ object :: run()
     m_done = true;
 }
 
-void
-object :: do_cond_wait(const enqueued_cond_wait& cw)
+bool
+object :: do_tor(bool has_ctor)
 {
-    if (failed())
+    if (has_ctor)
     {
-        m_replica->m_daemon->callback_client(cw.si, cw.nonce, REPLICANT_MAYBE, "");
-        return;
-    }
-
-    std::map<std::string, condition*>::iterator it = m_conditions.find(cw.cond);
+        char c(ACTION_CTOR);
 
-    if (it == m_conditions.end())
-    {
-        m_replica->m_daemon->callback_client(cw.si, cw.nonce, REPLICANT_OBJ_NOT_FOUND, "");
+        if (!write(&c, 1))
+        {
+            return false;
+        }
     }
     else
     {
-        it->second->wait(m_replica->m_daemon, cw.si, cw.nonce, cw.state);
-    }
-}
+        char c(ACTION_RTOR);
 
-void
-object :: do_nop()
-{
-    char c = char(ACTION_NOP);
+        if (!write(&c, 1) || !write_chunked(m_rtor))
+        {
+            return false;
+        }
 
-    if (!write(&c, 1))
-    {
-        return;
+        std::string().swap(m_rtor);
     }
 
-    if (!read(&c, 1))
+    if (!do_tor_output())
     {
-        return;
+        return false;
     }
-}
-
-void
-object :: do_call(const enqueued_call& c)
-{
-    e::atomic::store_64_release(&m_last_executed, std::max(c.p.s, e::atomic::load_64_acquire(&m_last_executed)));
 
-    if (failed())
+    for (size_t i = 0; i < m_rtor_deltas.size(); ++i)
     {
-        m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_MAYBE, "");
-        return;
-    }
+        do_apply_delta(m_rtor_deltas[i]);
 
-    if (c.func == "__backup__")
-    {
-        po6::threads::mutex::hold hold(&m_snap_mtx);
-        m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_SUCCESS, m_snap);
-        return;
+        if (!do_tor_output())
+        {
+            return false;
+        }
     }
 
-    e::slice func(c.func);
-    e::slice input(c.input);
-
-    if (c.func == "__tick__")
-    {
-        uint64_t tick;
-        e::unpacker up(input);
-        up = up >> tick;
+    return true;
+}
 
-        if (up.error() || m_tick_func.empty() || tick % m_tick_interval != 0)
-        {
-            m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_SUCCESS, "");
-            return;
-        }
+bool
+object :: do_tor_inproc(bool has_ctor)
+{
+    enqueued_call c_log("<init>", "", pvalue(ballot(), m_obj_slot, ""), 0, 0, server_id(), 0);
+    m_executing = &c_log;
+    bool ok = has_ctor ? m_exec->ctor() : m_exec->rtor(m_rtor);
+    std::string().swap(m_rtor);
 
-        func = m_tick_func;
-        input = "";
+    for (size_t i = 0; ok && i < m_rtor_deltas.size(); ++i)
+    {
+        ok = m_exec->apply_delta(m_rtor_deltas[i]);
     }
 
-    const size_t sz = sizeof(uint64_t)
-                    + sizeof(uint32_t) + func.size()
-                    + sizeof(uint32_t) + input.size();
-    std::auto_ptr<e::buffer> msg(e::buffer::create(sz + 1));
-    msg->pack_at(0)
-        << uint8_t(ACTION_COMMAND)
-        << uint64_t(sz)
-        << uint32_t(func.size())
-        << e::pack_memmove(func.data(), func.size())
-        << uint32_t(input.size())
-        << e::pack_memmove(input.data(), input.size());
+    m_executing = NULL;
 
-    if (!write(msg->cdata(), msg->size()))
+    if (!ok)
     {
-        return;
+        LOG(INFO) << m_obj_name << " failed: " << (has_ctor ? "ctor" : "rtor") << " failed";
+        fail();
     }
 
+    return ok;
+}
+
+bool
+object :: do_tor_output()
+{
     while (true)
     {
         char buf[1];
 
         if (!read(buf, 1))
         {
-            return;
+            return false;
         }
 
         command_response_t cr = static_cast<command_response_t>(buf[0]);
+        enqueued_call c_log("<init>", "", pvalue(ballot(), m_obj_slot, ""), 0, 0, server_id(), 0);
+        enqueued_call c_output("", "", pvalue(), 0, 0, server_id(), 0);
 
         switch (cr)
         {
             case COMMAND_RESPONSE_LOG:
-                do_call_log(c);
+                do_call_log(c_log);
                 break;
             case COMMAND_RESPONSE_COND_CREATE:
                 do_call_cond_create();
@@ -744,125 +771,743 @@ object :: do_call(const enqueued_call& c)
                 do_call_tick_interval();
                 break;
             case COMMAND_RESPONSE_OUTPUT:
-                return do_call_output(c);
+                do_call_output(c_output);
+                return true;
             case COMMAND_FAILURE:
                 do_failure();
-                return;
+                return false;
             default:
                 fail();
-                return;
+                return false;
         }
     }
 }
 
 void
-object :: do_snapshot(e::intrusive_ptr<snapshot> snap)
+object :: do_apply_delta(const std::string& delta)
 {
-    e::guard g_abort = e::makeobjguard(*snap, &snapshot::abort_snapshot);
-    std::string s;
-    do_snapshot(&s);
-    g_abort.dismiss();
-    snap->finish_object(m_obj_name, s);
+    char c(ACTION_APPLY_DELTA);
 
-    if (snap->done())
+    if (!write(&c, 1))
     {
-        m_replica->snapshot_finished();
+        return;
     }
+
+    write_chunked(delta);
 }
 
 void
-object :: do_snapshot(std::string* s)
+object :: do_cond_wait(const enqueued_cond_wait& cw)
 {
     if (failed())
     {
+        m_replica->m_daemon->callback_client(cw.si, cw.nonce, REPLICANT_MAYBE, "");
         return;
     }
 
-    char buf[4];
-    buf[0] = ACTION_SNAPSHOT;
+    std::map<std::string, condition*>::iterator it = m_conditions.find(cw.cond);
 
-    if (!write(buf, 1))
+    if (it == m_conditions.end())
     {
-        return;
+        m_replica->m_daemon->callback_client(cw.si, cw.nonce, REPLICANT_OBJ_NOT_FOUND, "");
+    }
+    else
+    {
+        it->second->wait(m_replica->m_daemon, cw.si, cw.nonce, cw.state);
     }
+}
 
-    if (!read(buf, 4))
+void
+object :: do_nop()
+{
+    // there is no child whose pipe needs exercising
+    if (m_exec.get())
     {
         return;
     }
 
-    uint32_t o;
-    e::unpack32be(buf, &o);
-    std::vector<char> snapshot_buf(o);
+    char c = char(ACTION_NOP);
 
-    if (!read(&snapshot_buf[0], o))
+    if (!write(&c, 1))
     {
         return;
     }
 
-    s->clear();
-    e::packer pa(s);
-    pa = pa << m_type << m_init
-            << m_fail_at
-            << e::slice(m_tick_func)
-            << m_tick_interval
-            << e::pack_varint(m_conditions.size());
+    if (!read(&c, 1))
+    {
+        return;
+    }
+}
 
-    for (cond_map_t::iterator it = m_conditions.begin();
-            it != m_conditions.end(); ++it)
+void
+object :: executing_slot(uint64_t slot)
+{
+    // A batch puts several calls in one slot, and a slot is reported as
+    // executed only once all of its calls have run and been recorded;
+    // otherwise a repair taken at the slot could miss some of its calls.  A
+    // call from a later slot means every call before it is done.
+    if (m_exec_pending < slot)
     {
-        pa = pa << it->first << *it->second;
+        executed_slot(m_exec_pending);
     }
 
-    pa = pa << e::slice(&snapshot_buf[0], snapshot_buf.size());
-    po6::threads::mutex::hold hold(&m_snap_mtx);
-    m_snap = *s;
+    m_exec_pending = slot;
 }
 
 void
-object :: do_call_log(const enqueued_call& c)
+object :: executed_slot(uint64_t slot)
 {
-    char buf[4];
+    e::atomic::store_64_release(&m_last_executed, std::max(slot, e::atomic::load_64_acquire(&m_last_executed)));
+}
 
-    if (!read(buf, 4))
+void
+object :: do_call(const enqueued_call& c)
+{
+    if (!(c.flags & OBJECT_CALL_READONLY))
+    {
+        executing_slot(c.p.s);
+    }
+
+    if (failed())
     {
+        m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_MAYBE, "");
         return;
     }
 
-    uint32_t o;
-    e::unpack32be(buf, &o);
-    std::vector<char> log_buf(o);
+    if (c.func == "__backup__")
+    {
+        std::string state;
 
-    if (!read(&log_buf[0], o))
+        if (!last_state(&state))
+        {
+            m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_INTERNAL, "");
+            return;
+        }
+
+        m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_SUCCESS, state);
+        return;
+    }
+
+    e::slice func(c.func);
+    e::slice input(c.input);
+
+    if (c.func == "__tick__")
+    {
+        uint64_t tick;
+        e::unpacker up(input);
+        up = up >> tick;
+
+        if (up.error() || m_tick_func.empty() || tick % m_tick_interval != 0)
+        {
+            m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_SUCCESS, "");
+            return;
+        }
+
+        func = m_tick_func;
+        input = "";
+    }
+
+    const bool reading = (c.flags & OBJECT_CALL_READONLY);
+    m_snap_dirty = m_snap_dirty || !reading;
+    m_reading = reading;
+
+    if (m_exec.get())
+    {
+        do_call_inproc(c, func, input);
+        m_reading = false;
+        return;
+    }
+
+    const action_t action = reading ? ACTION_COMMAND_READONLY : ACTION_COMMAND;
+    std::auto_ptr<e::buffer> msg(e::buffer::create(1 + command_size(func, input)));
+    pack_command(msg->pack_at(0) << uint8_t(action), func, input);
+
+    if (write(msg->cdata(), msg->size()))
+    {
+        do_call_responses(c);
+    }
+
+    m_reading = false;
+}
+
+// Only ordinary calls go in a batch; "__backup__" must see the replay of every
+// call before it, "__tick__" must see any tick interval they set, and reads
+// need their own action.
+static bool
+ordinary(const replicant::object::enqueued_call& c)
+{
+    return c.func != "__backup__" && c.func != "__tick__" &&
+           !(c.flags & OBJECT_CALL_READONLY);
+}
+
+size_t
+object :: batch_cost(const enqueued_call& c)
+{
+    return command_size(e::slice(c.func), e::slice(c.input));
+}
+
+bool
+object :: batchable(const std::list<enqueued_call>& calls, uint64_t limit)
+{
+    std::list<enqueued_call>::const_iterator it = calls.begin();
+
+    if (it == calls.end() || it->p.s >= limit || !ordinary(*it))
+    {
+        return false;
+    }
+
+    const size_t first = batch_cost(*it);
+    return ++it != calls.end() && it->p.s < limit && ordinary(*it) &&
+           first + batch_cost(*it) <= REPLICANT_OBJECT_BATCH_BYTES;
+}
+
+void
+object :: do_call_batch(std::list<enqueued_call>* calls, uint64_t limit)
+{
+    // the run of ordinary calls ahead of the next snapshot
+    std::list<enqueued_call>::iterator end = calls->begin();
+    size_t count = 0;
+    size_t bytes = 0;
+
+    // The child holds the whole batch in memory before it runs any of it, so
+    // bound the batch in bytes as well as in calls.
+    while (end != calls->end() && end->p.s < limit && ordinary(*end) &&
+           count < REPLICANT_OBJECT_BATCH_SIZE &&
+           bytes + batch_cost(*end) <= REPLICANT_OBJECT_BATCH_BYTES)
+    {
+        bytes += batch_cost(*end);
+        ++count;
+        ++end;
+    }
+
+    assert(count > 1);
+    const size_t sz = 1 + sizeof(uint32_t) + bytes;
+
+    if (!failed())
+    {
+        std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
+        e::packer pa = msg->pack_at(0) << uint8_t(ACTION_COMMAND_BATCH) << uint32_t(count);
+
+        for (std::list<enqueued_call>::iterator it = calls->begin(); it != end; ++it)
+        {
+            pa = pack_command(pa, e::slice(it->func), e::slice(it->input));
+        }
+
+        m_snap_dirty = true;
+        write(msg->cdata(), msg->size());
+    }
+
+    // The child reads the entire batch before it executes anything, so the
+    // write above never waits on the child's outputs, and a call that makes a
+    // round trip (e.g. rsm_cond_current_value) reads only its own reply.  It
+    // then answers each call in turn, with its side effects followed by its
+    // output, so everything read before an output belongs to that call.  If
+    // the child fails partway, the rest are answered as in do_call.
+    while (calls->begin() != end)
+    {
+        const enqueued_call& c(calls->front());
+        executing_slot(c.p.s);
+
+        if (failed())
+        {
+            m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, REPLICANT_MAYBE, "");
+        }
+        else
+        {
+            do_call_responses(c);
+        }
+
+        record_call(c);
+        calls->pop_front();
+    }
+}
+
+void
+object :: do_call_responses(const enqueued_call& c)
+{
+    while (true)
+    {
+        char buf[1];
+
+        if (!read(buf, 1))
+        {
+            return;
+        }
+
+        command_response_t cr = static_cast<command_response_t>(buf[0]);
+
+        switch (cr)
+        {
+            case COMMAND_RESPONSE_LOG:
+                do_call_log(c);
+                break;
+            case COMMAND_RESPONSE_COND_CREATE:
+                do_call_cond_create();
+                break;
+            case COMMAND_RESPONSE_COND_DESTROY:
+                do_call_cond_destroy();
+                break;
+            case COMMAND_RESPONSE_COND_BROADCAST:
+                do_call_cond_broadcast();
+                break;
+            case COMMAND_RESPONSE_COND_BROADCAST_DATA:
+                do_call_cond_broadcast_data();
+                break;
+            case COMMAND_RESPONSE_COND_CURRENT_VALUE:
+                do_call_cond_current_value();
+                break;
+            case COMMAND_RESPONSE_TICK_INTERVAL:
+                do_call_tick_interval();
+                break;
+            case COMMAND_RESPONSE_OUTPUT:
+                return do_call_output(c);
+            case COMMAND_FAILURE:
+                do_failure();
+                return;
+            default:
+                fail();
+                return;
+        }
+    }
+}
+
+void
+object :: record_call(const enqueued_call& c)
+{
+    if (!failed() && !(c.flags & OBJECT_CALL_READONLY))
+    {
+        po6::threads::mutex::hold hold(&m_snap_mtx);
+        e::packer pa(&m_replay, m_replay.size());
+        pa = pa << c;
+        spill_replay();
+    }
+}
+
+size_t
+object :: command_size(const e::slice& func, const e::slice& input)
+{
+    return sizeof(uint64_t)
+         + sizeof(uint32_t) + func.size()
+         + sizeof(uint32_t) + input.size();
+}
+
+e::packer
+object :: pack_command(e::packer pa, const e::slice& func, const e::slice& input)
+{
+    return pa << uint64_t(command_size(func, input))
+              << uint32_t(func.size())
+              << e::pack_memmove(func.data(), func.size())
+              << uint32_t(input.size())
+              << e::pack_memmove(input.data(), input.size());
+}
+
+void
+object :: do_call_inproc(const enqueued_call& c,
+                         const e::slice& func,
+                         const e::slice& input)
+{
+    replicant_returncode status = REPLICANT_GARBAGE;
+    std::string output;
+    m_executing = &c;
+    const bool ok = m_exec->call(func, input, m_reading, &status, &output);
+    m_executing = NULL;
+
+    if (!ok)
+    {
+        LOG(INFO) << m_obj_name << " failed: execution failed";
+        fail();
+        return;
+    }
+
+    m_replica->executed(c.p, c.flags, c.command_nonce, c.si, c.request_nonce, status, output);
+}
+
+void
+object :: do_snapshot(e::intrusive_ptr<snapshot> snap)
+{
+    wait_async_snapshot();
+    e::guard g_abort = e::makeobjguard(*snap, &snapshot::abort_snapshot);
+    std::string s;
+
+    if (!do_snapshot(&s, snap))
+    {
+        // the forked child will finish this snapshot from async_snapshot
+        g_abort.dismiss();
+        return;
+    }
+
+    g_abort.dismiss();
+    snap->finish_object(m_obj_name, &s);
+
+    if (snap->done())
+    {
+        m_replica->snapshot_finished();
+    }
+}
+
+bool
+object :: do_snapshot(std::string* s, e::intrusive_ptr<snapshot> snap)
+{
+    if (failed())
+    {
+        return true;
+    }
+
+    // nothing reached the state machine since the last snapshot, so the bytes
+    // we already have are still accurate
+    if (!m_snap_dirty)
+    {
+        po6::threads::mutex::hold hold(&m_snap_mtx);
+        reset_replay();
+        *s = m_snap;
+        return true;
+    }
+
+    // ask for a delta until the chain is long enough, or large enough, that
+    // restoring from it would cost more than a fresh full snapshot
+    const bool want_delta = m_snap_deltas.size() < REPLICANT_SNAPSHOT_DELTA_CHAIN &&
+                            m_snap_delta_bytes < m_snap_base.size();
+
+    if (m_exec.get())
+    {
+        bool is_delta = false;
+        std::string state;
+
+        if (!m_exec->snapshot(want_delta, &is_delta, &state))
+        {
+            LOG(INFO) << m_obj_name << " failed: snapshot failed";
+            fail();
+            return true;
+        }
+
+        finish_snapshot(is_delta, &state, s);
+        return true;
+    }
+
+    char buf[4];
+    buf[0] = want_delta ? ACTION_SNAPSHOT_DELTA : ACTION_SNAPSHOT;
+
+    if (!write(buf, 1))
+    {
+        return true;
+    }
+
+    // either action is answered with its kind first; a full snapshot may come
+    // from a forked child through the descriptor that follows an 'a'
+    int fd = -1;
+
+    if (!read(buf, 1) ||
+        (buf[0] == 'a' && !read_fd(buf, &fd)))
+    {
+        return true;
+    }
+
+    if (buf[0] == 'a')
+    {
+        if (fd < 0)
+        {
+            fail();
+            return true;
+        }
+
+        start_async_snapshot(fd, snap);
+
+        if (snap)
+        {
+            return false;
+        }
+
+        wait_async_snapshot();
+        po6::threads::mutex::hold hold(&m_snap_mtx);
+        *s = m_snap;
+        return true;
+    }
+
+    const bool is_delta = want_delta && buf[0] == 'd';
+    std::string state;
+
+    if (!read_chunked(&state))
+    {
+        return true;
+    }
+
+    finish_snapshot(is_delta, &state, s);
+    return true;
+}
+
+void
+object :: finish_snapshot(bool is_delta, std::string* state, std::string* s)
+{
+    if (is_delta)
+    {
+        m_snap_delta_bytes += state->size();
+        m_snap_deltas.push_back(std::string());
+        m_snap_deltas.back().swap(*state);
+    }
+    else
+    {
+        m_snap_base.swap(*state);
+        m_snap_deltas.clear();
+        m_snap_delta_bytes = 0;
+    }
+
+    pack_snapshot_header(s);
+    e::packer pa(s, s->size());
+    pa = pa << e::slice(m_snap_base)
+            << e::pack_varint(m_snap_deltas.size());
+
+    for (size_t i = 0; i < m_snap_deltas.size(); ++i)
+    {
+        pa = pa << e::slice(m_snap_deltas[i]);
+    }
+
+    m_snap_dirty = false;
+    po6::threads::mutex::hold hold(&m_snap_mtx);
+    m_snap = *s;
+    reset_replay();
+}
+
+void
+object :: pack_snapshot_header(std::string* s)
+{
+    s->clear();
+    e::packer pa(s);
+    pa = pa << uint8_t(OBJECT_SNAPSHOT_VERSIONED)
+            << e::pack_varint(uint64_t(OBJECT_SNAPSHOT_VERSION))
+            << m_type << m_init
+            << m_fail_at
+            << e::slice(m_tick_func)
+            << m_tick_interval
+            << e::pack_varint(m_conditions.size());
+
+    for (cond_map_t::iterator it = m_conditions.begin();
+            it != m_conditions.end(); ++it)
+    {
+        pa = pa << it->first << *it->second;
+    }
+}
+
+void
+object :: start_async_snapshot(int fd, e::intrusive_ptr<snapshot> snap)
+{
+    assert(!m_async_thread.get());
+    m_async_fd = fd;
+    m_async_snap = snap;
+    m_async_ok = false;
+    pack_snapshot_header(&m_async_header);
+
+    {
+        po6::threads::mutex::hold hold(&m_snap_mtx);
+        m_async_off = m_spill_sz + m_replay.size();
+    }
+
+    // the fork captured the state as of now; later calls will re-dirty it
+    m_snap_dirty = false;
+    m_async_thread.reset(new po6::threads::thread(po6::threads::make_obj_func(&object::async_snapshot, this)));
+    m_async_thread->start();
+}
+
+void
+object :: async_snapshot()
+{
+    std::string state;
+    bool ok = read_chunked(&m_async_fd, &state);
+    m_async_fd.close();
+
+    if (!ok)
+    {
+        LOG(ERROR) << "forked snapshot of \"" << e::strescape(m_obj_name) << "\" did not complete";
+
+        if (m_async_snap)
+        {
+            m_async_snap->abort_snapshot();
+        }
+
+        return;
+    }
+
+    std::string s(m_async_header);
+    e::packer pa(&s, s.size());
+    pa = pa << e::slice(state) << e::pack_varint(uint64_t(0));
+
+    {
+        // calls that executed while the child was writing follow the snapshot
+        po6::threads::mutex::hold hold(&m_snap_mtx);
+        std::string tail;
+
+        if (!read_replay(m_async_off, &tail))
+        {
+            if (m_async_snap)
+            {
+                m_async_snap->abort_snapshot();
+            }
+
+            return;
+        }
+
+        m_snap = s;
+        reset_replay();
+        m_replay.swap(tail);
+        spill_replay();
+    }
+
+    m_async_state.swap(state);
+    m_async_ok = true;
+
+    if (m_async_snap)
+    {
+        m_async_snap->finish_object(m_obj_name, &s);
+
+        if (m_async_snap->done())
+        {
+            m_replica->snapshot_finished();
+        }
+    }
+}
+
+void
+object :: wait_async_snapshot()
+{
+    if (!m_async_thread.get())
+    {
+        return;
+    }
+
+    m_async_thread->join();
+    m_async_thread.reset();
+    m_async_snap = NULL;
+
+    if (m_async_ok)
+    {
+        m_snap_base.swap(m_async_state);
+        m_snap_deltas.clear();
+        m_snap_delta_bytes = 0;
+    }
+    else
+    {
+        m_snap_dirty = true;
+    }
+
+    m_async_state.clear();
+}
+
+void
+object :: reset_replay()
+{
+    std::string().swap(m_replay);
+
+    // only to give the space back; the file is always written at m_spill_sz
+    if (m_spill_sz > 0 && ftruncate(m_spill.get(), 0) < 0)
+    {
+        PLOG(WARNING) << "could not truncate replay buffer of \"" << e::strescape(m_obj_name) << "\"";
+    }
+
+    m_spill_sz = 0;
+}
+
+void
+object :: spill_replay()
+{
+    if (m_replay.size() <= m_replay_limit)
+    {
+        return;
+    }
+
+    if (m_spill.get() < 0)
+    {
+        m_spill = open(spill_path(m_obj_name, m_obj_slot).c_str(),
+                       O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+
+        if (m_spill.get() < 0)
+        {
+            PLOG(ERROR) << "could not spill replay buffer of \"" << e::strescape(m_obj_name) << "\"";
+            return;
+        }
+    }
+
+    const char* data = m_replay.data();
+    size_t rem = m_replay.size();
+    uint64_t off = m_spill_sz;
+
+    while (rem > 0)
+    {
+        const ssize_t ret = pwrite(m_spill.get(), data, rem, off);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (ret <= 0)
+        {
+            // keep holding the calls in memory; whatever made it to the file
+            // past m_spill_sz gets overwritten by the next attempt
+            PLOG(ERROR) << "could not spill replay buffer of \"" << e::strescape(m_obj_name) << "\"";
+            return;
+        }
+
+        data += ret;
+        rem -= ret;
+        off += ret;
+    }
+
+    m_spill_sz = off;
+    std::string().swap(m_replay);
+}
+
+bool
+object :: read_replay(uint64_t offset, std::string* out)
+{
+    char buf[65536];
+
+    while (offset < m_spill_sz)
+    {
+        const size_t sz = std::min(m_spill_sz - offset, uint64_t(sizeof(buf)));
+        const ssize_t ret = pread(m_spill.get(), buf, sz, offset);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (ret <= 0)
+        {
+            PLOG(ERROR) << "could not read replay buffer of \"" << e::strescape(m_obj_name) << "\"";
+            return false;
+        }
+
+        out->append(buf, ret);
+        offset += ret;
+    }
+
+    offset -= m_spill_sz;
+
+    if (offset < m_replay.size())
     {
-        return;
+        out->append(m_replay, offset, std::string::npos);
     }
 
-    const char* ptr = &log_buf[0];
-    const char* end = &log_buf[0] + log_buf.size();
+    return true;
+}
 
-    while (ptr < end)
+void
+object :: do_call_log(const enqueued_call& c)
+{
+    char buf[4];
+
+    if (!read(buf, 4))
     {
-        const void* ptr_nl = memchr(ptr, '\n', end - ptr);
-        const void* ptr_0  = memchr(ptr, '\0', end - ptr);
-        const char* eol = end;
+        return;
+    }
 
-        if (ptr_nl && ptr_0 && ptr_0 <= ptr_nl)
-        {
-            eol = static_cast<const char*>(ptr_0);
-        }
-        else if (ptr_nl)
-        {
-            eol = static_cast<const char*>(ptr_nl);
-        }
-        else if (ptr_0)
-        {
-            eol = static_cast<const char*>(ptr_0);
-        }
+    uint32_t o;
+    e::unpack32be(buf, &o);
+    std::vector<char> log_buf(o);
 
-        LOG(INFO) << m_obj_name << "." << c.func << " @ slot=" << c.p.s << ": " << std::string(ptr, eol);
-        ptr = eol + 1;
+    if (!read(&log_buf[0], o))
+    {
+        return;
     }
+
+    log_output(&c, &log_buf[0], log_buf.size());
 }
 
 void
@@ -884,15 +1529,7 @@ object :: do_call_cond_create()
         return;
     }
 
-    std::string cond(&cond_buf[0], o);
-    cond_map_t::iterator it = m_conditions.find(cond);
-
-    if (it == m_conditions.end())
-    {
-        std::auto_ptr<condition> c(new condition());
-        m_conditions.insert(std::make_pair(cond, c.get()));
-        c.release();
-    }
+    cond_create(std::string(&cond_buf[0], o));
 }
 
 void
@@ -914,14 +1551,7 @@ object :: do_call_cond_destroy()
         return;
     }
 
-    std::string cond(&cond_buf[0], o);
-    cond_map_t::iterator it = m_conditions.find(cond);
-
-    if (it != m_conditions.end())
-    {
-        delete it->second;
-        m_conditions.erase(it);
-    }
+    cond_destroy(std::string(&cond_buf[0], o));
 }
 
 void
@@ -943,20 +1573,8 @@ object :: do_call_cond_broadcast()
         return;
     }
 
-    std::string cond(&cond_buf[0], o);
-    cond_map_t::iterator it = m_conditions.find(cond);
-
-    if (it != m_conditions.end())
-    {
-        it->second->broadcast(m_replica->m_daemon);
-        buf[0] = 0;
-        write(buf, 1);
-    }
-    else
-    {
-        buf[0] = 1;
-        write(buf, 1);
-    }
+    buf[0] = cond_broadcast(std::string(&cond_buf[0], o)) ? 0 : 1;
+    write(buf, 1);
 }
 
 void
@@ -993,19 +1611,8 @@ object :: do_call_cond_broadcast_data()
         return;
     }
 
-    cond_map_t::iterator it = m_conditions.find(cond);
-
-    if (it != m_conditions.end())
-    {
-        it->second->broadcast(m_replica->m_daemon, &data_buf[0], o);
-        buf[0] = 0;
-        write(buf, 1);
-    }
-    else
-    {
-        buf[0] = 1;
-        write(buf, 1);
-    }
+    buf[0] = cond_broadcast_data(cond, &data_buf[0], o) ? 0 : 1;
+    write(buf, 1);
 }
 
 void
@@ -1027,10 +1634,11 @@ object :: do_call_cond_current_value()
         return;
     }
 
-    std::string cond(&cond_buf[0], o);
-    cond_map_t::iterator it = m_conditions.find(cond);
+    uint64_t state;
+    const char* data;
+    size_t data_sz;
 
-    if (it == m_conditions.end())
+    if (!cond_current_value(std::string(&cond_buf[0], o), &state, &data, &data_sz))
     {
         buf[0] = 1;
         write(buf, 1);
@@ -1039,13 +1647,9 @@ object :: do_call_cond_current_value()
 
     buf[0] = 0;
     write(buf, 1);
-    uint64_t state;
-    const char* data;
-    size_t data_sz;
-    it->second->peek_state(&state, &data, &data_sz);
     o = data_sz;
     e::pack64be(state, buf);
-    e::pack32be(o, buf);
+    e::pack32be(o, buf + 8);
     write(buf, 12);
     write(data, o);
 }
@@ -1078,8 +1682,7 @@ object :: do_call_tick_interval()
 
     uint64_t tick;
     e::unpack64be(buf, &tick);
-    m_tick_func = func;
-    m_tick_interval = tick;
+    tick_interval(func, tick);
 }
 
 void
@@ -1156,6 +1759,135 @@ object :: do_failure()
     fail();
 }
 
+void
+object :: log_output(const enqueued_call* c, const char* data, size_t data_sz)
+{
+    const char* ptr = data;
+    const char* end = data + data_sz;
+
+    while (ptr < end)
+    {
+        const void* ptr_nl = memchr(ptr, '\n', end - ptr);
+        const void* ptr_0  = memchr(ptr, '\0', end - ptr);
+        const char* eol = end;
+
+        if (ptr_nl && ptr_0 && ptr_0 <= ptr_nl)
+        {
+            eol = static_cast<const char*>(ptr_0);
+        }
+        else if (ptr_nl)
+        {
+            eol = static_cast<const char*>(ptr_nl);
+        }
+        else if (ptr_0)
+        {
+            eol = static_cast<const char*>(ptr_0);
+        }
+
+        if (c)
+        {
+            LOG(INFO) << m_obj_name << "." << c->func << " @ slot=" << c->p.s << ": " << std::string(ptr, eol);
+        }
+        else
+        {
+            LOG(INFO) << m_obj_name << ": " << std::string(ptr, eol);
+        }
+
+        ptr = eol + 1;
+    }
+}
+
+void
+object :: cond_create(const std::string& cond)
+{
+    if (m_reading)
+    {
+        return;
+    }
+
+    cond_map_t::iterator it = m_conditions.find(cond);
+
+    if (it == m_conditions.end())
+    {
+        std::auto_ptr<condition> c(new condition());
+        m_conditions.insert(std::make_pair(cond, c.get()));
+        c.release();
+    }
+}
+
+void
+object :: cond_destroy(const std::string& cond)
+{
+    if (m_reading)
+    {
+        return;
+    }
+
+    cond_map_t::iterator it = m_conditions.find(cond);
+
+    if (it != m_conditions.end())
+    {
+        delete it->second;
+        m_conditions.erase(it);
+    }
+}
+
+bool
+object :: cond_broadcast(const std::string& cond)
+{
+    cond_map_t::iterator it = m_conditions.find(cond);
+
+    if (it == m_conditions.end() || m_reading)
+    {
+        return false;
+    }
+
+    it->second->broadcast(m_replica->m_daemon);
+    return true;
+}
+
+bool
+object :: cond_broadcast_data(const std::string& cond,
+                              const char* data, size_t data_sz)
+{
+    cond_map_t::iterator it = m_conditions.find(cond);
+
+    if (it == m_conditions.end() || m_reading)
+    {
+        return false;
+    }
+
+    it->second->broadcast(m_replica->m_daemon, data, data_sz);
+    return true;
+}
+
+bool
+object :: cond_current_value(const std::string& cond, uint64_t* state,
+                             const char** data, size_t* data_sz)
+{
+    cond_map_t::iterator it = m_conditions.find(cond);
+
+    if (it == m_conditions.end())
+    {
+        return false;
+    }
+
+    it->second->peek_state(state, data, data_sz);
+    return true;
+}
+
+void
+object :: tick_interval(const std::string& func, uint64_t seconds)
+{
+    if (m_reading)
+    {
+        return;
+    }
+
+    m_tick_func = func;
+    m_tick_interval = seconds;
+}
+
 void
 object :: fail()
 {
@@ -1188,6 +1920,9 @@ object :: fail()
             kill(m_obj_pid, SIGKILL);
             waitpid(m_obj_pid, &status, 0);
         }
+
+        // the run thread may be asleep on the channel
+        m_chan.interrupt();
     }
 
     for (std::list<enqueued_cond_wait>::iterator it = cond_waits.begin();
@@ -1208,7 +1943,7 @@ object :: fail()
 bool
 object :: read(char* data, size_t sz)
 {
-    if (m_fd.xread(data, sz) != ssize_t(sz))
+    if (!m_chan.attached() || !m_chan.read(data, sz))
     {
         fail();
         return false;
@@ -1220,7 +1955,108 @@ object :: read(char* data, size_t sz)
 bool
 object :: write(const char* data, size_t sz)
 {
-    if (m_fd.xwrite(data, sz) != ssize_t(sz))
+    if (!m_chan.attached() || !m_chan.write(data, sz))
+    {
+        fail();
+        return false;
+    }
+
+    return true;
+}
+
+bool
+object :: write_chunked(const std::string& data)
+{
+    const char* ptr = data.data();
+    size_t rem = data.size();
+    char buf[4];
+
+    while (rem > 0)
+    {
+        const uint32_t o = std::min(rem, size_t(REPLICANT_SNAPSHOT_CHUNK_SIZE));
+        e::pack32be(o, buf);
+
+        if (!write(buf, 4) || !write(ptr, o))
+        {
+            return false;
+        }
+
+        ptr += o;
+        rem -= o;
+    }
+
+    e::pack32be(uint32_t(0), buf);
+    return write(buf, 4);
+}
+
+bool
+object :: read_chunked(std::string* data)
+{
+    data->clear();
+
+    while (true)
+    {
+        char buf[4];
+
+        if (!read(buf, 4))
+        {
+            return false;
+        }
+
+        uint32_t o;
+        e::unpack32be(buf, &o);
+
+        if (o == 0)
+        {
+            return true;
+        }
+
+        const size_t off = data->size();
+        data->resize(off + o);
+
+        if (!read(&(*data)[off], o))
+        {
+            return false;
+        }
+    }
+}
+
+bool
+object :: read_chunked(po6::io::fd* fd, std::string* data)
+{
+    data->clear();
+
+    while (true)
+    {
+        char buf[4];
+
+        if (fd->xread(buf, 4) != 4)
+        {
+            return false;
+        }
+
+        uint32_t o;
+        e::unpack32be(buf, &o);
+
+        if (o == 0)
+        {
+            return true;
+        }
+
+        const size_t off = data->size();
+        data->resize(off + o);
+
+        if (fd->xread(&(*data)[off], o) != ssize_t(o))
+        {
+            return false;
+        }
+    }
+}
+
+bool
+object :: read_fd(char* c, int* fd)
+{
+    if (!recv_fd(m_fd.get(), c, fd))
     {
         fail();
         return false;
@@ -30,7 +30,9 @@
 
 // STL
 #include <list>
+#include <memory>
 #include <map>
+#include <vector>
 
 // po6
 #include <po6/io/fd.h>
@@ -46,18 +48,38 @@
 #include <replicant.h>
 #include "namespace.h"
 #include "daemon/pvalue.h"
+#include "daemon/shm_channel.h"
 
 BEGIN_REPLICANT_NAMESPACE
 class condition;
 class replica;
+class rsm_executor;
 class snapshot;
 
 enum object_t
 {
     OBJECT_LIBRARY = 1,
+    // a library run by the daemon itself rather than a child process
+    OBJECT_LIBRARY_INPROC = 2,
     OBJECT_GARBAGE = 255
 };
 
+// An object's snapshot (and backup) starts with its object_t.  Since snapshots
+// gained deltas, it starts instead with OBJECT_SNAPSHOT_VERSIONED and a
+// version number, followed by the object_t.  Version 1 adds the count of
+// deltas after the state.  Snapshots without a version have no deltas.
+#define OBJECT_SNAPSHOT_VERSIONED 128
+#define OBJECT_SNAPSHOT_VERSION 1
+
+// Flags for object::call.  The low bit marks a robust call.  A read-only call
+// comes from a single client rather than the log, so it leaves no trace in the
+// replay or the conditions, and runs after every call enqueued before it.  Its
+// command nonce carries the slot the read reflects.  An open call shares its
+// slot with calls that may yet follow, and the slot stays open until
+// object::close_slot.
+#define OBJECT_CALL_READONLY 2
+#define OBJECT_CALL_OPEN 4
+
 class object
 {
     public:
@@ -68,13 +90,18 @@ class object
         const std::string& name() const { return m_obj_name; }
         uint64_t created_at() const { return m_obj_slot; }
         uint64_t last_executed() const;
-        std::string last_state();
-        void set_child(pid_t child, int fd);
+        // the last snapshot followed by every call executed since
+        bool last_state(std::string* state);
+        // the region is the shared memory for the channel to the child
+        void set_child(pid_t child, int fd, int region);
+        // takes ownership; used instead of set_child for in-process objects
+        void set_executor(rsm_executor* exec);
         bool failed();
         bool done();
         // must call set_child before these functions
         void ctor();
-        void rtor(e::unpacker up);
+        // "version" is that of the snapshot, as read by replica::relaunch
+        void rtor(uint64_t version, e::unpacker up);
         void cond_wait(server_id si, uint64_t nonce,
                        const e::slice& cond,
                        uint64_t state);
@@ -85,6 +112,8 @@ class object
                   uint64_t command_nonce,
                   server_id si,
                   uint64_t request_nonce);
+        // no more calls will be made with this slot
+        void close_slot(uint64_t slot);
         void take_snapshot(e::intrusive_ptr<snapshot> snap);
         void fail_at(uint64_t slot);
         void keepalive();
@@ -95,11 +124,39 @@ class object
 
     private:
         void run();
+        bool do_tor(bool has_ctor);
+        bool do_tor_inproc(bool has_ctor);
+        bool do_tor_output();
+        void do_apply_delta(const std::string& delta);
         void do_cond_wait(const enqueued_cond_wait& cw);
         void do_nop();
         void do_call(const enqueued_call& c);
+        // a call of "slot" is about to run; publishes the slot before it
+        void executing_slot(uint64_t slot);
+        void executed_slot(uint64_t slot);
+        // true if the next two calls can go to the child together
+        bool batchable(const std::list<enqueued_call>& calls, uint64_t limit);
+        // execute and pop the calls before "limit" that batchable admits
+        void do_call_batch(std::list<enqueued_call>* calls, uint64_t limit);
+        void do_call_responses(const enqueued_call& c);
+        void record_call(const enqueued_call& c);
+        static size_t command_size(const e::slice& func, const e::slice& input);
+        static size_t batch_cost(const enqueued_call& c);
+        static e::packer pack_command(e::packer pa, const e::slice& func, const e::slice& input);
+        void do_call_inproc(const enqueued_call& c,
+                            const e::slice& func,
+                            const e::slice& input);
         void do_snapshot(e::intrusive_ptr<snapshot> snap);
-        void do_snapshot(std::string* s);
+        // returns false if the snapshot is left to async_snapshot
+        bool do_snapshot(std::string* s, e::intrusive_ptr<snapshot> snap);
+        void finish_snapshot(bool is_delta, std::string* state, std::string* s);
+        void pack_snapshot_header(std::string* s);
+        void start_async_snapshot(int fd, e::intrusive_ptr<snapshot> snap);
+        void async_snapshot();
+        void wait_async_snapshot();
+        void reset_replay();
+        void spill_replay();
+        bool read_replay(uint64_t offset, std::string* out);
         void do_call_log(const enqueued_call& c);
         void do_call_cond_create();
         void do_call_cond_destroy();
@@ -110,8 +167,24 @@ class object
         void do_call_output(const enqueued_call& c);
         void do_failure();
         void fail();
+        void log_output(const enqueued_call* c, const char* data, size_t data_sz);
+        void cond_create(const std::string& cond);
+        void cond_destroy(const std::string& cond);
+        bool cond_broadcast(const std::string& cond);
+        bool cond_broadcast_data(const std::string& cond,
+                                 const char* data, size_t data_sz);
+        bool cond_current_value(const std::string& cond, uint64_t* state,
+                                const char** data, size_t* data_sz);
+        void tick_interval(const std::string& func, uint64_t seconds);
         bool read(char* data, size_t sz);
+        bool read_fd(char* c, int* fd);
         bool write(const char* data, size_t sz);
+        bool write_chunked(const std::string& data);
+        bool read_chunked(std::string* data);
+        static bool read_chunked(po6::io::fd* fd, std::string* data);
+
+    private:
+        friend class rsm_executor;
 
     // refcount
     private:
@@ -133,13 +206,18 @@ class object
         po6::threads::cond m_cond;
         pid_t m_obj_pid;
         po6::io::fd m_fd;
+        shm_channel m_chan;
+        std::auto_ptr<rsm_executor> m_exec;
         bool m_has_ctor;
         bool m_has_rtor;
         std::string m_rtor;
+        std::vector<std::string> m_rtor_deltas;
         std::list<enqueued_cond_wait> m_cond_waits;
         std::list<enqueued_call> m_calls;
         std::list<e::intrusive_ptr<snapshot> > m_snapshots;
         uint64_t m_highest_slot;
+        // the slot of the open calls handed over, or zero if none
+        uint64_t m_open_slot;
         uint64_t m_fail_at;
         bool m_failed;
         bool m_done;
@@ -148,6 +226,13 @@ class object
         // snapshot state
         po6::threads::mutex m_snap_mtx;
         std::string m_snap;
+        // calls executed since m_snap; once more than m_replay_limit bytes are
+        // held in memory they move, in order, to the append-only spill file
+        // and m_replay holds only what came after
+        const uint64_t m_replay_limit;
+        std::string m_replay;
+        po6::io::fd m_spill;
+        uint64_t m_spill_sz;
 
         // state to only be used by the background thread (except at init)
         po6::threads::thread m_thread;
@@ -155,6 +240,29 @@ class object
         cond_map_t m_conditions;
         std::string m_tick_func;
         uint64_t m_tick_interval;
+        // the call an in-process state machine is executing, if any
+        const enqueued_call* m_executing;
+        // true while a read-only call executes; its side effects are dropped
+        bool m_reading;
+        // the last full snapshot and the deltas taken on top of it
+        std::string m_snap_base;
+        std::vector<std::string> m_snap_deltas;
+        size_t m_snap_delta_bytes;
+        bool m_snap_dirty;
+        // m_open_slot as of the calls being executed, and the slot of the
+        // last call run, which is not published until all its calls are done
+        uint64_t m_exec_open;
+        uint64_t m_exec_pending;
+
+        // a snapshot being written by a forked copy of the state machine;
+        // owned by the async thread from start_async_snapshot until joined
+        std::auto_ptr<po6::threads::thread> m_async_thread;
+        po6::io::fd m_async_fd;
+        e::intrusive_ptr<snapshot> m_async_snap;
+        std::string m_async_header;
+        size_t m_async_off;
+        std::string m_async_state;
+        bool m_async_ok;
 
         // to be written/read with atomics
         uint64_t m_last_executed;
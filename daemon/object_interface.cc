@@ -27,11 +27,14 @@
 // C
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 // POSIX
+#include <sys/socket.h>
 #include <unistd.h>
 
 // STL
+#include <algorithm>
 #include <new>
 #include <vector>
 
@@ -45,7 +48,10 @@
 
 // Replicant
 #include "visibility.h"
+#include "common/constants.h"
+#include "daemon/fd_passing.h"
 #include "daemon/object_interface.h"
+#include "daemon/shm_channel.h"
 
 #pragma GCC diagnostic ignored "-Wsuggest-attribute=format"
 
@@ -58,12 +64,21 @@ struct object_interface
     void write(const char* data, size_t sz);
 
     po6::io::fd fd;
+    replicant::shm_channel chan;
     FILE* debug_stream;
     bool shutdown;
 
+    // position within a chunked snapshot being read
+    uint32_t snap_remain;
+    bool snap_eof;
+
     std::string tmp1;
     std::string tmp2;
 
+    // commands of a batch not yet handed to object_read_command
+    std::string batch;
+    size_t batch_off;
+
     private:
         object_interface(const object_interface&);
         object_interface& operator = (const object_interface&);
@@ -71,10 +86,15 @@ struct object_interface
 
 object_interface :: object_interface(int f)
     : fd(f)
+    , chan()
     , debug_stream(NULL)
     , shutdown(false)
+    , snap_remain(0)
+    , snap_eof(false)
     , tmp1()
     , tmp2()
+    , batch()
+    , batch_off(0)
 {
     int tty = open("/dev/tty", O_RDWR);
 
@@ -95,7 +115,19 @@ object_interface :: ~object_interface() throw ()
 void
 object_interface :: read(char* data, size_t sz)
 {
-    if (fd.xread(data, sz) != ssize_t(sz))
+    if (chan.attached())
+    {
+        if (!chan.read(data, sz))
+        {
+            if (shutdown)
+            {
+                abort();
+            }
+
+            object_permanent_error(this, "short read: daemon went away");
+        }
+    }
+    else if (fd.xread(data, sz) != ssize_t(sz))
     {
         if (errno == EINTR || shutdown)
         {
@@ -111,7 +143,19 @@ object_interface :: read(char* data, size_t sz)
 void
 object_interface :: write(const char* data, size_t sz)
 {
-    if (fd.xwrite(data, sz) != ssize_t(sz))
+    if (chan.attached())
+    {
+        if (!chan.write(data, sz))
+        {
+            if (shutdown)
+            {
+                abort();
+            }
+
+            object_permanent_error(this, "short write: daemon went away");
+        }
+    }
+    else if (fd.xwrite(data, sz) != ssize_t(sz))
     {
         if (errno == EINTR || shutdown)
         {
@@ -124,6 +168,22 @@ object_interface :: write(const char* data, size_t sz)
     }
 }
 
+// The daemon sends the shared memory for the channel over the socket before
+// anything else.
+static int
+receive_region(int sock)
+{
+    char c;
+    int region = -1;
+
+    if (!replicant::recv_fd(sock, &c, &region))
+    {
+        return -1;
+    }
+
+    return region;
+}
+
 extern "C"
 {
 
@@ -142,6 +202,28 @@ object_interface_create(int fd)
     return obj_int;
 }
 
+REPLICANT_API object_interface*
+object_interface_create_channel(int fd)
+{
+    object_interface* obj_int = object_interface_create(fd);
+
+    if (!obj_int)
+    {
+        return NULL;
+    }
+
+    e::guard g_obj_int = e::makeguard(object_interface_destroy, obj_int);
+    po6::io::fd region(receive_region(fd));
+
+    if (region.get() < 0 || !obj_int->chan.attach(region.get(), false, fd))
+    {
+        return NULL;
+    }
+
+    g_obj_int.dismiss();
+    return obj_int;
+}
+
 REPLICANT_API void
 object_interface_destroy(object_interface* obj_int)
 {
@@ -179,6 +261,7 @@ object_permanent_error(object_interface* obj_int, const char* format, ...)
     e::pack32be(o, head + 1);
     obj_int->write(head, 5);
     obj_int->write(buf, ret);
+    obj_int->chan.flush();
     free(buf);
     obj_int->fd.close();
     abort();
@@ -195,14 +278,20 @@ object_next_action(object_interface* obj_int, action_t* action)
     char act;
     obj_int->read(&act, 1);
     *action = static_cast<action_t>(act);
+    obj_int->snap_remain = 0;
+    obj_int->snap_eof = false;
 
     switch (*action)
     {
         case ACTION_CTOR:
         case ACTION_RTOR:
         case ACTION_COMMAND:
+        case ACTION_COMMAND_BATCH:
+        case ACTION_COMMAND_READONLY:
         case ACTION_SNAPSHOT:
         case ACTION_NOP:
+        case ACTION_SNAPSHOT_DELTA:
+        case ACTION_APPLY_DELTA:
             return 0;
         case ACTION_SHUTDOWN:
             obj_int->shutdown = true;
@@ -215,23 +304,72 @@ object_next_action(object_interface* obj_int, action_t* action)
 REPLICANT_API void
 object_read_snapshot(object_interface* obj_int, const char** data, size_t* data_sz)
 {
-    char buf[4];
-    obj_int->read(buf, 4);
-    uint32_t size;
-    e::unpack32be(buf, &size);
-    std::vector<char> snap(size);
-    obj_int->read(&snap[0], size);
-    obj_int->tmp1.assign(&snap[0], size);
+    obj_int->tmp1.clear();
+    char buf[4096];
+    size_t sz;
+
+    while ((sz = object_read_snapshot_chunk(obj_int, buf, sizeof(buf))) > 0)
+    {
+        obj_int->tmp1.append(buf, sz);
+    }
+
     *data = obj_int->tmp1.data();
     *data_sz = obj_int->tmp1.size();
 }
 
+REPLICANT_API size_t
+object_read_snapshot_chunk(object_interface* obj_int, char* data, size_t data_sz)
+{
+    while (obj_int->snap_remain == 0 && !obj_int->snap_eof)
+    {
+        char buf[4];
+        obj_int->read(buf, 4);
+        e::unpack32be(buf, &obj_int->snap_remain);
+        obj_int->snap_eof = obj_int->snap_remain == 0;
+    }
+
+    if (obj_int->snap_eof)
+    {
+        return 0;
+    }
+
+    const size_t sz = std::min(data_sz, size_t(obj_int->snap_remain));
+    obj_int->read(data, sz);
+    obj_int->snap_remain -= sz;
+    return sz;
+}
+
+// A batch is taken off the channel whole, so its commands come from memory.
+static void
+read_command_bytes(object_interface* obj_int, char* data, size_t sz)
+{
+    if (obj_int->batch_off >= obj_int->batch.size())
+    {
+        obj_int->read(data, sz);
+        return;
+    }
+
+    if (obj_int->batch.size() - obj_int->batch_off < sz)
+    {
+        object_permanent_error(obj_int, "received corrupt command batch");
+    }
+
+    memmove(data, obj_int->batch.data() + obj_int->batch_off, sz);
+    obj_int->batch_off += sz;
+
+    if (obj_int->batch_off == obj_int->batch.size())
+    {
+        obj_int->batch.clear();
+        obj_int->batch_off = 0;
+    }
+}
+
 REPLICANT_API void
 object_read_command(object_interface* obj_int, command* cmd)
 {
     // read the size of the command
     char buf[8];
-    obj_int->read(buf, 8);
+    read_command_bytes(obj_int, buf, 8);
     uint64_t size;
     e::unpack64be(buf, &size);
 
@@ -242,7 +380,7 @@ object_read_command(object_interface* obj_int, command* cmd)
 
     size -= 8;
     std::vector<char> msg(size);
-    obj_int->read(&msg[0], size);
+    read_command_bytes(obj_int, &msg[0], size);
     uint32_t func_size;
     e::unpack32be(&msg[0], &func_size);
 
@@ -266,6 +404,36 @@ object_read_command(object_interface* obj_int, command* cmd)
     cmd->input_sz = obj_int->tmp2.size();
 }
 
+REPLICANT_API uint32_t
+object_read_command_batch(object_interface* obj_int)
+{
+    char buf[8];
+    obj_int->read(buf, 4);
+    uint32_t count;
+    e::unpack32be(buf, &count);
+    obj_int->batch.clear();
+    obj_int->batch_off = 0;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        obj_int->read(buf, 8);
+        uint64_t size;
+        e::unpack64be(buf, &size);
+
+        if (size < 16 || size > REPLICANT_OBJECT_BATCH_BYTES)
+        {
+            object_permanent_error(obj_int, "received corrupt command batch");
+        }
+
+        const size_t off = obj_int->batch.size();
+        obj_int->batch.append(buf, 8);
+        obj_int->batch.resize(off + size);
+        obj_int->read(&obj_int->batch[off + 8], size - 8);
+    }
+
+    return count;
+}
+
 REPLICANT_API void
 object_command_log(object_interface* obj_int,
                    const char *format, va_list ap)
@@ -422,11 +590,52 @@ REPLICANT_API void
 object_snapshot(object_interface* obj_int,
                 const char* data, size_t data_sz)
 {
-    uint32_t o = data_sz;
+    object_snapshot_chunk(obj_int, data, data_sz);
+    object_snapshot_end(obj_int);
+}
+
+REPLICANT_API void
+object_snapshot_chunk(object_interface* obj_int,
+                      const char* data, size_t data_sz)
+{
+    while (data_sz > 0)
+    {
+        uint32_t o = std::min(data_sz, size_t(REPLICANT_SNAPSHOT_CHUNK_SIZE));
+        char buf[4];
+        e::pack32be(o, buf);
+        obj_int->write(buf, 4);
+        obj_int->write(data, o);
+        data += o;
+        data_sz -= o;
+    }
+}
+
+REPLICANT_API void
+object_snapshot_end(object_interface* obj_int)
+{
     char buf[4];
-    e::pack32be(o, buf);
+    e::pack32be(uint32_t(0), buf);
     obj_int->write(buf, 4);
-    obj_int->write(data, o);
+}
+
+REPLICANT_API void
+object_snapshot_kind(object_interface* obj_int, int is_delta)
+{
+    obj_int->write(is_delta ? "d" : "f", 1);
+}
+
+REPLICANT_API void
+object_snapshot_async(object_interface* obj_int, int fd)
+{
+    // the kind travels with the rest of the response; the descriptor can only
+    // go over the socket
+    obj_int->write("a", 1);
+    obj_int->chan.flush();
+
+    if (!replicant::send_fd(obj_int->fd.get(), 'a', fd))
+    {
+        object_permanent_error(obj_int, "could not pass snapshot descriptor: %s", po6::strerror(errno).c_str());
+    }
 }
 
 REPLICANT_API void
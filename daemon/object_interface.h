@@ -44,6 +44,9 @@ extern "C"
 struct object_interface;
 
 struct object_interface* object_interface_create(int fd);
+/* like object_interface_create, but first receives the shared memory through
+ * which the daemon and the object exchange everything but descriptors */
+struct object_interface* object_interface_create_channel(int fd);
 void object_interface_destroy(struct object_interface* obj_int);
 
 void object_permanent_error(struct object_interface* obj_int, const char* format, ...) __attribute__ ((noreturn));
@@ -55,6 +58,10 @@ enum action_t
     ACTION_COMMAND  = 3,
     ACTION_SNAPSHOT = 4,
     ACTION_NOP = 5,
+    ACTION_SNAPSHOT_DELTA = 6,
+    ACTION_APPLY_DELTA = 7,
+    ACTION_COMMAND_BATCH = 8,
+    ACTION_COMMAND_READONLY = 9,
     ACTION_SHUTDOWN = 16
 };
 
@@ -81,8 +88,13 @@ enum command_response_t
 };
 
 void object_read_snapshot(struct object_interface* obj_int, const char** data, size_t* data_sz);
+size_t object_read_snapshot_chunk(struct object_interface* obj_int, char* data, size_t data_sz);
 
 void object_read_command(struct object_interface* obj_int, struct command* cmd);
+/* a batch is a count followed by that many commands, each answered in turn as
+ * if it had arrived on its own; the whole batch is read before this returns,
+ * and object_read_command then hands out its commands one at a time */
+uint32_t object_read_command_batch(struct object_interface* obj_int);
 void object_command_log(struct object_interface* obj_int,
                         const char *format, va_list ap);
 void object_command_output(struct object_interface* obj_int,
@@ -103,8 +115,15 @@ void object_tick_interval(struct object_interface* obj_int,
                           const char* func,
                           uint64_t seconds);
 
+/* snapshots travel as 32-bit length-prefixed chunks ended by an empty one */
 void object_snapshot(struct object_interface* obj_int,
                      const char* data, size_t data_sz);
+void object_snapshot_chunk(struct object_interface* obj_int,
+                           const char* data, size_t data_sz);
+void object_snapshot_end(struct object_interface* obj_int);
+void object_snapshot_kind(struct object_interface* obj_int, int is_delta);
+/* hand the daemon a descriptor from which the snapshot will be read */
+void object_snapshot_async(struct object_interface* obj_int, int fd);
 
 void object_nop_response(struct object_interface* obj_int);
 
@@ -0,0 +1,84 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef replicant_daemon_pending_read_h_
+#define replicant_daemon_pending_read_h_
+
+// STL
+#include <string>
+
+// Replicant
+#include "namespace.h"
+#include "common/ids.h"
+
+BEGIN_REPLICANT_NAMESPACE
+
+// A read-only call from a client, held until the leader hands out a read
+// index and the replica has learned every slot below it.
+class pending_read
+{
+    public:
+        pending_read(server_id on_behalf_of,
+                     uint64_t request_nonce,
+                     const std::string& obj,
+                     const std::string& func,
+                     const std::string& input);
+        ~pending_read() throw ();
+
+    public:
+        server_id on_behalf_of() const { return m_on_behalf_of; }
+        uint64_t request_nonce() const { return m_request_nonce; }
+        const std::string& obj() const { return m_obj; }
+        const std::string& func() const { return m_func; }
+        const std::string& input() const { return m_input; }
+
+        bool has_index() const { return m_has_index; }
+        uint64_t index() const { return m_index; }
+        void set_index(uint64_t index);
+
+        uint64_t requested_at() const { return m_requested_at; }
+        void set_requested_at(uint64_t when) { m_requested_at = when; }
+
+    private:
+        const server_id m_on_behalf_of;
+        const uint64_t m_request_nonce;
+        const std::string m_obj;
+        const std::string m_func;
+        const std::string m_input;
+        bool m_has_index;
+        uint64_t m_index;
+        uint64_t m_requested_at;
+
+    // noncopyable
+    private:
+        pending_read(const pending_read&);
+        pending_read& operator = (const pending_read&);
+};
+
+END_REPLICANT_NAMESPACE
+
+#endif // replicant_daemon_pending_read_h_
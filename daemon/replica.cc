@@ -33,10 +33,12 @@
 
 // C
 #include <limits.h>
+#include <string.h>
 
 // POSIX
 #include <signal.h>
 #include <spawn.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 
 // STL
@@ -45,8 +47,12 @@
 // Google Log
 #include <glog/logging.h>
 
+// po6
+#include <po6/io/fd.h>
+
 // e
 #include <e/compat.h>
+#include <e/endian.h>
 #include <e/guard.h>
 #include <e/strescape.h>
 
@@ -54,8 +60,11 @@
 #include "common/atomic_io.h"
 #include "common/packing.h"
 #include "daemon/daemon.h"
+#include "daemon/fd_passing.h"
 #include "daemon/replica.h"
 #include "daemon/robust_history.h"
+#include "daemon/rsm_executor.h"
+#include "daemon/shm_channel.h"
 #include "daemon/slot_type.h"
 
 #pragma GCC diagnostic ignored "-Wunsafe-loop-optimizations"
@@ -132,6 +141,7 @@ replica :: replica(daemon* d, const configuration& c)
     , m_cond_config(c.version().get())
     , m_cond_tick()
     , m_s()
+    , m_snapshot_policy()
     , m_defended()
     , m_counter(0)
     , m_command_nonces()
@@ -140,11 +150,12 @@ replica :: replica(daemon* d, const configuration& c)
     , m_dying_objects()
     , m_failed_objects()
     , m_robust()
+    , m_batching(false)
     , m_snapshots_mtx()
     , m_snapshots()
     , m_latest_snapshot_mtx()
     , m_latest_snapshot_slot(0)
-    , m_latest_snapshot_backing()
+    , m_latest_snapshot()
 {
     for (size_t i = 0; i < REPLICANT_MAX_REPLICAS; ++i)
     {
@@ -216,6 +227,7 @@ replica :: learn(const pvalue& p)
     while (!m_pvalues.empty() && m_pvalues.begin()->s == m_slot)
     {
         execute(m_pvalues.front());
+        m_snapshot_policy.executed(m_pvalues.front().c.size());
         m_pvalues.erase(m_pvalues.begin());
         ++m_slot;
 
@@ -227,12 +239,27 @@ replica :: learn(const pvalue& p)
             e::packer(&packed) << c;
             m_cond_config.broadcast(m_daemon, packed.data(), packed.size());
             assert(m_cond_config.peek_state() == c.version().get());
-            initiate_snapshot();
+
+            m_snapshot_policy.reset(m_cond_tick.peek_state());
+
+            if (initiate_snapshot())
+            {
+                m_snapshot_policy.taken(snapshot_policy::CONFIG);
+            }
         }
 
-        if (m_slot % 250 == 0)
+        const uint64_t tick = m_cond_tick.peek_state();
+        snapshot_policy::reason_t why;
+
+        if (m_snapshot_policy.should_snapshot(m_s, tick, &why))
         {
-            initiate_snapshot();
+            m_snapshot_policy.reset(tick);
+
+            if (initiate_snapshot())
+            {
+                LOG_IF(INFO, s_debug_mode) << "initiating snapshot at " << m_slot << " because of " << why;
+                m_snapshot_policy.taken(why);
+            }
         }
     }
 }
@@ -325,6 +352,43 @@ replica :: cond_wait(server_id si, uint64_t nonce,
     }
 }
 
+void
+replica :: call_readonly(server_id si, uint64_t nonce,
+                         const e::slice& _obj,
+                         const e::slice& func,
+                         const e::slice& input)
+{
+    std::string obj(_obj.cdata(), _obj.size());
+
+    // the builtin object has no read-only functions
+    if (obj == "replicant")
+    {
+        m_daemon->callback_client(si, nonce, REPLICANT_FUNC_NOT_FOUND, "");
+        return;
+    }
+
+    object_map_t::iterator it = m_objects.find(obj);
+
+    if (m_failed_objects.find(obj) != m_failed_objects.end())
+    {
+        m_daemon->callback_client(si, nonce, REPLICANT_MAYBE, "");
+    }
+    else if (it != m_objects.end() && it->second)
+    {
+        // the object picks the slot; the read goes behind its pending calls
+        const uint64_t reflects = m_slot > 0 ? m_slot - 1 : 0;
+        it->second->call(func, input, pvalue(), OBJECT_CALL_READONLY, reflects, si, nonce);
+    }
+    else if (it != m_objects.end())
+    {
+        m_daemon->callback_client(si, nonce, REPLICANT_MAYBE, "");
+    }
+    else
+    {
+        m_daemon->callback_client(si, nonce, REPLICANT_OBJ_NOT_FOUND, "object not found");
+    }
+}
+
 bool
 replica :: has_output(uint64_t nonce,
                       uint64_t min_slot,
@@ -376,15 +440,16 @@ replica :: strike_number(server_id si) const
 
 void
 replica :: take_blocking_snapshot(uint64_t* snapshot_slot,
-                                  e::slice* snapshot,
-                                  std::auto_ptr<e::buffer>* snapshot_backing)
+                                  e::intrusive_ptr<snapshot>* snap)
 {
+    // as in learn, the policy counts from the snapshot it just took
+    m_snapshot_policy.reset(m_cond_tick.peek_state());
     initiate_snapshot();
     snapshot_barrier();
-    get_last_snapshot(snapshot_slot, snapshot, snapshot_backing);
+    get_last_snapshot(snapshot_slot, snap);
 }
 
-void
+bool
 replica :: initiate_snapshot()
 {
     e::intrusive_ptr<snapshot> snap;
@@ -398,14 +463,14 @@ replica :: initiate_snapshot()
             if (it->second->failed())
             {
                 LOG(INFO) << "skipping snapshot because \"" << e::strescape(it->first) << "\" has failed";
-                return;
+                return false;
             }
         }
 
         // don't take snapshots out of order or duplicate them
         if (!m_snapshots.empty() && m_snapshots.back()->slot() >= m_slot)
         {
-            return;
+            return false;
         }
 
         snap = new snapshot(m_slot, &m_robust);
@@ -442,6 +507,8 @@ replica :: initiate_snapshot()
     {
         snapshot_finished();
     }
+
+    return true;
 }
 
 replica*
@@ -491,6 +558,8 @@ replica :: from_snapshot(daemon* d, const e::slice& snap)
         return NULL;
     }
 
+    // every replica reset its policy when it took this snapshot
+    rep->m_snapshot_policy.reset(rep->m_cond_tick.peek_state());
     rep->m_command_nonces = std::deque<uint64_t>(command_nonces.begin(), command_nonces.end());
 
     for (size_t i = 0; i < command_nonces.size(); ++i)
@@ -547,12 +616,11 @@ replica :: last_snapshot_num()
 
 void
 replica :: get_last_snapshot(uint64_t* snapshot_slot,
-                             e::slice* snapshot,
-                             std::auto_ptr<e::buffer>* snapshot_backing)
+                             e::intrusive_ptr<snapshot>* snap)
 {
     bool block = false;
     m_latest_snapshot_mtx.lock();
-    block = !m_latest_snapshot_backing.get();
+    block = !m_latest_snapshot;
     m_latest_snapshot_mtx.unlock();
 
     if (block)
@@ -566,13 +634,12 @@ replica :: get_last_snapshot(uint64_t* snapshot_slot,
     if (m_latest_snapshot_slot == 0)
     {
         *snapshot_slot = 0;
-        *snapshot = e::slice();
+        *snap = NULL;
         return;
     }
 
     *snapshot_slot = m_latest_snapshot_slot;
-    snapshot_backing->reset(m_latest_snapshot_backing->copy());
-    *snapshot = (*snapshot_backing)->as_slice();
+    *snap = m_latest_snapshot;
 }
 
 void
@@ -586,12 +653,10 @@ replica :: snapshot_finished()
     {
         if ((*it)->done())
         {
+            (*it)->seal();
             po6::threads::mutex::hold hold2(&m_latest_snapshot_mtx);
             snap_slot = m_latest_snapshot_slot = (*it)->slot();
-            const std::string& snap((*it)->contents());
-            m_latest_snapshot_backing.reset(e::buffer::create(snap.size()));
-            m_latest_snapshot_backing->resize(snap.size());
-            memmove(m_latest_snapshot_backing->data(), snap.data(), snap.size());
+            m_latest_snapshot = *it;
             break;
         }
     }
@@ -636,15 +701,29 @@ replica :: execute(const pvalue& p)
         return;
     }
 
+    execute_command(p, e::slice(p.c));
+}
+
+void
+replica :: execute_command(const pvalue& p, const e::slice& cmd)
+{
     slot_type type;
     uint8_t flags;
     uint64_t nonce;
-    e::unpacker up(p.c.data(), p.c.size());
+    e::unpacker up(cmd.cdata(), cmd.size());
     up = up >> type >> flags >> nonce;
 
     if (up.error())
     {
-        LOG(ERROR) << "bad command: " << e::slice(p.c).hex();
+        LOG(ERROR) << "bad command: " << cmd.hex();
+        return;
+    }
+
+    // a batch carries no nonce of its own; every command within it is
+    // executed in order as if it had been given the slot alone
+    if (type == SLOT_BATCH)
+    {
+        execute_batch(p, up);
         return;
     }
 
@@ -719,11 +798,12 @@ replica :: execute(const pvalue& p)
             execute_poke(up.remainder());
             break;
         case SLOT_CALL:
+        case SLOT_BATCH:
             abort();
         case SLOT_NOP:
             break;
         default:
-            LOG(ERROR) << "bad command: " << e::slice(p.c).hex();
+            LOG(ERROR) << "bad command: " << cmd.hex();
             break;
     }
 
@@ -733,6 +813,58 @@ replica :: execute(const pvalue& p)
     }
 }
 
+void
+replica :: execute_batch(const pvalue& p, e::unpacker up)
+{
+    m_batching = true;
+
+    while (up.remain() && !up.error())
+    {
+        e::slice cmd;
+        up = up >> cmd;
+
+        if (up.error())
+        {
+            break;
+        }
+
+        // the daemon never nests batches; refuse to recurse on one that does
+        slot_type type = SLOT_NOP;
+        e::unpacker tup(cmd.cdata(), cmd.size());
+        tup = tup >> type;
+
+        if (type == SLOT_BATCH)
+        {
+            LOG(ERROR) << "ignoring nested batch of commands in slot " << p.s;
+            continue;
+        }
+
+        execute_command(p, cmd);
+    }
+
+    m_batching = false;
+
+    for (object_map_t::iterator it = m_objects.begin();
+            it != m_objects.end(); ++it)
+    {
+        if (it->second)
+        {
+            it->second->close_slot(p.s);
+        }
+    }
+
+    if (up.error())
+    {
+        LOG(ERROR) << "bad batch of commands in slot " << p.s;
+    }
+}
+
+unsigned
+replica :: object_call_flags(unsigned flags) const
+{
+    return m_batching ? flags | OBJECT_CALL_OPEN : flags;
+}
+
 void
 replica :: execute_server_become_member(const pvalue& p, e::unpacker up)
 {
@@ -1035,11 +1167,13 @@ replica :: execute_list_objects(const pvalue& p,
 void
 replica :: post_fail_action(object* obj, repair_info* ri)
 {
-    if (ri->highest == obj->last_executed())
+    std::string state;
+
+    if (ri->highest == obj->last_executed() && obj->last_state(&state))
     {
         std::string repair;
         e::packer pa(&repair);
-        pa = pa << e::slice(obj->name()) << ri->when << m_daemon->id() << ri->highest << e::slice(obj->last_state());
+        pa = pa << e::slice(obj->name()) << ri->when << m_daemon->id() << ri->highest << e::slice(state);
         m_daemon->enqueue_paxos_command(SLOT_OBJECT_REPAIR, repair);
     }
 }
@@ -1139,7 +1273,7 @@ replica :: execute_tick(const pvalue& p,
     for (object_map_t::iterator it = m_objects.begin();
             it != m_objects.end(); ++it)
     {
-        it->second->call("__tick__", t, p, flags, command_nonce, si, request_nonce);
+        it->second->call("__tick__", t, p, object_call_flags(flags), command_nonce, si, request_nonce);
     }
 
     const uint64_t DEFEND_TIMEOUT = m_s.DEFEND_TIMEOUT;
@@ -1198,7 +1332,11 @@ replica :: execute_call(const pvalue& p,
     {
         if (func == e::slice("new_object"))
         {
-            execute_new_object(p, flags, command_nonce, si, request_nonce, input);
+            execute_new_object(p, flags, command_nonce, si, request_nonce, input, OBJECT_LIBRARY);
+        }
+        else if (func == e::slice("new_object_in_process"))
+        {
+            execute_new_object(p, flags, command_nonce, si, request_nonce, input, OBJECT_LIBRARY_INPROC);
         }
         else if (func == e::slice("del_object"))
         {
@@ -1228,6 +1366,10 @@ replica :: execute_call(const pvalue& p,
         {
             execute_kill_server(p, flags, command_nonce, si, request_nonce, input);
         }
+        else if (func == e::slice("set_setting"))
+        {
+            execute_set_setting(p, flags, command_nonce, si, request_nonce, input);
+        }
         else if (func == e::slice("defended"))
         {
             execute_defended(p, flags, command_nonce, si, request_nonce, input);
@@ -1262,7 +1404,7 @@ replica :: execute_call(const pvalue& p,
         }
         else if (it != m_objects.end() && it->second)
         {
-            it->second->call(func, input, p, flags, command_nonce, si, request_nonce);
+            it->second->call(func, input, p, object_call_flags(flags), command_nonce, si, request_nonce);
         }
         else if (it != m_objects.end())
         {
@@ -1281,7 +1423,8 @@ replica :: execute_new_object(const pvalue& p,
                               uint64_t command_nonce,
                               server_id si,
                               uint64_t request_nonce,
-                              const e::slice& input)
+                              const e::slice& input,
+                              object_t t)
 {
     const size_t name_sz = strnlen(input.cdata(), input.size());
     const std::string name(input.cdata(), name_sz);
@@ -1302,7 +1445,7 @@ replica :: execute_new_object(const pvalue& p,
 
     const std::string lib(input.cdata() + name_sz + 1, input.size() - name_sz - 1);
     LOG(INFO) << "creating object \"" << e::strescape(name) << "\"";
-    e::intrusive_ptr<object> obj = launch_library(name, p.s, lib);
+    e::intrusive_ptr<object> obj = launch_library(name, p.s, lib, t);
 
     if (obj)
     {
@@ -1360,7 +1503,7 @@ replica :: execute_backup_object(const pvalue& p,
         return;
     }
 
-    it->second->call("__backup__", "", p, flags, command_nonce, si, request_nonce);
+    it->second->call("__backup__", "", p, object_call_flags(flags), command_nonce, si, request_nonce);
 }
 
 void
@@ -1508,6 +1651,38 @@ replica :: execute_kill_server(const pvalue& p,
     executed(p, flags, command_nonce, si, request_nonce, REPLICANT_SUCCESS, "");
 }
 
+void
+replica :: execute_set_setting(const pvalue& p,
+                               unsigned flags,
+                               uint64_t command_nonce,
+                               server_id si,
+                               uint64_t request_nonce,
+                               const e::slice& input)
+{
+    const size_t name_sz = strnlen(input.cdata(), input.size());
+
+    if (name_sz + 1 + sizeof(uint64_t) != input.size())
+    {
+        LOG(ERROR) << "invalid command to change a setting";
+        executed(p, flags, command_nonce, si, request_nonce, REPLICANT_INTERNAL, "invalid setting");
+        return;
+    }
+
+    const e::slice name(input.cdata(), name_sz);
+    uint64_t value;
+    e::unpack64be(input.cdata() + name_sz + 1, &value);
+
+    if (!m_s.set(name, value))
+    {
+        LOG(ERROR) << "cannot change setting \"" << e::strescape(name.str()) << "\"";
+        executed(p, flags, command_nonce, si, request_nonce, REPLICANT_INTERNAL, "setting cannot be changed");
+        return;
+    }
+
+    LOG(INFO) << "setting " << name.str() << " to " << value;
+    executed(p, flags, command_nonce, si, request_nonce, REPLICANT_SUCCESS, "");
+}
+
 void
 replica :: execute_defended(const pvalue& p,
                             unsigned flags,
@@ -1606,6 +1781,12 @@ replica :: executed(const pvalue& p,
                     replicant_returncode status,
                     const std::string& result)
 {
+    if ((flags & OBJECT_CALL_READONLY))
+    {
+        m_daemon->callback_client(si, request_nonce, status, result, command_nonce);
+        return;
+    }
+
     if (si != server_id())
     {
         m_daemon->callback_client(si, request_nonce, status, result);
@@ -1639,6 +1820,16 @@ replica :: launch(object* obj, const char* executable, char* const * args)
 
     e::guard g_fd0 = e::makeguard(close, fds[0]);
     e::guard g_fd1 = e::makeguard(close, fds[1]);
+    // the child picks up the shared memory for the channel before anything
+    // else it reads from the socket
+    po6::io::fd region(shm_channel::create_region());
+
+    if (region.get() < 0 || !send_fd(fds[0], 'r', region.get()))
+    {
+        PLOG(ERROR) << "could not create object \"" << e::strescape(obj->name()) << "\"";
+        return false;
+    }
+
     char* const envp[] = {0};
     pid_t child = fork();
 
@@ -1666,7 +1857,7 @@ replica :: launch(object* obj, const char* executable, char* const * args)
     }
     else
     {
-        obj->set_child(child, fds[0]);
+        obj->set_child(child, fds[0], region.get());
         g_fd0.dismiss();
         return true;
     }
@@ -1727,9 +1918,10 @@ locate_rsm_dlopen(std::string* path)
 #pragma GCC diagnostic pop
 
 e::intrusive_ptr<replicant::object>
-replica :: launch_library(const std::string& name, uint64_t slot, const std::string& lib)
+replica :: launch_library(const std::string& name, uint64_t slot,
+                          const std::string& lib, object_t t)
 {
-    e::intrusive_ptr<object> obj = new object(this, slot, name, OBJECT_LIBRARY, lib);
+    e::intrusive_ptr<object> obj = new object(this, slot, name, t, lib);
     m_objects[name] = obj;
     std::string libname = library_name(name, slot);
 
@@ -1739,6 +1931,19 @@ replica :: launch_library(const std::string& name, uint64_t slot, const std::str
         return NULL;
     }
 
+    if (t == OBJECT_LIBRARY_INPROC)
+    {
+        std::auto_ptr<rsm_executor> exec(new rsm_executor(obj.get()));
+
+        if (!exec->load(libname))
+        {
+            return NULL;
+        }
+
+        obj->set_executor(exec.release());
+        return obj;
+    }
+
     std::string exe;
 
     if (!locate_rsm_dlopen(&exe))
@@ -1765,9 +1970,11 @@ replica :: launch_library(const std::string& name, uint64_t slot, const std::str
     }
 
     e::guard g_libname = e::makeguard(free, libname_c_str);
+    char fork_flag[] = "--fork-snapshots";
     char* const args[] = {exe_c_str, libname_c_str, 0};
+    char* const fork_args[] = {exe_c_str, fork_flag, libname_c_str, 0};
 
-    if (!launch(obj.get(), exe.c_str(), args))
+    if (!launch(obj.get(), exe.c_str(), m_daemon->fork_snapshots() ? fork_args : args))
     {
         return NULL;
     }
@@ -1778,12 +1985,25 @@ replica :: launch_library(const std::string& name, uint64_t slot, const std::str
 bool
 replica :: relaunch(const e::slice& name, uint64_t slot, const e::slice& snap)
 {
+    uint8_t tag = 0;
+    uint64_t version = 0;
     object_t t;
     e::slice init;
     e::unpacker up(snap);
-    up = up >> t >> init;
+    up = up >> tag;
 
-    if (up.error())
+    if (tag == OBJECT_SNAPSHOT_VERSIONED)
+    {
+        up = up >> e::unpack_varint(version) >> t;
+    }
+    else
+    {
+        t = object_t(tag);
+    }
+
+    up = up >> init;
+
+    if (up.error() || version > OBJECT_SNAPSHOT_VERSION)
     {
         return false;
     }
@@ -1793,7 +2013,8 @@ replica :: relaunch(const e::slice& name, uint64_t slot, const e::slice& snap)
     switch (t)
     {
         case OBJECT_LIBRARY:
-            obj = launch_library(name.str(), slot, init.str());
+        case OBJECT_LIBRARY_INPROC:
+            obj = launch_library(name.str(), slot, init.str(), t);
             break;
         case OBJECT_GARBAGE:
         default:
@@ -1805,6 +2026,6 @@ replica :: relaunch(const e::slice& name, uint64_t slot, const e::slice& snap)
         return false;
     }
 
-    obj->rtor(up);
+    obj->rtor(version, up);
     return true;
 }
@@ -54,6 +54,7 @@
 #include "daemon/robust_history.h"
 #include "daemon/settings.h"
 #include "daemon/snapshot.h"
+#include "daemon/snapshot_policy.h"
 
 BEGIN_REPLICANT_NAMESPACE
 class daemon;
@@ -83,6 +84,11 @@ class replica
                        const e::slice& obj,
                        const e::slice& cond,
                        uint64_t state);
+        // execute a read-only call against the state learned so far
+        void call_readonly(server_id si, uint64_t nonce,
+                           const e::slice& obj,
+                           const e::slice& func,
+                           const e::slice& input);
         bool has_output(uint64_t nonce,
                         uint64_t min_slot,
                         replicant_returncode* status,
@@ -96,12 +102,12 @@ class replica
     // snapshots
     public:
         void take_blocking_snapshot(uint64_t* snapshot_slot,
-                                    e::slice* snapshot,
-                                    std::auto_ptr<e::buffer>* snapshot_backing);
+                                    e::intrusive_ptr<snapshot>* snap);
         uint64_t last_snapshot_num();
+        const snapshot_policy& snapshots() const { return m_snapshot_policy; }
+        // the snapshot is sealed and shared; callers must not modify it
         void get_last_snapshot(uint64_t* snapshot_slot,
-                               e::slice* snapshot,
-                               std::auto_ptr<e::buffer>* snapshot_backing);
+                               e::intrusive_ptr<snapshot>* snap);
         static replica* from_snapshot(daemon* d, const e::slice& snap);
 
     // recovering from object failures
@@ -117,10 +123,14 @@ class replica
         typedef std::map<std::string, repair_info> failure_map_t;
 
     private:
-        void initiate_snapshot();
+        bool initiate_snapshot();
         void snapshot_barrier();
         void snapshot_finished();
         void execute(const pvalue& p);
+        void execute_command(const pvalue& p, const e::slice& cmd);
+        void execute_batch(const pvalue& p, e::unpacker up);
+        // the object::call flags for a call made while executing p
+        unsigned object_call_flags(unsigned flags) const;
         void execute_server_become_member(const pvalue& p, e::unpacker up);
         bool execute_server_add(const pvalue& p, const server& s);
         void execute_server_set_gc_thresh(e::unpacker up);
@@ -160,7 +170,8 @@ class replica
                                 uint64_t command_nonce,
                                 server_id si,
                                 uint64_t request_nonce,
-                                const e::slice& input);
+                                const e::slice& input,
+                                object_t t);
         void execute_del_object(const pvalue& p,
                                 unsigned flags,
                                 uint64_t command_nonce,
@@ -191,6 +202,12 @@ class replica
                                  server_id si,
                                  uint64_t request_nonce,
                                  const e::slice& input);
+        void execute_set_setting(const pvalue& p,
+                                 unsigned flags,
+                                 uint64_t command_nonce,
+                                 server_id si,
+                                 uint64_t request_nonce,
+                                 const e::slice& input);
         void execute_defended(const pvalue& p,
                               unsigned flags,
                               uint64_t command_nonce,
@@ -217,7 +234,8 @@ class replica
                       replicant_returncode status,
                       const std::string& result);
         bool launch(object* obj, const char* executable, char* const * args);
-        e::intrusive_ptr<object> launch_library(const std::string& name, uint64_t slot, const std::string& lib);
+        e::intrusive_ptr<object> launch_library(const std::string& name, uint64_t slot,
+                                                const std::string& lib, object_t t);
         bool relaunch(const e::slice& name, uint64_t slot, const e::slice& state);
 
     private:
@@ -230,6 +248,7 @@ class replica
         condition m_cond_tick;
         condition m_cond_strikes[REPLICANT_MAX_REPLICAS];
         settings m_s;
+        snapshot_policy m_snapshot_policy;
         std::map<uint64_t, defender> m_defended;
         uint64_t m_counter;
         std::deque<uint64_t> m_command_nonces;
@@ -238,6 +257,9 @@ class replica
         object_list_t m_dying_objects;
         failure_map_t m_failed_objects;
         robust_history m_robust;
+        // true while the commands of a batch execute; objects see their calls
+        // as open until execute_batch closes the slot
+        bool m_batching;
 
         // manipulate snapshots
         po6::threads::mutex m_snapshots_mtx;
@@ -246,7 +268,7 @@ class replica
         // protect the latest snapshot
         po6::threads::mutex m_latest_snapshot_mtx;
         uint64_t m_latest_snapshot_slot;
-        std::auto_ptr<e::buffer> m_latest_snapshot_backing;
+        e::intrusive_ptr<snapshot> m_latest_snapshot;
 
     private:
         replica(const replica&);
@@ -31,12 +31,14 @@
 /* POSIX */
 #include <dlfcn.h>
 #include <errno.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 /* Replicant */
 #include <rsm.h>
 #include "daemon/rsm.h"
 #include "daemon/object_interface.h"
+#include "daemon/transition_table.h"
 
 static void
 action_ctor(struct state_machine* rsm,
@@ -45,39 +47,86 @@ action_ctor(struct state_machine* rsm,
 
 static void
 action_rtor(struct state_machine* rsm,
+            struct state_machine_stream* stream,
             void** state,
             struct object_interface* obj_int);
 
 static void
-action_command(struct state_machine* rsm,
+action_command(const struct transition_table* table,
+               int readonly,
                void* state,
                struct object_interface* obj_int);
 
+static void
+action_command_batch(const struct transition_table* table,
+                     void* state,
+                     struct object_interface* obj_int);
+
 static void
 action_snapshot(struct state_machine* rsm,
+                struct state_machine_delta* delta,
+                struct state_machine_stream* stream,
+                int fork_snapshots,
                 void* state,
                 struct object_interface* obj_int);
 
+static void
+action_snapshot_delta(struct state_machine* rsm,
+                      struct state_machine_delta* delta,
+                      struct state_machine_stream* stream,
+                      int fork_snapshots,
+                      void* state,
+                      struct object_interface* obj_int);
+
+static void
+action_apply_delta(struct state_machine_delta* delta,
+                   void* state,
+                   struct object_interface* obj_int);
+
 static void
 action_nop(struct state_machine* rsm,
            void* state,
            struct object_interface* obj_int);
 
+static int
+snapshot_full(struct state_machine* rsm,
+              struct state_machine_stream* stream,
+              struct rsm_context* ctx,
+              void* state);
+
+static int
+snapshot_fork(struct state_machine* rsm,
+              struct state_machine_stream* stream,
+              void* state,
+              struct object_interface* obj_int);
+
 int
 main(int argc, const char* argv[])
 {
     void* lib = NULL;
     struct state_machine* rsm = NULL;
+    struct state_machine_delta* delta = NULL;
+    struct state_machine_stream* stream = NULL;
+    const char** readonly = NULL;
+    struct transition_table table;
     void* state = NULL;
     struct object_interface* obj_int = NULL;
     enum action_t action;
+    int fork_snapshots = 0;
+
+    if (argc == 3 && strcmp(argv[1], "--fork-snapshots") == 0)
+    {
+        fork_snapshots = 1;
+        --argc;
+        ++argv;
+    }
 
     if (argc != 2)
     {
         return EXIT_FAILURE;
     }
 
-    obj_int = object_interface_create(0);
+    obj_int = object_interface_create_channel(0);
 
     if (!obj_int)
     {
@@ -102,6 +151,22 @@ main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (transition_table_init(&table, rsm->transitions) < 0)
+    {
+        object_permanent_error(obj_int, "could not index transitions");
+        return EXIT_FAILURE;
+    }
+
+    /* optional; libraries without them use the callbacks in "rsm" */
+    delta = (struct state_machine_delta*)dlsym(lib, "rsm_delta");
+    stream = (struct state_machine_stream*)dlsym(lib, "rsm_stream");
+    readonly = (const char**)dlsym(lib, "rsm_readonly");
+
+    if (readonly)
+    {
+        transition_table_set_readonly(&table, readonly);
+    }
+
     while (object_next_action(obj_int, &action) == 0)
     {
         switch (action)
@@ -110,13 +175,25 @@ main(int argc, const char* argv[])
                 action_ctor(rsm, &state, obj_int);
                 break;
             case ACTION_RTOR:
-                action_rtor(rsm, &state, obj_int);
+                action_rtor(rsm, stream, &state, obj_int);
                 break;
             case ACTION_COMMAND:
-                action_command(rsm, state, obj_int);
+                action_command(&table, 0, state, obj_int);
+                break;
+            case ACTION_COMMAND_READONLY:
+                action_command(&table, 1, state, obj_int);
+                break;
+            case ACTION_COMMAND_BATCH:
+                action_command_batch(&table, state, obj_int);
                 break;
             case ACTION_SNAPSHOT:
-                action_snapshot(rsm, state, obj_int);
+                action_snapshot(rsm, delta, stream, fork_snapshots, state, obj_int);
+                break;
+            case ACTION_SNAPSHOT_DELTA:
+                action_snapshot_delta(rsm, delta, stream, fork_snapshots, state, obj_int);
+                break;
+            case ACTION_APPLY_DELTA:
+                action_apply_delta(delta, state, obj_int);
                 break;
             case ACTION_NOP:
                 action_nop(rsm, state, obj_int);
@@ -129,6 +206,7 @@ main(int argc, const char* argv[])
         }
     }
 
+    transition_table_destroy(&table);
     object_interface_destroy(obj_int);
     return EXIT_SUCCESS;
 }
@@ -153,17 +231,31 @@ action_ctor(struct state_machine* rsm,
 
 void
 action_rtor(struct state_machine* rsm,
+            struct state_machine_stream* stream,
             void** state,
             struct object_interface* obj_int)
 {
     struct rsm_context ctx;
     const char* data = NULL;
     size_t data_sz = 0;
+    char drain[4096];
 
-    object_read_snapshot(obj_int, &data, &data_sz);
+    if (stream && stream->rtor)
+    {
+        rsm_context_init(&ctx, obj_int);
+        *state = stream->rtor(&ctx);
 
-    rsm_context_init(&ctx, obj_int);
-    *state = rsm->rtor(&ctx, data, data_sz);
+        /* skip whatever the library left unread */
+        while (object_read_snapshot_chunk(obj_int, drain, sizeof(drain)) > 0)
+        {
+        }
+    }
+    else
+    {
+        object_read_snapshot(obj_int, &data, &data_sz);
+        rsm_context_init(&ctx, obj_int);
+        *state = rsm->rtor(&ctx, data, data_sz);
+    }
 
     if (ctx.status != 0)
     {
@@ -175,26 +267,22 @@ action_rtor(struct state_machine* rsm,
 }
 
 void
-action_command(struct state_machine* rsm,
+action_command(const struct transition_table* table,
+               int readonly,
                void* state,
                struct object_interface* obj_int)
 {
     struct command cmd;
     struct rsm_context ctx;
-    struct state_machine_transition* transitions = rsm->transitions;
     struct state_machine_transition* transition = NULL;
 
     object_read_command(obj_int, &cmd);
+    transition = transition_table_lookup(table, cmd.func, strlen(cmd.func));
 
-    while (transitions->name)
+    /* a read may only reach transitions the library vouches for */
+    if (transition && readonly && !transition_table_is_readonly(table, transition))
     {
-        if (strcmp(cmd.func, transitions->name) == 0)
-        {
-            transition = transitions;
-            break;
-        }
-
-        ++transitions;
+        transition = NULL;
     }
 
     if (transition)
@@ -216,27 +304,121 @@ action_command(struct state_machine* rsm,
     }
 }
 
+void
+action_command_batch(const struct transition_table* table,
+                     void* state,
+                     struct object_interface* obj_int)
+{
+    uint32_t count = object_read_command_batch(obj_int);
+    uint32_t i = 0;
+
+    /* Nothing runs until the daemon's whole batch is off the channel.  A
+     * transition that waits on a reply, like rsm_cond_current_value, then
+     * reads only that reply, and the daemon is never left blocked writing
+     * commands while we are blocked writing outputs. */
+    for (i = 0; i < count; ++i)
+    {
+        action_command(table, 0, state, obj_int);
+    }
+}
+
 void
 action_snapshot(struct state_machine* rsm,
+                struct state_machine_delta* delta,
+                struct state_machine_stream* stream,
+                int fork_snapshots,
                 void* state,
                 struct object_interface* obj_int)
 {
-    char* data = NULL;
-    size_t data_sz = 0;
     struct rsm_context ctx;
+
+    /* see action_snapshot_delta for why libraries with deltas never fork */
+    if (!delta && fork_snapshots && snapshot_fork(rsm, stream, state, obj_int) == 0)
+    {
+        return;
+    }
+
+    object_snapshot_kind(obj_int, 0);
     rsm_context_init(&ctx, obj_int);
 
-    if (rsm->snap(&ctx, state, &data, &data_sz) < 0)
+    if (snapshot_full(rsm, stream, &ctx, state) < 0)
     {
         object_permanent_error(obj_int, "snapshot failed");
     }
+}
+
+void
+action_snapshot_delta(struct state_machine* rsm,
+                      struct state_machine_delta* delta,
+                      struct state_machine_stream* stream,
+                      int fork_snapshots,
+                      void* state,
+                      struct object_interface* obj_int)
+{
+    char* data = NULL;
+    size_t data_sz = 0;
+    struct rsm_context ctx;
+    rsm_context_init(&ctx, obj_int);
 
-    object_snapshot(obj_int, data, data_sz);
+    if (delta && delta->delta && delta->apply &&
+        delta->delta(&ctx, state, &data, &data_sz) == 0)
+    {
+        object_snapshot_kind(obj_int, 1);
+        object_snapshot(obj_int, data, data_sz);
+
+        if (data)
+        {
+            free(data);
+        }
+
+        return;
+    }
 
     if (data)
     {
         free(data);
     }
+
+    /* a forked snapshot would not reset the library's delta tracking in this
+     * process, so only libraries without deltas take this path */
+    if (!delta && fork_snapshots && snapshot_fork(rsm, stream, state, obj_int) == 0)
+    {
+        return;
+    }
+
+    object_snapshot_kind(obj_int, 0);
+
+    if (snapshot_full(rsm, stream, &ctx, state) < 0)
+    {
+        object_permanent_error(obj_int, "snapshot failed");
+    }
+}
+
+void
+action_apply_delta(struct state_machine_delta* delta,
+                   void* state,
+                   struct object_interface* obj_int)
+{
+    struct rsm_context ctx;
+    const char* data = NULL;
+    size_t data_sz = 0;
+
+    object_read_snapshot(obj_int, &data, &data_sz);
+
+    if (!delta || !delta->apply)
+    {
+        object_permanent_error(obj_int, "snapshot contains deltas, but library does not export \"rsm_delta\"");
+    }
+
+    rsm_context_init(&ctx, obj_int);
+
+    if (delta->apply(&ctx, state, data, data_sz) != 0 || ctx.status != 0)
+    {
+        object_permanent_error(obj_int, "applying snapshot delta failed");
+    }
+
+    object_command_output(ctx.obj_int, REPLICANT_SUCCESS, ctx.output, ctx.output_sz);
+    rsm_context_finish(&ctx);
 }
 
 static void
@@ -248,3 +430,188 @@ action_nop(struct state_machine* rsm,
     (void) rsm;
     (void) state;
 }
+
+int
+snapshot_full(struct state_machine* rsm,
+              struct state_machine_stream* stream,
+              struct rsm_context* ctx,
+              void* state)
+{
+    char* data = NULL;
+    size_t data_sz = 0;
+
+    if (stream && stream->snap)
+    {
+        if (stream->snap(ctx, state) < 0)
+        {
+            return -1;
+        }
+
+        object_snapshot_end(ctx->snap_int);
+        return 0;
+    }
+
+    if (rsm->snap(ctx, state, &data, &data_sz) < 0)
+    {
+        return -1;
+    }
+
+    object_snapshot(ctx->snap_int, data, data_sz);
+
+    if (data)
+    {
+        free(data);
+    }
+
+    return 0;
+}
+
+/* The process writing a forked snapshot shares the daemon's channel with its
+ * parent, so it must never touch it.  Everything but the snapshot itself goes
+ * nowhere; a snapshot has no business changing conditions anyway. */
+static void
+fork_log(void* arg, const char* format, va_list ap)
+{
+    (void) arg;
+    (void) format;
+    (void) ap;
+}
+
+static void
+fork_cond(void* arg, const char* cond)
+{
+    (void) arg;
+    (void) cond;
+}
+
+static int
+fork_cond_broadcast(void* arg, const char* cond)
+{
+    (void) arg;
+    (void) cond;
+    return -1;
+}
+
+static int
+fork_cond_broadcast_data(void* arg, const char* cond,
+                         const char* data, size_t data_sz)
+{
+    (void) arg;
+    (void) cond;
+    (void) data;
+    (void) data_sz;
+    return -1;
+}
+
+static int
+fork_cond_current_value(void* arg, const char* cond, uint64_t* state,
+                        const char** data, size_t* data_sz)
+{
+    (void) arg;
+    (void) cond;
+    (void) state;
+    (void) data;
+    (void) data_sz;
+    return -1;
+}
+
+static void
+fork_tick_interval(void* arg, const char* func, uint64_t seconds)
+{
+    (void) arg;
+    (void) func;
+    (void) seconds;
+}
+
+static void
+fork_snapshot_write(void* arg, const char* data, size_t data_sz)
+{
+    object_snapshot_chunk((struct object_interface*)arg, data, data_sz);
+}
+
+static size_t
+fork_snapshot_read(void* arg, char* data, size_t data_sz)
+{
+    (void) arg;
+    (void) data;
+    (void) data_sz;
+    return 0;
+}
+
+static const struct rsm_context_ops fork_ops = {
+    fork_log,
+    fork_cond,
+    fork_cond,
+    fork_cond_broadcast,
+    fork_cond_broadcast_data,
+    fork_cond_current_value,
+    fork_tick_interval,
+    fork_snapshot_write,
+    fork_snapshot_read
+};
+
+int
+snapshot_fork(struct state_machine* rsm,
+              struct state_machine_stream* stream,
+              void* state,
+              struct object_interface* obj_int)
+{
+    int fds[2];
+    pid_t child;
+    int status = 0;
+    struct rsm_context ctx;
+    struct object_interface* out = NULL;
+
+    if (pipe(fds) < 0)
+    {
+        return -1;
+    }
+
+    child = fork();
+
+    if (child < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    else if (child == 0)
+    {
+        /* fork again so that init reaps the process doing the snapshot */
+        close(fds[0]);
+        child = fork();
+
+        if (child == 0)
+        {
+            out = object_interface_create(fds[1]);
+
+            if (!out)
+            {
+                _exit(EXIT_FAILURE);
+            }
+
+            rsm_context_init(&ctx, out);
+            ctx.ops = &fork_ops;
+            ctx.ops_arg = out;
+            _exit(snapshot_full(rsm, stream, &ctx, state) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        _exit(child < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+        close(fds[0]);
+        return -1;
+    }
+
+    object_snapshot_async(obj_int, fds[0]);
+    close(fds[0]);
+    return 0;
+}
@@ -51,7 +51,16 @@ rsm_log(rsm_context* ctx, const char* format, ...)
 {
     va_list args;
     va_start(args, format);
-    object_command_log(ctx->obj_int, format, args);
+
+    if (ctx->ops)
+    {
+        ctx->ops->log(ctx->ops_arg, format, args);
+    }
+    else
+    {
+        object_command_log(ctx->obj_int, format, args);
+    }
+
     va_end(args);
 }
 
@@ -80,18 +89,33 @@ rsm_set_output(rsm_context* ctx, const char* output, size_t output_sz)
 REPLICANT_API void
 rsm_cond_create(rsm_context* ctx, const char* cond)
 {
+    if (ctx->ops)
+    {
+        return ctx->ops->cond_create(ctx->ops_arg, cond);
+    }
+
     return object_cond_create(ctx->obj_int, cond);
 }
 
 REPLICANT_API void
 rsm_cond_destroy(rsm_context* ctx, const char* cond)
 {
+    if (ctx->ops)
+    {
+        return ctx->ops->cond_destroy(ctx->ops_arg, cond);
+    }
+
     return object_cond_destroy(ctx->obj_int, cond);
 }
 
 REPLICANT_API int
 rsm_cond_broadcast(rsm_context* ctx, const char* cond)
 {
+    if (ctx->ops)
+    {
+        return ctx->ops->cond_broadcast(ctx->ops_arg, cond);
+    }
+
     return object_cond_broadcast(ctx->obj_int, cond);
 }
 
@@ -100,6 +124,11 @@ rsm_cond_broadcast_data(rsm_context* ctx,
                         const char* cond,
                         const char* data, size_t data_sz)
 {
+    if (ctx->ops)
+    {
+        return ctx->ops->cond_broadcast_data(ctx->ops_arg, cond, data, data_sz);
+    }
+
     return object_cond_broadcast_data(ctx->obj_int, cond, data, data_sz);
 }
 
@@ -108,19 +137,54 @@ rsm_cond_current_value(rsm_context* ctx,
                        const char* cond, uint64_t* state,
                        const char** data, size_t* data_sz)
 {
+    if (ctx->ops)
+    {
+        return ctx->ops->cond_current_value(ctx->ops_arg, cond, state, data, data_sz);
+    }
+
     return object_cond_current_value(ctx->obj_int, cond, state, data, data_sz);
 }
 
 REPLICANT_API void
 rsm_tick_interval(struct rsm_context* ctx, const char* func, uint64_t seconds)
 {
+    if (ctx->ops)
+    {
+        return ctx->ops->tick_interval(ctx->ops_arg, func, seconds);
+    }
+
     return object_tick_interval(ctx->obj_int, func, seconds);
 }
 
+REPLICANT_API void
+rsm_snapshot_write(rsm_context* ctx, const char* data, size_t data_sz)
+{
+    if (ctx->ops)
+    {
+        return ctx->ops->snapshot_write(ctx->ops_arg, data, data_sz);
+    }
+
+    object_snapshot_chunk(ctx->snap_int, data, data_sz);
+}
+
+REPLICANT_API size_t
+rsm_snapshot_read(rsm_context* ctx, char* data, size_t data_sz)
+{
+    if (ctx->ops)
+    {
+        return ctx->ops->snapshot_read(ctx->ops_arg, data, data_sz);
+    }
+
+    return object_read_snapshot_chunk(ctx->snap_int, data, data_sz);
+}
+
 REPLICANT_API void
 rsm_context_init(rsm_context* ctx, object_interface* obj_int)
 {
     ctx->obj_int = obj_int;
+    ctx->snap_int = obj_int;
+    ctx->ops = NULL;
+    ctx->ops_arg = NULL;
     ctx->status = 0;
     ctx->output = NULL;
     ctx->output_sz = 0;
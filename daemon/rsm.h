@@ -28,6 +28,11 @@
 #ifndef replicant_daemon_rsm_h_
 #define replicant_daemon_rsm_h_
 
+/* C */
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -35,9 +40,30 @@ extern "C"
 
 struct object_interface;
 
+/* When a state machine runs inside the daemon there is no object interface to
+ * talk to; every rsm_* call is handed to these instead, along with ops_arg. */
+struct rsm_context_ops
+{
+    void (*log)(void* arg, const char* format, va_list ap);
+    void (*cond_create)(void* arg, const char* cond);
+    void (*cond_destroy)(void* arg, const char* cond);
+    int (*cond_broadcast)(void* arg, const char* cond);
+    int (*cond_broadcast_data)(void* arg, const char* cond,
+                               const char* data, size_t data_sz);
+    int (*cond_current_value)(void* arg, const char* cond, uint64_t* state,
+                              const char** data, size_t* data_sz);
+    void (*tick_interval)(void* arg, const char* func, uint64_t seconds);
+    void (*snapshot_write)(void* arg, const char* data, size_t data_sz);
+    size_t (*snapshot_read)(void* arg, char* data, size_t data_sz);
+};
+
 struct rsm_context
 {
     struct object_interface* obj_int;
+    /* where snapshot chunks are written to and read from */
+    struct object_interface* snap_int;
+    const struct rsm_context_ops* ops;
+    void* ops_arg;
     int status;
     char* output;
     size_t output_sz;
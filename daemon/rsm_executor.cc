@@ -0,0 +1,373 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <dlfcn.h>
+
+// STL
+#include <algorithm>
+
+// Google Log
+#include <glog/logging.h>
+
+// e
+#include <e/strescape.h>
+
+// Replicant
+#include "daemon/object.h"
+#include "daemon/rsm_executor.h"
+
+using replicant::rsm_executor;
+
+const rsm_context_ops rsm_executor::ops = {
+    &rsm_executor::log,
+    &rsm_executor::cond_create,
+    &rsm_executor::cond_destroy,
+    &rsm_executor::cond_broadcast,
+    &rsm_executor::cond_broadcast_data,
+    &rsm_executor::cond_current_value,
+    &rsm_executor::tick_interval,
+    &rsm_executor::snapshot_write,
+    &rsm_executor::snapshot_read
+};
+
+rsm_executor :: rsm_executor(object* obj)
+    : m_obj(obj)
+    , m_lib(NULL)
+    , m_rsm(NULL)
+    , m_transitions()
+    , m_delta(NULL)
+    , m_stream(NULL)
+    , m_state(NULL)
+    , m_snap_out(NULL)
+    , m_snap_in()
+{
+}
+
+rsm_executor :: ~rsm_executor() throw ()
+{
+    transition_table_destroy(&m_transitions);
+
+    if (m_lib)
+    {
+        dlclose(m_lib);
+    }
+}
+
+bool
+rsm_executor :: load(const std::string& path)
+{
+    m_lib = dlopen(path.c_str(), RTLD_NOW|RTLD_LOCAL);
+
+    if (!m_lib)
+    {
+        const char* err = dlerror();
+        LOG(ERROR) << "could not load library " << path << ": "
+                   << (err ? err : "<no error provided>");
+        return false;
+    }
+
+    m_rsm = static_cast<state_machine*>(dlsym(m_lib, "rsm"));
+
+    if (!m_rsm)
+    {
+        LOG(ERROR) << "could not find \"rsm\" symbol in library " << path;
+        return false;
+    }
+
+    if (transition_table_init(&m_transitions, m_rsm->transitions) < 0)
+    {
+        LOG(ERROR) << "could not index transitions in library " << path;
+        return false;
+    }
+
+    // optional; libraries without them use the callbacks in "rsm"
+    m_delta = static_cast<state_machine_delta*>(dlsym(m_lib, "rsm_delta"));
+    m_stream = static_cast<state_machine_stream*>(dlsym(m_lib, "rsm_stream"));
+    const char** readonly = static_cast<const char**>(dlsym(m_lib, "rsm_readonly"));
+
+    if (readonly)
+    {
+        transition_table_set_readonly(&m_transitions, readonly);
+    }
+
+    return true;
+}
+
+bool
+rsm_executor :: ctor()
+{
+    rsm_context ctx;
+    init_context(&ctx);
+    m_state = m_rsm->ctor(&ctx);
+    const bool ok = ctx.status == 0;
+    finish_context(&ctx);
+    return ok;
+}
+
+bool
+rsm_executor :: rtor(const std::string& state)
+{
+    rsm_context ctx;
+    init_context(&ctx);
+
+    if (m_stream && m_stream->rtor)
+    {
+        m_snap_in = e::slice(state);
+        m_state = m_stream->rtor(&ctx);
+        m_snap_in = e::slice();
+    }
+    else
+    {
+        m_state = m_rsm->rtor(&ctx, state.data(), state.size());
+    }
+
+    const bool ok = ctx.status == 0;
+    finish_context(&ctx);
+    return ok;
+}
+
+bool
+rsm_executor :: apply_delta(const std::string& delta)
+{
+    if (!m_delta || !m_delta->apply)
+    {
+        LOG(ERROR) << "snapshot contains deltas, but library does not export \"rsm_delta\"";
+        return false;
+    }
+
+    rsm_context ctx;
+    init_context(&ctx);
+    const bool ok = m_delta->apply(&ctx, m_state, delta.data(), delta.size()) == 0 &&
+                    ctx.status == 0;
+    finish_context(&ctx);
+    return ok;
+}
+
+bool
+rsm_executor :: call(const e::slice& func, const e::slice& input, bool readonly,
+                     replicant_returncode* status, std::string* output)
+{
+    state_machine_transition* transition =
+        transition_table_lookup(&m_transitions, func.cdata(), func.size());
+
+    if (!transition ||
+        (readonly && !transition_table_is_readonly(&m_transitions, transition)))
+    {
+        *status = REPLICANT_FUNC_NOT_FOUND;
+        output->clear();
+        return true;
+    }
+
+    rsm_context ctx;
+    init_context(&ctx);
+    transition->func(&ctx, m_state, input.cdata(), input.size());
+    const bool ok = ctx.status == 0;
+    *status = REPLICANT_SUCCESS;
+    output->assign(ctx.output ? ctx.output : "", ctx.output_sz);
+    finish_context(&ctx);
+    return ok;
+}
+
+bool
+rsm_executor :: snapshot(bool want_delta, bool* is_delta, std::string* state)
+{
+    char* data = NULL;
+    size_t data_sz = 0;
+    rsm_context ctx;
+    init_context(&ctx);
+    *is_delta = false;
+
+    if (want_delta && m_delta && m_delta->delta && m_delta->apply &&
+        m_delta->delta(&ctx, m_state, &data, &data_sz) == 0)
+    {
+        *is_delta = true;
+        state->assign(data ? data : "", data_sz);
+    }
+
+    if (data)
+    {
+        free(data);
+    }
+
+    // there is no copy-on-write fork in here; that would fork the daemon
+    const bool ok = *is_delta || snapshot_full(&ctx, state);
+    finish_context(&ctx);
+    return ok;
+}
+
+void
+rsm_executor :: log(void* arg, const char* format, va_list ap)
+{
+    rsm_executor* exec = static_cast<rsm_executor*>(arg);
+    char* buf = NULL;
+    int ret = vasprintf(&buf, format, ap);
+
+    if (ret < 0)
+    {
+        return;
+    }
+
+    exec->m_obj->log_output(exec->m_obj->m_executing, buf, ret);
+    free(buf);
+}
+
+void
+rsm_executor :: cond_create(void* arg, const char* cond)
+{
+    static_cast<rsm_executor*>(arg)->m_obj->cond_create(cond);
+}
+
+void
+rsm_executor :: cond_destroy(void* arg, const char* cond)
+{
+    static_cast<rsm_executor*>(arg)->m_obj->cond_destroy(cond);
+}
+
+int
+rsm_executor :: cond_broadcast(void* arg, const char* cond)
+{
+    return static_cast<rsm_executor*>(arg)->m_obj->cond_broadcast(cond) ? 0 : -1;
+}
+
+int
+rsm_executor :: cond_broadcast_data(void* arg, const char* cond,
+                                    const char* data, size_t data_sz)
+{
+    return static_cast<rsm_executor*>(arg)->m_obj->cond_broadcast_data(cond, data, data_sz) ? 0 : -1;
+}
+
+int
+rsm_executor :: cond_current_value(void* arg, const char* cond, uint64_t* state,
+                                   const char** data, size_t* data_sz)
+{
+    const char* d = NULL;
+    size_t d_sz = 0;
+
+    if (!static_cast<rsm_executor*>(arg)->m_obj->cond_current_value(cond, state, &d, &d_sz))
+    {
+        return -1;
+    }
+
+    // the library frees this, just as it would the copy from the child's pipe
+    char* ptr = static_cast<char*>(malloc(std::max(d_sz, size_t(1))));
+
+    if (!ptr)
+    {
+        return -1;
+    }
+
+    memmove(ptr, d, d_sz);
+    *data = ptr;
+    *data_sz = d_sz;
+    return 0;
+}
+
+void
+rsm_executor :: tick_interval(void* arg, const char* func, uint64_t seconds)
+{
+    static_cast<rsm_executor*>(arg)->m_obj->tick_interval(func, seconds);
+}
+
+void
+rsm_executor :: snapshot_write(void* arg, const char* data, size_t data_sz)
+{
+    rsm_executor* exec = static_cast<rsm_executor*>(arg);
+
+    if (exec->m_snap_out)
+    {
+        exec->m_snap_out->append(data, data_sz);
+    }
+}
+
+size_t
+rsm_executor :: snapshot_read(void* arg, char* data, size_t data_sz)
+{
+    rsm_executor* exec = static_cast<rsm_executor*>(arg);
+    const size_t sz = std::min(data_sz, exec->m_snap_in.size());
+    memmove(data, exec->m_snap_in.data(), sz);
+    exec->m_snap_in = e::slice(exec->m_snap_in.data() + sz, exec->m_snap_in.size() - sz);
+    return sz;
+}
+
+void
+rsm_executor :: init_context(rsm_context* ctx)
+{
+    ctx->obj_int = NULL;
+    ctx->snap_int = NULL;
+    ctx->ops = &ops;
+    ctx->ops_arg = this;
+    ctx->status = 0;
+    ctx->output = NULL;
+    ctx->output_sz = 0;
+}
+
+void
+rsm_executor :: finish_context(rsm_context* ctx)
+{
+    if (ctx->output)
+    {
+        free(ctx->output);
+        ctx->output = NULL;
+        ctx->output_sz = 0;
+    }
+}
+
+bool
+rsm_executor :: snapshot_full(rsm_context* ctx, std::string* state)
+{
+    state->clear();
+
+    if (m_stream && m_stream->snap)
+    {
+        m_snap_out = state;
+        const int ret = m_stream->snap(ctx, m_state);
+        m_snap_out = NULL;
+        return ret >= 0;
+    }
+
+    char* data = NULL;
+    size_t data_sz = 0;
+    const int ret = m_rsm->snap(ctx, m_state, &data, &data_sz);
+
+    if (ret >= 0)
+    {
+        state->assign(data ? data : "", data_sz);
+    }
+
+    if (data)
+    {
+        free(data);
+    }
+
+    return ret >= 0;
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef replicant_daemon_rsm_executor_h_
+#define replicant_daemon_rsm_executor_h_
+
+// C
+#include <stdarg.h>
+#include <stdint.h>
+
+// STL
+#include <string>
+
+// e
+#include <e/slice.h>
+
+// Replicant
+#include <replicant.h>
+#include <rsm.h>
+#include "namespace.h"
+#include "daemon/rsm.h"
+#include "daemon/transition_table.h"
+
+BEGIN_REPLICANT_NAMESPACE
+class object;
+
+// Runs a state machine library inside the daemon, on the object's own thread.
+// The library's rsm_* calls land directly on the object instead of crossing a
+// pipe, so a library that crashes takes the daemon down with it.
+class rsm_executor
+{
+    public:
+        rsm_executor(object* obj);
+        ~rsm_executor() throw ();
+
+    public:
+        bool load(const std::string& path);
+        // each returns false if the state machine failed
+        bool ctor();
+        bool rtor(const std::string& state);
+        bool apply_delta(const std::string& delta);
+        // a read-only call may only reach transitions in "rsm_readonly"
+        bool call(const e::slice& func, const e::slice& input, bool readonly,
+                  replicant_returncode* status, std::string* output);
+        bool snapshot(bool want_delta, bool* is_delta, std::string* state);
+
+    private:
+        static const rsm_context_ops ops;
+        static void log(void* arg, const char* format, va_list ap);
+        static void cond_create(void* arg, const char* cond);
+        static void cond_destroy(void* arg, const char* cond);
+        static int cond_broadcast(void* arg, const char* cond);
+        static int cond_broadcast_data(void* arg, const char* cond,
+                                       const char* data, size_t data_sz);
+        static int cond_current_value(void* arg, const char* cond, uint64_t* state,
+                                      const char** data, size_t* data_sz);
+        static void tick_interval(void* arg, const char* func, uint64_t seconds);
+        static void snapshot_write(void* arg, const char* data, size_t data_sz);
+        static size_t snapshot_read(void* arg, char* data, size_t data_sz);
+        void init_context(rsm_context* ctx);
+        static void finish_context(rsm_context* ctx);
+        bool snapshot_full(rsm_context* ctx, std::string* state);
+
+    private:
+        object* const m_obj;
+        void* m_lib;
+        state_machine* m_rsm;
+        transition_table m_transitions;
+        state_machine_delta* m_delta;
+        state_machine_stream* m_stream;
+        void* m_state;
+        // the target of rsm_snapshot_write and source of rsm_snapshot_read
+        std::string* m_snap_out;
+        e::slice m_snap_in;
+
+    private:
+        rsm_executor(const rsm_executor&);
+        rsm_executor& operator = (const rsm_executor&);
+};
+
+END_REPLICANT_NAMESPACE
+
+#endif // replicant_daemon_rsm_executor_h_
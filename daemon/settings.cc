@@ -40,27 +40,113 @@ settings :: settings()
     : SUSPECT_TIMEOUT(5 * SECONDS)
     , SUSPECT_STRIKES(5)
     , DEFEND_TIMEOUT(10)
+    , SNAPSHOT_MIN_INTERVAL(1 * SECONDS)
+    , SNAPSHOT_INTERVAL(60 * SECONDS)
+    , SNAPSHOT_BYTES(64ULL * 1024ULL * 1024ULL)
 {
 }
 
+bool
+settings :: set(const e::slice& name, uint64_t value)
+{
+    // Failure detection, leases and defended objects all derive their timing
+    // from the SUSPECT_* and DEFEND_* settings, and there is no safe way to
+    // change them under a running cluster, so only the snapshot policy, for
+    // which every value is sane (zero disables the trigger), may be changed.
+#define SETTING(X) if (name == e::slice(#X)) { X = value; return true; }
+    SETTING(SNAPSHOT_MIN_INTERVAL)
+    SETTING(SNAPSHOT_INTERVAL)
+    SETTING(SNAPSHOT_BYTES)
+#undef SETTING
+    return false;
+}
+
+// Settings used to be three bare integers.  They are now tagged with a leading
+// SETTINGS_TAG, which no suspect timeout could be, followed by the number of
+// integers that follow.  A reader keeps the fields it knows and skips the
+// rest, so fields may be appended without breaking old snapshots or newer
+// peers.  Servers that predate the tag cannot read it, so while the snapshot
+// policy keeps its defaults the settings are written in the legacy form; the
+// tagged form appears only once set-setting changes the policy.
+#define SETTINGS_TAG 0xffffffffffffffffULL
+#define SETTINGS_FIELDS 6
+
+// in the order operator << writes them
+static uint64_t*
+field(settings* s, uint64_t idx)
+{
+    uint64_t* fields[SETTINGS_FIELDS] = {&s->SUSPECT_TIMEOUT,
+                                         &s->SUSPECT_STRIKES,
+                                         &s->DEFEND_TIMEOUT,
+                                         &s->SNAPSHOT_MIN_INTERVAL,
+                                         &s->SNAPSHOT_INTERVAL,
+                                         &s->SNAPSHOT_BYTES};
+    return idx < SETTINGS_FIELDS ? fields[idx] : NULL;
+}
+
+static bool
+legacy(const settings& s)
+{
+    const settings d;
+    return s.SNAPSHOT_MIN_INTERVAL == d.SNAPSHOT_MIN_INTERVAL &&
+           s.SNAPSHOT_INTERVAL == d.SNAPSHOT_INTERVAL &&
+           s.SNAPSHOT_BYTES == d.SNAPSHOT_BYTES;
+}
+
 e::packer
 replicant :: operator << (e::packer lhs, const settings& rhs)
 {
-    return lhs << rhs.SUSPECT_TIMEOUT
+    if (legacy(rhs))
+    {
+        return lhs << rhs.SUSPECT_TIMEOUT
+                   << rhs.SUSPECT_STRIKES
+                   << rhs.DEFEND_TIMEOUT;
+    }
+
+    return lhs << uint64_t(SETTINGS_TAG)
+               << uint64_t(SETTINGS_FIELDS)
+               << rhs.SUSPECT_TIMEOUT
                << rhs.SUSPECT_STRIKES
-               << rhs.DEFEND_TIMEOUT;
+               << rhs.DEFEND_TIMEOUT
+               << rhs.SNAPSHOT_MIN_INTERVAL
+               << rhs.SNAPSHOT_INTERVAL
+               << rhs.SNAPSHOT_BYTES;
 }
 
 e::unpacker
 replicant :: operator >> (e::unpacker lhs, settings& rhs)
 {
-    return lhs >> rhs.SUSPECT_TIMEOUT
-               >> rhs.SUSPECT_STRIKES
-               >> rhs.DEFEND_TIMEOUT;
+    uint64_t tag = 0;
+    lhs = lhs >> tag;
+
+    if (tag != SETTINGS_TAG)
+    {
+        rhs = settings();
+        rhs.SUSPECT_TIMEOUT = tag;
+        return lhs >> rhs.SUSPECT_STRIKES
+                   >> rhs.DEFEND_TIMEOUT;
+    }
+
+    uint64_t count = 0;
+    lhs = lhs >> count;
+
+    for (uint64_t i = 0; i < count && !lhs.error(); ++i)
+    {
+        uint64_t value = 0;
+        lhs = lhs >> value;
+        uint64_t* f = field(&rhs, i);
+
+        if (f && !lhs.error())
+        {
+            *f = value;
+        }
+    }
+
+    return lhs;
 }
 
 size_t
-replicant :: pack_size(const settings&)
+replicant :: pack_size(const settings& rhs)
 {
-    return 3 * pack_size(uint64_t());
+    return (legacy(rhs) ? 3 : 2 + SETTINGS_FIELDS) * pack_size(uint64_t());
 }
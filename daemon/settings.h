@@ -33,6 +33,7 @@
 
 // e
 #include <e/serialization.h>
+#include <e/slice.h>
 
 // Replicant
 #include "namespace.h"
@@ -44,10 +45,17 @@ class settings
     public:
         settings();
 
+    public:
+        // false if there is no such setting or it cannot be changed
+        bool set(const e::slice& name, uint64_t value);
+
     public:
         uint64_t SUSPECT_TIMEOUT;
         uint64_t SUSPECT_STRIKES;
         uint64_t DEFEND_TIMEOUT;
+        uint64_t SNAPSHOT_MIN_INTERVAL;
+        uint64_t SNAPSHOT_INTERVAL;
+        uint64_t SNAPSHOT_BYTES;
 };
 
 e::packer
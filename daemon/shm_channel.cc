@@ -0,0 +1,302 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+// POSIX
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Linux
+#include <linux/futex.h>
+
+// STL
+#include <algorithm>
+
+// e
+#include <e/atomic.h>
+
+// Replicant
+#include "common/constants.h"
+#include "daemon/shm_channel.h"
+
+using replicant::shm_channel;
+
+// Each index is a count of bytes that only ever grows, and lives on its own
+// cache line.  A side that finds nothing to do sets "waiting" and sleeps on
+// "seq"; the other side bumps "seq" and wakes it only when "waiting" is set.
+struct shm_channel::ring
+{
+    // advanced by the producer
+    uint64_t head;
+    char pad1[56];
+    // advanced by the consumer
+    uint64_t tail;
+    char pad2[56];
+    uint32_t data_seq;
+    uint32_t data_waiting;
+    char pad3[56];
+    uint32_t space_seq;
+    uint32_t space_waiting;
+    char pad4[56];
+    char data[REPLICANT_SHM_RING_SIZE];
+};
+
+static int
+futex(uint32_t* addr, int op, uint32_t val, const struct timespec* ts)
+{
+    return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+int
+shm_channel :: create_region()
+{
+    int fd = memfd_create("replicant-object", MFD_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (ftruncate(fd, 2 * sizeof(ring)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+shm_channel :: shm_channel()
+    : m_base(NULL)
+    , m_in(NULL)
+    , m_out(NULL)
+    , m_pending(0)
+    , m_peer(-1)
+    , m_spin(0)
+{
+}
+
+shm_channel :: ~shm_channel() throw ()
+{
+    if (m_base)
+    {
+        munmap(m_base, 2 * sizeof(ring));
+    }
+}
+
+bool
+shm_channel :: attach(int region, bool daemon, int peer)
+{
+    assert(!m_base);
+    void* base = mmap(NULL, 2 * sizeof(ring), PROT_READ|PROT_WRITE, MAP_SHARED, region, 0);
+
+    if (base == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_base = static_cast<char*>(base);
+    ring* rings = reinterpret_cast<ring*>(m_base);
+    m_out = daemon ? &rings[0] : &rings[1];
+    m_in = daemon ? &rings[1] : &rings[0];
+    m_pending = e::atomic::load_64_acquire(&m_out->head);
+    m_peer = peer;
+    // spinning only helps when the other side can run at the same time
+    m_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? REPLICANT_SHM_RING_SPIN : 0;
+    return true;
+}
+
+bool
+shm_channel :: read(char* data, size_t sz)
+{
+    // the other side cannot answer what it has not yet seen
+    flush();
+
+    while (sz > 0)
+    {
+        const uint64_t tail = m_in->tail;
+        const uint64_t head = e::atomic::load_64_acquire(&m_in->head);
+
+        if (head == tail)
+        {
+            if (!wait(&m_in->head, head, &m_in->data_waiting, &m_in->data_seq))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        const size_t off = tail & (REPLICANT_SHM_RING_SIZE - 1);
+        const size_t amt = std::min(sz, std::min(size_t(head - tail), size_t(REPLICANT_SHM_RING_SIZE - off)));
+        memmove(data, m_in->data + off, amt);
+        e::atomic::store_64_release(&m_in->tail, tail + amt);
+        wake(&m_in->space_waiting, &m_in->space_seq);
+        data += amt;
+        sz -= amt;
+    }
+
+    return true;
+}
+
+bool
+shm_channel :: write(const char* data, size_t sz)
+{
+    while (sz > 0)
+    {
+        const uint64_t tail = e::atomic::load_64_acquire(&m_out->tail);
+        const size_t space = REPLICANT_SHM_RING_SIZE - (m_pending - tail);
+
+        if (space == 0)
+        {
+            flush();
+
+            if (!wait(&m_out->tail, tail, &m_out->space_waiting, &m_out->space_seq))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        const size_t off = m_pending & (REPLICANT_SHM_RING_SIZE - 1);
+        const size_t amt = std::min(sz, std::min(space, size_t(REPLICANT_SHM_RING_SIZE - off)));
+        memmove(m_out->data + off, data, amt);
+        m_pending += amt;
+        data += amt;
+        sz -= amt;
+    }
+
+    return true;
+}
+
+void
+shm_channel :: flush()
+{
+    if (m_base && m_pending != m_out->head)
+    {
+        e::atomic::store_64_release(&m_out->head, m_pending);
+        wake(&m_out->data_waiting, &m_out->data_seq);
+    }
+}
+
+void
+shm_channel :: interrupt()
+{
+    if (!m_base)
+    {
+        return;
+    }
+
+    __sync_fetch_and_add(&m_in->data_seq, 1);
+    futex(&m_in->data_seq, FUTEX_WAKE, INT_MAX, NULL);
+    __sync_fetch_and_add(&m_out->space_seq, 1);
+    futex(&m_out->space_seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+bool
+shm_channel :: wait(uint64_t* pos, uint64_t seen, uint32_t* waiting, uint32_t* seq)
+{
+    for (unsigned i = 0; i < m_spin; ++i)
+    {
+        if (e::atomic::load_64_acquire(pos) != seen)
+        {
+            return true;
+        }
+    }
+
+    while (true)
+    {
+        const uint32_t s = e::atomic::load_32_acquire(seq);
+        e::atomic::store_32_release(waiting, 1);
+        // pairs with the barrier in wake:  either we see the new position, or
+        // the other side sees that we are waiting
+        __sync_synchronize();
+
+        if (e::atomic::load_64_acquire(pos) == seen)
+        {
+            struct timespec ts;
+            ts.tv_sec = REPLICANT_SHM_RING_TIMEOUT / 1000;
+            ts.tv_nsec = (REPLICANT_SHM_RING_TIMEOUT % 1000) * 1000000L;
+            futex(seq, FUTEX_WAIT, s, &ts);
+        }
+
+        e::atomic::store_32_release(waiting, 0);
+
+        if (e::atomic::load_64_acquire(pos) != seen)
+        {
+            return true;
+        }
+
+        // whatever the peer wrote before going away is still worth reading
+        if (!peer_alive())
+        {
+            return e::atomic::load_64_acquire(pos) != seen;
+        }
+    }
+}
+
+void
+shm_channel :: wake(uint32_t* waiting, uint32_t* seq)
+{
+    __sync_synchronize();
+
+    if (e::atomic::load_32_acquire(waiting))
+    {
+        __sync_fetch_and_add(seq, 1);
+        futex(seq, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+bool
+shm_channel :: peer_alive()
+{
+    if (m_peer < 0)
+    {
+        return false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = m_peer;
+    pfd.events = POLLRDHUP;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 0) < 0)
+    {
+        return errno == EINTR;
+    }
+
+    return (pfd.revents & (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL)) == 0;
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef replicant_daemon_shm_channel_h_
+#define replicant_daemon_shm_channel_h_
+
+// C
+#include <stddef.h>
+#include <stdint.h>
+
+// Replicant
+#include "namespace.h"
+
+BEGIN_REPLICANT_NAMESPACE
+
+// The channel between the daemon and an object's child process:  one
+// single-producer/single-consumer byte ring in each direction, in memory that
+// both processes map.  Writes are copied into the outgoing ring and published
+// together when the writer flushes or turns around to read, so that a command
+// and its responses each cost at most one futex wake.  A reader spins briefly
+// before sleeping.  The socket between the processes stays around to carry
+// descriptors and to notice when the other side has gone away.
+class shm_channel
+{
+    public:
+        // an anonymous region sized for one channel, or -1 on error
+        static int create_region();
+
+    public:
+        shm_channel();
+        ~shm_channel() throw ();
+
+    public:
+        // the daemon and the child attach with opposite values of "daemon";
+        // "peer" is the socket connecting the two and is not owned
+        bool attach(int region, bool daemon, int peer);
+        bool attached() const { return m_base != NULL; }
+        bool read(char* data, size_t sz);
+        bool write(const char* data, size_t sz);
+        // publish what has been written; a no-op when not attached
+        void flush();
+        // wake this side if it is blocked; it will notice if the peer is gone
+        void interrupt();
+
+    private:
+        struct ring;
+        bool wait(uint64_t* pos, uint64_t seen, uint32_t* waiting, uint32_t* seq);
+        void wake(uint32_t* waiting, uint32_t* seq);
+        bool peer_alive();
+
+    private:
+        char* m_base;
+        ring* m_in;
+        ring* m_out;
+        // bytes written to m_out but not yet visible to the reader
+        uint64_t m_pending;
+        int m_peer;
+        unsigned m_spin;
+
+    private:
+        shm_channel(const shm_channel&);
+        shm_channel& operator = (const shm_channel&);
+};
+
+END_REPLICANT_NAMESPACE
+
+#endif // replicant_daemon_shm_channel_h_
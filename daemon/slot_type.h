@@ -48,6 +48,7 @@ enum slot_type
     SLOT_TICK = 7,
     SLOT_POKE = 4,
     SLOT_CALL = 5,
+    SLOT_BATCH = 12,
     SLOT_NOP = 0
 };
 
@@ -25,6 +25,13 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <assert.h>
+#include <string.h>
+
+// STL
+#include <algorithm>
+
 // e
 #include <e/endian.h>
 
@@ -41,10 +48,9 @@ snapshot :: snapshot(uint64_t up_to, robust_history* rh)
     , m_failed()
     , m_history(rh)
     , m_objects()
-    , m_serialized_prefix()
-    , m_serialized_objects()
-    , m_obj_packer(&m_serialized_objects)
-    , m_serialized_altogether()
+    , m_sealed(false)
+    , m_segments()
+    , m_size(0)
 {
 }
 
@@ -66,7 +72,9 @@ snapshot :: wait()
 void
 snapshot :: replica_internals(const e::slice& replica)
 {
-    m_serialized_prefix.assign(replica.cdata(), replica.size());
+    po6::threads::mutex::hold hold(&m_mtx);
+    std::string seg(replica.cdata(), replica.size());
+    append(&seg);
 }
 
 void
@@ -77,15 +85,20 @@ snapshot :: start_object(const std::string& name)
 }
 
 void
-snapshot :: finish_object(const std::string& name, const std::string& snap)
+snapshot :: finish_object(const std::string& name, std::string* snap)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     std::set<std::string>::iterator it = m_objects.find(name);
 
-    if (it != m_objects.end())
+    if (it != m_objects.end() && !m_sealed)
     {
         m_objects.erase(it);
-        m_obj_packer = m_obj_packer << e::slice(name) << e::slice(snap);
+        // the header is exactly what packing e::slice(*snap) would emit ahead
+        // of the bytes, so the image itself becomes a segment uncopied
+        std::string hdr;
+        e::packer(&hdr) << e::slice(name) << e::pack_varint(snap->size());
+        append(&hdr);
+        append(snap);
     }
 
     m_cond.broadcast();
@@ -111,18 +124,71 @@ snapshot :: done()
     return done_condition();
 }
 
-const std::string&
-snapshot :: contents()
+void
+snapshot :: seal()
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    m_serialized_altogether = m_serialized_prefix;
+
+    if (m_sealed)
+    {
+        return;
+    }
+
     robust_history rh;
     m_history->copy_up_to(&rh, m_up_to);
-    std::string tmp;
-    e::packer(&tmp) << rh;
-    m_serialized_altogether += tmp;
-    m_serialized_altogether += m_serialized_objects;
-    return m_serialized_altogether;
+    std::string hist;
+    e::packer(&hist) << rh;
+    std::list<std::string>::iterator it = m_segments.begin();
+
+    if (it != m_segments.end())
+    {
+        ++it;
+    }
+
+    // the history follows the replica internals and precedes the objects
+    it = m_segments.insert(it, std::string());
+    it->swap(hist);
+    m_size += it->size();
+    m_sealed = true;
+}
+
+void
+snapshot :: segments(std::vector<e::slice>* segs) const
+{
+    assert(m_sealed);
+    segs->clear();
+
+    for (std::list<std::string>::const_iterator it = m_segments.begin();
+            it != m_segments.end(); ++it)
+    {
+        if (!it->empty())
+        {
+            segs->push_back(e::slice(*it));
+        }
+    }
+}
+
+void
+snapshot :: gather(uint64_t offset, char* buf, size_t buf_sz) const
+{
+    assert(m_sealed);
+    assert(offset + buf_sz <= m_size);
+
+    for (std::list<std::string>::const_iterator it = m_segments.begin();
+            it != m_segments.end() && buf_sz > 0; ++it)
+    {
+        if (offset >= it->size())
+        {
+            offset -= it->size();
+            continue;
+        }
+
+        const size_t sz = std::min(it->size() - offset, buf_sz);
+        memmove(buf, it->data() + offset, sz);
+        buf += sz;
+        buf_sz -= sz;
+        offset = 0;
+    }
 }
 
 bool
@@ -130,3 +196,11 @@ snapshot :: done_condition()
 {
     return m_failed || m_objects.empty();
 }
+
+void
+snapshot :: append(std::string* seg)
+{
+    m_size += seg->size();
+    m_segments.push_back(std::string());
+    m_segments.back().swap(*seg);
+}
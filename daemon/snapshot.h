@@ -32,7 +32,9 @@
 #include <stdint.h>
 
 // STL
+#include <list>
 #include <set>
+#include <vector>
 
 // po6
 #include <po6/threads/cond.h>
@@ -60,13 +62,23 @@ class snapshot
         void wait();
         void replica_internals(const e::slice& replica);
         void start_object(const std::string& name);
-        void finish_object(const std::string& name, const std::string& snap);
+        // takes ownership of the object's image by swapping it out of snap
+        void finish_object(const std::string& name, std::string* snap);
         void abort_snapshot();
         bool done();
-        const std::string& contents();
+        // freezes a done snapshot; from then on it is immutable and may be
+        // shared by every reader that holds a reference to it
+        void seal();
+
+    // valid only once sealed
+    public:
+        uint64_t size() const { return m_size; }
+        void segments(std::vector<e::slice>* segs) const;
+        void gather(uint64_t offset, char* buf, size_t buf_sz) const;
 
     private:
         bool done_condition();
+        void append(std::string* seg);
 
     // refcount
     private:
@@ -82,10 +94,9 @@ class snapshot
         bool m_failed;
         robust_history* m_history;
         std::set<std::string> m_objects;
-        std::string m_serialized_prefix;
-        std::string m_serialized_objects;
-        e::packer m_obj_packer;
-        std::string m_serialized_altogether;
+        bool m_sealed;
+        std::list<std::string> m_segments;
+        uint64_t m_size;
 
     private:
         snapshot(const snapshot&);
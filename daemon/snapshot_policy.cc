@@ -0,0 +1,116 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+
+// po6
+#include <po6/time.h>
+
+// Replicant
+#include "daemon/snapshot_policy.h"
+
+using replicant::snapshot_policy;
+
+snapshot_policy :: snapshot_policy()
+    : m_bytes(0)
+    , m_last_tick(0)
+{
+    for (size_t i = 0; i < REASONS; ++i)
+    {
+        m_counts[i] = 0;
+    }
+}
+
+snapshot_policy :: ~snapshot_policy() throw ()
+{
+}
+
+bool
+snapshot_policy :: should_snapshot(const settings& s, uint64_t tick, reason_t* why) const
+{
+    // the leader issues one tick a second
+    const uint64_t elapsed = (tick - std::min(tick, m_last_tick)) * PO6_SECONDS;
+
+    // a zero-valued setting disables the corresponding trigger
+    if (elapsed < s.SNAPSHOT_MIN_INTERVAL)
+    {
+        return false;
+    }
+
+    if (s.SNAPSHOT_BYTES > 0 && m_bytes >= s.SNAPSHOT_BYTES)
+    {
+        *why = BYTES;
+        return true;
+    }
+
+    if (s.SNAPSHOT_INTERVAL > 0 && m_bytes > 0 && elapsed >= s.SNAPSHOT_INTERVAL)
+    {
+        *why = TIME;
+        return true;
+    }
+
+    return false;
+}
+
+void
+snapshot_policy :: reset(uint64_t tick)
+{
+    m_bytes = 0;
+    m_last_tick = tick;
+}
+
+std::ostream&
+replicant :: operator << (std::ostream& lhs, snapshot_policy::reason_t rhs)
+{
+    switch (rhs)
+    {
+        case snapshot_policy::CONFIG:
+            return lhs << "config";
+        case snapshot_policy::BYTES:
+            return lhs << "bytes";
+        case snapshot_policy::TIME:
+            return lhs << "time";
+        case snapshot_policy::REASONS:
+        default:
+            return lhs << "unknown";
+    }
+}
+
+std::ostream&
+replicant :: operator << (std::ostream& lhs, const snapshot_policy& rhs)
+{
+    lhs << "snapshots(";
+
+    for (size_t i = 0; i < snapshot_policy::REASONS; ++i)
+    {
+        snapshot_policy::reason_t r = static_cast<snapshot_policy::reason_t>(i);
+        lhs << (i > 0 ? ", " : "") << r << "=" << rhs.count(r);
+    }
+
+    return lhs << ")";
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef replicant_daemon_snapshot_policy_h_
+#define replicant_daemon_snapshot_policy_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <iostream>
+
+// Replicant
+#include "namespace.h"
+#include "daemon/settings.h"
+
+BEGIN_REPLICANT_NAMESPACE
+
+// Decides when the replica should snapshot, based on the replicated settings
+// and on how much has happened since the last snapshot.  Its only inputs are
+// the slots executed and the replicated tick, so every replica snapshots at
+// the same slots and state transfer can pull one snapshot from many servers.
+// A replica restored from a snapshot starts counting at the snapshot's slot,
+// where every other replica started counting too.
+class snapshot_policy
+{
+    public:
+        enum reason_t
+        {
+            CONFIG      = 0,
+            BYTES       = 1,
+            TIME        = 2,
+            REASONS     = 3
+        };
+
+    public:
+        snapshot_policy();
+        ~snapshot_policy() throw ();
+
+    public:
+        void executed(uint64_t command_bytes) { m_bytes += command_bytes; }
+        bool should_snapshot(const settings& s, uint64_t tick, reason_t* why) const;
+        // call whenever the policy fires, whether or not the snapshot happens
+        void reset(uint64_t tick);
+        void taken(reason_t why) { ++m_counts[why]; }
+        uint64_t count(reason_t why) const { return m_counts[why]; }
+
+    private:
+        uint64_t m_bytes;
+        uint64_t m_last_tick;
+        uint64_t m_counts[REASONS];
+};
+
+std::ostream&
+operator << (std::ostream& lhs, snapshot_policy::reason_t rhs);
+std::ostream&
+operator << (std::ostream& lhs, const snapshot_policy& rhs);
+
+END_REPLICANT_NAMESPACE
+
+#endif // replicant_daemon_snapshot_policy_h_
@@ -0,0 +1,403 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+
+// Google Log
+#include <glog/logging.h>
+
+// po6
+#include <po6/threads/thread.h>
+
+// BusyBee
+#include <busybee.h>
+
+// Replicant
+#include "common/constants.h"
+#include "common/crc32c.h"
+#include "common/network_msgtype.h"
+#include "daemon/state_transfer.h"
+
+using replicant::state_transfer;
+
+// relative to the data directory, which is the working directory by now
+#define STATE_TRANSFER_FILE ".state_transfer.tmp"
+
+class state_transfer::peer
+{
+    public:
+        peer(state_transfer* st, const po6::net::location& loc);
+        ~peer() throw ();
+
+    public:
+        void start() { m_thread.start(); }
+        void join() { m_thread.join(); }
+        bool stale() const { return m_stale; }
+
+    private:
+        void run();
+
+    private:
+        state_transfer* const m_st;
+        const po6::net::location m_loc;
+        po6::threads::thread m_thread;
+        bool m_stale;
+
+    private:
+        peer(const peer&);
+        peer& operator = (const peer&);
+};
+
+state_transfer :: peer :: peer(state_transfer* st, const po6::net::location& loc)
+    : m_st(st)
+    , m_loc(loc)
+    , m_thread(po6::threads::make_obj_func(&peer::run, this))
+    , m_stale(false)
+{
+}
+
+state_transfer :: peer :: ~peer() throw ()
+{
+}
+
+void
+state_transfer :: peer :: run()
+{
+    std::auto_ptr<busybee_single> bbs(busybee_single::create(m_loc));
+    unsigned failures = 0;
+    uint64_t idx = 0;
+
+    while (failures < REPLICANT_STATE_TRANSFER_RETRIES && m_st->next_chunk(&idx))
+    {
+        std::auto_ptr<e::buffer> msg;
+        state_transfer_status_t status;
+        uint64_t slot;
+        uint64_t total;
+        uint64_t offset;
+        uint32_t crc;
+        e::slice data;
+
+        if (!request_chunk(bbs.get(), m_st->m_slot, idx * REPLICANT_STATE_TRANSFER_CHUNK_SIZE,
+                           &msg, &status, &slot, &total, &offset, &crc, &data))
+        {
+            // start over with a fresh connection and pick up where we were
+            m_st->return_chunk(idx);
+            bbs.reset(busybee_single::create(m_loc));
+            ++failures;
+            continue;
+        }
+
+        if (status == STATE_TRANSFER_BUSY)
+        {
+            m_st->return_chunk(idx);
+            timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = 50 * 1000ULL * 1000ULL;
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        if (status != STATE_TRANSFER_OK || slot != m_st->m_slot)
+        {
+            m_st->return_chunk(idx);
+            m_stale = true;
+            break;
+        }
+
+        if (!m_st->store_chunk(idx, slot, total, offset, crc, data))
+        {
+            LOG(WARNING) << "discarding corrupt state transfer chunk from " << m_loc;
+            m_st->return_chunk(idx);
+            ++failures;
+            continue;
+        }
+
+        failures = 0;
+    }
+}
+
+state_transfer :: state_transfer()
+    : m_mtx()
+    , m_slot(0)
+    , m_total(0)
+    , m_fd()
+    , m_map()
+    , m_chunks()
+    , m_copied(0)
+{
+}
+
+state_transfer :: ~state_transfer() throw ()
+{
+    reset();
+}
+
+bool
+state_transfer :: fetch(const configuration& c, uint64_t* slot, e::slice* snapshot)
+{
+    const std::vector<server>& servers(c.servers());
+
+    for (size_t i = 0; m_slot == 0 && i < servers.size(); ++i)
+    {
+        probe(servers[i].bind_to);
+    }
+
+    if (m_slot == 0)
+    {
+        return false;
+    }
+
+    const uint64_t copied = m_copied;
+    const size_t num_peers = std::min(servers.size(), size_t(REPLICANT_STATE_TRANSFER_PEERS));
+    std::vector<peer*> peers;
+
+    for (size_t i = 0; i < num_peers; ++i)
+    {
+        peers.push_back(new peer(this, servers[i].bind_to));
+        peers.back()->start();
+    }
+
+    bool all_stale = true;
+
+    for (size_t i = 0; i < peers.size(); ++i)
+    {
+        peers[i]->join();
+        all_stale = all_stale && peers[i]->stale();
+        delete peers[i];
+    }
+
+    if (m_copied == m_chunks.size())
+    {
+        m_map.reset(new po6::io::mmap(NULL, m_total, PROT_READ, MAP_SHARED, m_fd.get(), 0));
+
+        if (!m_map->valid())
+        {
+            errno = m_map->error();
+            PLOG(ERROR) << "could not map copied snapshot";
+            reset();
+            return false;
+        }
+
+        if (madvise(m_map->base(), m_total, MADV_SEQUENTIAL) < 0)
+        {
+            PLOG(WARNING) << "could not advise sequential access to the copied snapshot";
+        }
+
+        LOG(INFO) << "copied snapshot " << m_slot << " (" << m_total << " bytes)";
+        *slot = m_slot;
+        *snapshot = e::slice(static_cast<const char*>(m_map->base()), m_total);
+        return true;
+    }
+
+    if (all_stale && m_copied == copied)
+    {
+        LOG(INFO) << "no server still holds snapshot " << m_slot << "; starting over";
+        reset();
+    }
+    else
+    {
+        LOG(INFO) << "copied " << m_copied << "/" << m_chunks.size()
+                  << " chunks of snapshot " << m_slot << "; will resume";
+    }
+
+    return false;
+}
+
+bool
+state_transfer :: probe(const po6::net::location& loc)
+{
+    std::auto_ptr<busybee_single> bbs(busybee_single::create(loc));
+    std::auto_ptr<e::buffer> msg;
+    state_transfer_status_t status;
+    uint64_t slot;
+    uint64_t total;
+    uint64_t offset;
+    uint32_t crc;
+    e::slice data;
+
+    if (!request_chunk(bbs.get(), 0, 0, &msg, &status, &slot, &total, &offset, &crc, &data) ||
+        status != STATE_TRANSFER_OK || slot == 0 || total == 0)
+    {
+        return false;
+    }
+
+    m_fd = open(STATE_TRANSFER_FILE, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+
+    if (m_fd.get() < 0 || ftruncate(m_fd.get(), total) < 0)
+    {
+        PLOG(ERROR) << "could not create " << STATE_TRANSFER_FILE;
+        reset();
+        return false;
+    }
+
+    m_slot = slot;
+    m_total = total;
+    m_chunks.assign((total + REPLICANT_STATE_TRANSFER_CHUNK_SIZE - 1) / REPLICANT_STATE_TRANSFER_CHUNK_SIZE, 0);
+    m_copied = 0;
+    m_chunks[0] = 1;
+
+    if (!store_chunk(0, slot, total, offset, crc, data))
+    {
+        reset();
+        return false;
+    }
+
+    return true;
+}
+
+bool
+state_transfer :: request_chunk(busybee_single* bbs, uint64_t slot, uint64_t offset,
+                                std::auto_ptr<e::buffer>* msg,
+                                state_transfer_status_t* status,
+                                uint64_t* r_slot, uint64_t* total, uint64_t* r_offset,
+                                uint32_t* crc, e::slice* data)
+{
+    const size_t sz = BUSYBEE_HEADER_SIZE
+                    + pack_size(REPLNET_STATE_TRANSFER_CHUNK)
+                    + 2 * sizeof(uint64_t);
+    msg->reset(e::buffer::create(sz));
+    (*msg)->pack_at(BUSYBEE_HEADER_SIZE) << REPLNET_STATE_TRANSFER_CHUNK << slot << offset;
+
+    if (bbs->send(*msg) != BUSYBEE_SUCCESS ||
+        bbs->recv(REPLICANT_STATE_TRANSFER_TIMEOUT, msg) != BUSYBEE_SUCCESS ||
+        !msg->get())
+    {
+        return false;
+    }
+
+    network_msgtype mt = REPLNET_NOP;
+    uint8_t st = 0;
+    e::unpacker up = (*msg)->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> mt >> st >> *r_slot >> *total >> *r_offset >> *crc >> *data;
+
+    if (up.error() || mt != REPLNET_STATE_TRANSFER_CHUNK)
+    {
+        return false;
+    }
+
+    *status = state_transfer_status_t(st);
+    return true;
+}
+
+bool
+state_transfer :: next_chunk(uint64_t* idx)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        if (m_chunks[i] == 0)
+        {
+            m_chunks[i] = 1;
+            *idx = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+state_transfer :: return_chunk(uint64_t idx)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    assert(idx < m_chunks.size());
+    assert(m_chunks[idx] == 1);
+    m_chunks[idx] = 0;
+}
+
+bool
+state_transfer :: store_chunk(uint64_t idx, uint64_t slot, uint64_t total,
+                              uint64_t offset, uint32_t crc, const e::slice& data)
+{
+    if (slot != m_slot || total != m_total ||
+        offset != idx * REPLICANT_STATE_TRANSFER_CHUNK_SIZE ||
+        idx >= m_chunks.size() ||
+        data.size() != std::min(uint64_t(REPLICANT_STATE_TRANSFER_CHUNK_SIZE), total - offset) ||
+        crc32c(data.data(), data.size()) != crc)
+    {
+        return false;
+    }
+
+    // the caller owns chunk idx while it is in flight, so the write itself
+    // needs no lock
+    size_t written = 0;
+
+    while (written < data.size())
+    {
+        ssize_t ret = pwrite(m_fd.get(), data.data() + written,
+                             data.size() - written, offset + written);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (ret <= 0)
+        {
+            PLOG(ERROR) << "could not write to " << STATE_TRANSFER_FILE;
+            return false;
+        }
+
+        written += ret;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    assert(m_chunks[idx] == 1);
+    m_chunks[idx] = 2;
+    ++m_copied;
+    return true;
+}
+
+void
+state_transfer :: reset()
+{
+    m_slot = 0;
+    m_total = 0;
+    m_map.reset();
+
+    if (m_fd.get() >= 0)
+    {
+        m_fd.close();
+        unlink(STATE_TRANSFER_FILE);
+    }
+    m_chunks.clear();
+    m_copied = 0;
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef replicant_daemon_state_transfer_h_
+#define replicant_daemon_state_transfer_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/io/mmap.h>
+#include <po6/net/location.h>
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/buffer.h>
+#include <e/slice.h>
+
+// Replicant
+#include "namespace.h"
+#include "common/configuration.h"
+
+class busybee_single;
+
+BEGIN_REPLICANT_NAMESPACE
+
+// Status of a REPLNET_STATE_TRANSFER_CHUNK response
+enum state_transfer_status_t
+{
+    STATE_TRANSFER_OK       = 0,
+    // the donor is over its transfer budget; retry shortly
+    STATE_TRANSFER_BUSY     = 1,
+    // the donor has no snapshot to offer
+    STATE_TRANSFER_NONE     = 2,
+    // the donor no longer holds the requested snapshot
+    STATE_TRANSFER_STALE    = 3
+};
+
+// Copies the latest snapshot from a cluster in fixed-size, checksummed
+// chunks.  Chunks are pulled from several servers at once when they hold the
+// same snapshot, and whatever has been copied survives failed attempts so
+// that a later call to fetch resumes where this one left off.  Chunks are
+// written straight to a file in the data directory as they arrive, and the
+// finished snapshot is handed out as a read-only mapping of that file, so the
+// snapshot is never held in memory as a whole.
+class state_transfer
+{
+    public:
+        state_transfer();
+        ~state_transfer() throw ();
+
+    public:
+        bool fetch(const configuration& c, uint64_t* slot, e::slice* snapshot);
+        // forget any partially copied snapshot
+        void reset();
+
+    private:
+        class peer;
+        static bool request_chunk(busybee_single* bbs, uint64_t slot, uint64_t offset,
+                                  std::auto_ptr<e::buffer>* msg,
+                                  state_transfer_status_t* status,
+                                  uint64_t* r_slot, uint64_t* total, uint64_t* r_offset,
+                                  uint32_t* crc, e::slice* data);
+        bool probe(const po6::net::location& loc);
+        bool next_chunk(uint64_t* idx);
+        void return_chunk(uint64_t idx);
+        bool store_chunk(uint64_t idx, uint64_t slot, uint64_t total,
+                         uint64_t offset, uint32_t crc, const e::slice& data);
+
+    private:
+        po6::threads::mutex m_mtx;
+        uint64_t m_slot;
+        uint64_t m_total;
+        po6::io::fd m_fd;
+        std::auto_ptr<po6::io::mmap> m_map;
+        // per chunk: 0 = missing, 1 = in flight, 2 = copied
+        std::vector<uint8_t> m_chunks;
+        uint64_t m_copied;
+
+    private:
+        state_transfer(const state_transfer&);
+        state_transfer& operator = (const state_transfer&);
+};
+
+END_REPLICANT_NAMESPACE
+
+#endif // replicant_daemon_state_transfer_h_
@@ -0,0 +1,188 @@
+/* Copyright (c) 2015, Robert Escriva
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Replicant nor the names of its contributors may be
+ *       used to endorse or promote products derived from this software without
+ *       specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* C */
+#include <stdlib.h>
+#include <string.h>
+
+/* Replicant */
+#include "daemon/transition_table.h"
+
+static uint64_t
+hash_name(const char* name, size_t name_sz)
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ULL;
+    size_t i = 0;
+
+    for (i = 0; i < name_sz; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static int
+parse_index(const char* name, size_t name_sz, size_t* idx)
+{
+    size_t i = 0;
+    *idx = 0;
+
+    if (name_sz < 2 || name_sz > 10 || name[0] != '#')
+    {
+        return -1;
+    }
+
+    for (i = 1; i < name_sz; ++i)
+    {
+        if (name[i] < '0' || name[i] > '9')
+        {
+            return -1;
+        }
+
+        *idx = *idx * 10 + (name[i] - '0');
+    }
+
+    return 0;
+}
+
+int
+transition_table_init(struct transition_table* table,
+                      struct state_machine_transition* transitions)
+{
+    size_t sz = 0;
+    size_t slots_sz = 4;
+    size_t i = 0;
+
+    while (transitions[sz].name)
+    {
+        ++sz;
+    }
+
+    /* keep the table at most half full so probes stay short */
+    while (slots_sz < 2 * sz)
+    {
+        slots_sz *= 2;
+    }
+
+    table->transitions = transitions;
+    table->transitions_sz = sz;
+    table->slots = calloc(slots_sz, sizeof(uint32_t));
+    table->slots_mask = slots_sz - 1;
+    table->readonly = calloc(sz + 1, sizeof(unsigned char));
+
+    if (!table->slots || !table->readonly)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < sz; ++i)
+    {
+        const char* name = transitions[i].name;
+        size_t slot = hash_name(name, strlen(name)) & table->slots_mask;
+
+        /* the first of two transitions with the same name wins, as it did
+         * when the table was searched in order */
+        if (transition_table_lookup(table, name, strlen(name)))
+        {
+            continue;
+        }
+
+        while (table->slots[slot] != 0)
+        {
+            slot = (slot + 1) & table->slots_mask;
+        }
+
+        table->slots[slot] = i + 1;
+    }
+
+    return 0;
+}
+
+void
+transition_table_destroy(struct transition_table* table)
+{
+    free(table->slots);
+    free(table->readonly);
+    table->slots = NULL;
+    table->readonly = NULL;
+}
+
+void
+transition_table_set_readonly(struct transition_table* table,
+                              const char* const* names)
+{
+    struct state_machine_transition* t = NULL;
+
+    for (; *names; ++names)
+    {
+        t = transition_table_lookup(table, *names, strlen(*names));
+
+        if (t)
+        {
+            table->readonly[t - table->transitions] = 1;
+        }
+    }
+}
+
+int
+transition_table_is_readonly(const struct transition_table* table,
+                             const struct state_machine_transition* transition)
+{
+    return table->readonly[transition - table->transitions];
+}
+
+struct state_machine_transition*
+transition_table_lookup(const struct transition_table* table,
+                        const char* name, size_t name_sz)
+{
+    size_t slot = 0;
+    size_t idx = 0;
+
+    if (parse_index(name, name_sz, &idx) == 0)
+    {
+        return idx < table->transitions_sz ? &table->transitions[idx] : NULL;
+    }
+
+    slot = hash_name(name, name_sz) & table->slots_mask;
+
+    while (table->slots[slot] != 0)
+    {
+        struct state_machine_transition* t = &table->transitions[table->slots[slot] - 1];
+
+        if (strlen(t->name) == name_sz && memcmp(t->name, name, name_sz) == 0)
+        {
+            return t;
+        }
+
+        slot = (slot + 1) & table->slots_mask;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) 2015, Robert Escriva
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Replicant nor the names of its contributors may be
+ *       used to endorse or promote products derived from this software without
+ *       specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef replicant_daemon_transition_table_h_
+#define replicant_daemon_transition_table_h_
+
+/* C */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Replicant */
+#include <rsm.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* A state machine's transitions, hashed by name once when the library is
+ * loaded.  A command whose function is "#" followed by a decimal number names
+ * the transition at that position in the library's table instead, so that
+ * clients may leave the name out of the command (and the log) altogether. */
+struct transition_table
+{
+    struct state_machine_transition* transitions;
+    size_t transitions_sz;
+    /* open addressing over positions in transitions, plus one; zero is empty */
+    uint32_t* slots;
+    size_t slots_mask;
+    /* one flag per transition, set for those the library says are read-only */
+    unsigned char* readonly;
+};
+
+int transition_table_init(struct transition_table* table,
+                          struct state_machine_transition* transitions);
+void transition_table_destroy(struct transition_table* table);
+/* mark the named transitions read-only; "names" ends with NULL */
+void transition_table_set_readonly(struct transition_table* table,
+                                   const char* const* names);
+int transition_table_is_readonly(const struct transition_table* table,
+                                 const struct state_machine_transition* transition);
+struct state_machine_transition*
+transition_table_lookup(const struct transition_table* table,
+                        const char* name, size_t name_sz);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+#endif /* replicant_daemon_transition_table_h_ */
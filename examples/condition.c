@@ -65,10 +65,32 @@ condition_broadcast(struct rsm_context* ctx,
     rsm_cond_broadcast_data(ctx, "cond", data, data_sz);
 }
 
+void
+condition_current(struct rsm_context* ctx,
+                  void* obj,
+                  const char* data, size_t data_sz)
+{
+    uint64_t state = 0;
+    const char* value = NULL;
+    size_t value_sz = 0;
+
+    if (rsm_cond_current_value(ctx, "cond", &state, &value, &value_sz) < 0)
+    {
+        rsm_log(ctx, "could not read the current value of \"cond\"");
+        return;
+    }
+
+    rsm_set_output(ctx, value, value_sz);
+    free((void*)value);
+}
+
 struct state_machine rsm = {
     condition_create,
     condition_recreate,
     condition_snapshot,
     {{"broadcast", condition_broadcast},
+     {"current", condition_current},
      {NULL, NULL}}
 };
+
+const char* rsm_readonly[] = {"current", NULL};
@@ -147,3 +147,63 @@ struct state_machine rsm = {
     {{"increment", counter_increment},
      {NULL, NULL}}
 };
+
+/* The whole counter fits in a delta, which makes it a convenient exercise of
+ * incremental snapshots. */
+int
+counter_delta(struct rsm_context* ctx,
+              void* obj,
+              char** data, size_t* data_sz)
+{
+    return counter_snapshot(ctx, obj, data, data_sz);
+}
+
+int
+counter_apply(struct rsm_context* ctx,
+              void* obj,
+              const char* data, size_t data_sz)
+{
+    if (data_sz != sizeof(uint64_t))
+    {
+        rsm_log(ctx, "apply failed: corrupt delta");
+        return -1;
+    }
+
+    unpack64be(data, (uint64_t*)obj);
+    return 0;
+}
+
+struct state_machine_delta rsm_delta = {
+    counter_delta,
+    counter_apply
+};
+
+int
+counter_stream_snapshot(struct rsm_context* ctx, void* obj)
+{
+    char buf[8];
+    pack64be(*(uint64_t*)obj, buf);
+    rsm_snapshot_write(ctx, buf, sizeof(uint64_t));
+    return 0;
+}
+
+void*
+counter_stream_recreate(struct rsm_context* ctx)
+{
+    char buf[8];
+    size_t buf_sz = 0;
+    size_t amt = 0;
+
+    while (buf_sz < sizeof(uint64_t) &&
+           (amt = rsm_snapshot_read(ctx, buf + buf_sz, sizeof(uint64_t) - buf_sz)) > 0)
+    {
+        buf_sz += amt;
+    }
+
+    return counter_recreate(ctx, buf, buf_sz);
+}
+
+struct state_machine_stream rsm_stream = {
+    counter_stream_snapshot,
+    counter_stream_recreate
+};
@@ -102,6 +102,16 @@ replicant_client_new_object(struct replicant_client* client,
                             const char* path,
                             enum replicant_returncode* status);
 
+/* Like replicant_client_new_object, but the servers run the library in their
+ * own address space rather than in a child process.  Calls are cheaper, but a
+ * library that crashes takes the server down with it; use only for trusted
+ * code. */
+int64_t
+replicant_client_new_object_in_process(struct replicant_client* client,
+                                       const char* object,
+                                       const char* path,
+                                       enum replicant_returncode* status);
+
 int64_t
 replicant_client_del_object(struct replicant_client* client,
                             const char* object,
@@ -131,6 +141,8 @@ replicant_client_list_objects(struct replicant_client* client,
 
 #define REPLICANT_CALL_IDEMPOTENT 1
 #define REPLICANT_CALL_ROBUST 2
+/* answered by one server without a log entry; see "rsm_readonly" in rsm.h */
+#define REPLICANT_CALL_READONLY 4
 
 int64_t
 replicant_client_call(struct replicant_client* client,
@@ -141,6 +153,19 @@ replicant_client_call(struct replicant_client* client,
                       enum replicant_returncode* status,
                       char** output, size_t* output_sz);
 
+/* A read-only call that any server may answer from its own replica, provided
+ * it learned from the leader no more than max_staleness_ms ago.  "slot" is the
+ * last slot reflected in the answer. */
+int64_t
+replicant_client_call_stale(struct replicant_client* client,
+                            const char* object,
+                            const char* func,
+                            const char* input, size_t input_sz,
+                            uint64_t max_staleness_ms,
+                            enum replicant_returncode* status,
+                            char** output, size_t* output_sz,
+                            uint64_t* slot);
+
 int64_t
 replicant_client_cond_wait(struct replicant_client* client,
                            const char* object,
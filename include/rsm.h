@@ -48,6 +48,13 @@ struct state_machine_transition
     void (*func)(struct rsm_context* ctx, void* obj, const char* data, size_t data_sz);
 };
 
+/* A command may name a transition by its position in "transitions", written
+ * as "#" and a decimal number (e.g., "#0"), instead of by its name.  Names
+ * that begin with "#" are therefore reserved.  Positions are recorded in the
+ * replicated log and replayed against whatever build of the library is loaded
+ * at the time, and nothing checks that they still refer to the same
+ * transitions.  Once any client may have used positions, new transitions may
+ * only be appended to "transitions"; never reorder or remove an entry. */
 struct state_machine
 {
     void* (*ctor)(struct rsm_context* ctx);
@@ -56,6 +63,39 @@ struct state_machine
     struct state_machine_transition transitions[];
 };
 
+/* Optional incremental snapshots.  A library that exports a
+ * "struct state_machine_delta rsm_delta" symbol may hand back only the changes
+ * made since its most recent call to "snap" or "delta".  Returning non-zero
+ * from "delta" makes Replicant fall back to "snap".  On restore, "rtor" is
+ * given the last full snapshot and "apply" is invoked with each subsequent
+ * delta, in order.
+ */
+struct state_machine_delta
+{
+    int (*delta)(struct rsm_context* ctx, void* obj, char** data, size_t* data_sz);
+    int (*apply)(struct rsm_context* ctx, void* obj, const char* data, size_t data_sz);
+};
+
+/* Optional streaming snapshots.  A library that exports a
+ * "struct state_machine_stream rsm_stream" symbol never has to hold its whole
+ * state in one buffer:  "snap" emits the state piecewise with
+ * rsm_snapshot_write and "rtor" pulls it back with rsm_snapshot_read, which
+ * returns 0 once the snapshot is exhausted.  Either member may be NULL to use
+ * the corresponding "struct state_machine" callback instead.
+ */
+struct state_machine_stream
+{
+    int (*snap)(struct rsm_context* ctx, void* obj);
+    void* (*rtor)(struct rsm_context* ctx);
+};
+
+/* Optional read-only transitions.  A library that exports a NULL-terminated
+ * "const char* rsm_readonly[]" symbol lists the transitions that change neither
+ * the object's state nor its conditions.  Clients may invoke these with
+ * REPLICANT_CALL_READONLY to have them answered by one replica without a trip
+ * through consensus; such a call to any other transition fails.
+ */
+
 #pragma GCC diagnostic pop
 
 void rsm_log(struct rsm_context* ctx, const char* format, ...);
@@ -73,6 +113,9 @@ int rsm_cond_current_value(struct rsm_context* ctx,
 
 void rsm_tick_interval(struct rsm_context* ctx, const char* func, uint64_t seconds);
 
+void rsm_snapshot_write(struct rsm_context* ctx, const char* data, size_t data_sz);
+size_t rsm_snapshot_read(struct rsm_context* ctx, char* data, size_t data_sz);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
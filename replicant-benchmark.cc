@@ -66,6 +66,7 @@ struct benchmark
 
     ygor_data_logger* dl;
     uint32_t done;
+    uint64_t completed;
 
     po6::threads::mutex mtx;
     replicant_client* client;
@@ -85,6 +86,7 @@ benchmark :: benchmark()
     , length(60)
     , dl(NULL)
     , done(0)
+    , completed(0)
     , mtx()
     , client(NULL)
     , times()
@@ -186,6 +188,7 @@ benchmark :: consumer()
 
         const uint64_t start = it->second;
         times.erase(it);
+        ++completed;
 
         ygor_data_record dr;
         dr.series = 1;
@@ -253,12 +256,21 @@ main(int argc, const char* argv[])
 
     b.client = replicant_client_create(conn.host(), conn.port());
     b.dl = dl;
+    const uint64_t start = po6::wallclock_time();
     po6::threads::thread prod(po6::threads::make_thread_wrapper(&benchmark::producer, &b));
     po6::threads::thread cons(po6::threads::make_thread_wrapper(&benchmark::consumer, &b));
     prod.start();
     cons.start();
     prod.join();
     cons.join();
+    const uint64_t end = po6::wallclock_time();
+
+    // benchmarks/batch-size-sweep.sh runs this against clusters started with
+    // different --batch-size values to chart throughput against batch size
+    std::cout << "completed " << b.completed << " calls in "
+              << double(end - start) / SECONDS << " seconds: "
+              << double(b.completed) * SECONDS / double(end - start)
+              << " ops/s" << std::endl;
 
     if (ygor_data_logger_flush_and_destroy(dl) < 0)
     {
@@ -0,0 +1,282 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// STL
+#include <iostream>
+#include <vector>
+
+// po6
+#include <po6/errno.h>
+#include <po6/io/fd.h>
+#include <po6/time.h>
+
+// e
+#include <e/popt.h>
+
+// Replicant
+#include "daemon/shm_channel.h"
+
+// Compare the round trip of one call between the daemon and an object's child
+// process over the socketpair that used to carry everything and over the
+// shared-memory rings that carry it now.  The child is an echo:  each call is
+// an action byte and a payload, and each answer is a response byte, a length,
+// and the payload, read and written in the same pieces that object and
+// object_interface use.
+
+struct ipc_benchmark
+{
+    ipc_benchmark();
+
+    long calls;
+    long payload;
+};
+
+ipc_benchmark :: ipc_benchmark()
+    : calls(100000)
+    , payload(16)
+{
+}
+
+class socket_transport
+{
+    public:
+        socket_transport(po6::io::fd* fd) : m_fd(fd) {}
+
+    public:
+        bool read(char* data, size_t sz) { return m_fd->xread(data, sz) == ssize_t(sz); }
+        bool write(const char* data, size_t sz) { return m_fd->xwrite(data, sz) == ssize_t(sz); }
+
+    private:
+        po6::io::fd* m_fd;
+};
+
+class channel_transport
+{
+    public:
+        channel_transport(replicant::shm_channel* chan) : m_chan(chan) {}
+
+    public:
+        bool read(char* data, size_t sz) { return m_chan->read(data, sz); }
+        bool write(const char* data, size_t sz) { return m_chan->write(data, sz); }
+
+    private:
+        replicant::shm_channel* m_chan;
+};
+
+template <typename T>
+static bool
+echo(T* t, const ipc_benchmark& b)
+{
+    std::vector<char> buf(b.payload + 5);
+
+    for (long i = 0; i < b.calls; ++i)
+    {
+        if (!t->read(&buf[0], 1) ||
+            !t->read(&buf[5], b.payload))
+        {
+            return false;
+        }
+
+        buf[0] = 16;
+        memset(&buf[1], 0, 4);
+
+        if (!t->write(&buf[0], 1) ||
+            !t->write(&buf[1], 4) ||
+            !t->write(&buf[5], b.payload))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename T>
+static bool
+call(T* t, const ipc_benchmark& b)
+{
+    std::vector<char> buf(b.payload + 5, 'A');
+
+    for (long i = 0; i < b.calls; ++i)
+    {
+        buf[0] = 3;
+
+        if (!t->write(&buf[0], 1) ||
+            !t->write(&buf[5], b.payload) ||
+            !t->read(&buf[0], 1) ||
+            !t->read(&buf[1], 4 + b.payload))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int
+run(const char* name, bool use_channel, const ipc_benchmark& b)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        std::cerr << "could not create socketpair: " << po6::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    po6::io::fd parent(fds[0]);
+    po6::io::fd child(fds[1]);
+    po6::io::fd region(use_channel ? replicant::shm_channel::create_region() : -1);
+
+    if (use_channel && region.get() < 0)
+    {
+        std::cerr << "could not create shared memory: " << po6::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        std::cerr << "could not fork: " << po6::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    else if (pid == 0)
+    {
+        parent.close();
+        bool success = false;
+
+        if (use_channel)
+        {
+            replicant::shm_channel chan;
+            channel_transport t(&chan);
+            success = chan.attach(region.get(), false, child.get()) && echo(&t, b);
+            chan.flush();
+        }
+        else
+        {
+            socket_transport t(&child);
+            success = echo(&t, b);
+        }
+
+        _exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    child.close();
+    bool success = false;
+    const uint64_t start = po6::monotonic_time();
+
+    if (use_channel)
+    {
+        replicant::shm_channel chan;
+        channel_transport t(&chan);
+        success = chan.attach(region.get(), true, parent.get()) && call(&t, b);
+    }
+    else
+    {
+        socket_transport t(&parent);
+        success = call(&t, b);
+    }
+
+    const uint64_t end = po6::monotonic_time();
+    int status = 0;
+
+    if (!success)
+    {
+        kill(pid, SIGKILL);
+    }
+
+    waitpid(pid, &status, 0);
+
+    if (!success || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+        std::cerr << name << " failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const double secs = double(end - start) / PO6_SECONDS;
+    std::cout << name << ": "
+              << b.calls / secs << " calls/s, "
+              << double(end - start) / b.calls / PO6_MICROS << " us/call" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    ipc_benchmark b;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('n', "calls")
+            .description("number of round trips to make (default: 100000)")
+            .metavar("calls").as_long(&b.calls);
+    ap.arg().name('s', "payload")
+            .description("size of each call and its output in bytes (default: 16)")
+            .metavar("bytes").as_long(&b.payload);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << "command requires no positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (b.calls <= 0 || b.payload <= 0)
+    {
+        std::cerr << "calls and payload must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (run("socketpair", false, b) != EXIT_SUCCESS ||
+        run("shared memory", true, b) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
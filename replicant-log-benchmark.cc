@@ -0,0 +1,304 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// C
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef REPL_IO_URING
+// liburing
+#include <liburing.h>
+#endif
+
+// po6
+#include <po6/errno.h>
+#include <po6/io/fd.h>
+#include <po6/time.h>
+
+// e
+#include <e/popt.h>
+
+// Compare the ways the acceptor can make a group of log records durable:
+// pwritev followed by fdatasync, and (when built with --enable-io-uring) a
+// writev linked to an fdatasync submitted through io_uring.  Both run against
+// the same directory so that they see the same disk.
+
+struct log_benchmark
+{
+    log_benchmark();
+
+    const char* dir;
+    long record_size;
+    long group_size;
+    long groups;
+};
+
+log_benchmark :: log_benchmark()
+    : dir(".")
+    , record_size(128)
+    , group_size(16)
+    , groups(1000)
+{
+}
+
+static bool
+pwritev_all(int fd, struct iovec* iov, size_t iov_sz, uint64_t offset)
+{
+    while (iov_sz > 0)
+    {
+        ssize_t ret = pwritev(fd, iov, int(std::min(iov_sz, size_t(IOV_MAX))), offset);
+
+        if (ret < 0)
+        {
+            return false;
+        }
+
+        size_t amt = ret;
+        offset += amt;
+
+        while (iov_sz > 0 && amt >= iov->iov_len)
+        {
+            amt -= iov->iov_len;
+            ++iov;
+            --iov_sz;
+        }
+
+        if (iov_sz > 0)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + amt;
+            iov->iov_len -= amt;
+        }
+    }
+
+    return true;
+}
+
+static bool
+run_pwritev(int fd, const log_benchmark& b, std::vector<struct iovec>* iovs)
+{
+    uint64_t offset = 0;
+
+    for (long g = 0; g < b.groups; ++g)
+    {
+        std::vector<struct iovec> tmp(*iovs);
+
+        if (!pwritev_all(fd, &tmp[0], tmp.size(), offset) ||
+            fdatasync(fd) < 0)
+        {
+            return false;
+        }
+
+        offset += b.record_size * b.group_size;
+    }
+
+    return true;
+}
+
+#ifdef REPL_IO_URING
+static bool
+run_uring(int fd, const log_benchmark& b, std::vector<struct iovec>* iovs)
+{
+    struct io_uring ring;
+    int ret = io_uring_queue_init(64, &ring, 0);
+
+    if (ret < 0)
+    {
+        errno = -ret;
+        return false;
+    }
+
+    uint64_t offset = 0;
+    bool success = true;
+
+    for (long g = 0; success && g < b.groups; ++g)
+    {
+        unsigned sqes = 0;
+
+        for (size_t i = 0; i < iovs->size(); i += IOV_MAX)
+        {
+            const size_t n = std::min(iovs->size() - i, size_t(IOV_MAX));
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_writev(sqe, fd, &(*iovs)[i], n, offset);
+            sqe->flags |= IOSQE_IO_LINK;
+            offset += n * b.record_size;
+            ++sqes;
+        }
+
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+        ++sqes;
+        ret = io_uring_submit_and_wait(&ring, sqes);
+
+        if (ret < 0)
+        {
+            errno = -ret;
+            success = false;
+            break;
+        }
+
+        for (unsigned i = 0; i < sqes; ++i)
+        {
+            struct io_uring_cqe* cqe = NULL;
+
+            if (io_uring_peek_cqe(&ring, &cqe) < 0 &&
+                io_uring_wait_cqe(&ring, &cqe) < 0)
+            {
+                success = false;
+                break;
+            }
+
+            if (cqe->res < 0)
+            {
+                errno = -cqe->res;
+                success = false;
+            }
+
+            io_uring_cqe_seen(&ring, cqe);
+        }
+    }
+
+    io_uring_queue_exit(&ring);
+    return success;
+}
+#endif
+
+static int
+run(const char* name,
+    bool (*func)(int fd, const log_benchmark& b, std::vector<struct iovec>* iovs),
+    const log_benchmark& b)
+{
+    std::string path(b.dir);
+    path += "/replicant-log-benchmark.tmp";
+    po6::io::fd fd(open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR));
+
+    if (fd.get() < 0)
+    {
+        std::cerr << "could not open " << path << ": " << po6::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<char> data(b.record_size * b.group_size, 'A');
+    std::vector<struct iovec> iovs(b.group_size);
+
+    for (long i = 0; i < b.group_size; ++i)
+    {
+        iovs[i].iov_base = &data[i * b.record_size];
+        iovs[i].iov_len = b.record_size;
+    }
+
+    const uint64_t start = po6::monotonic_time();
+    const bool success = func(fd.get(), b, &iovs);
+    const uint64_t end = po6::monotonic_time();
+    unlink(path.c_str());
+
+    if (!success)
+    {
+        std::cerr << name << " failed: " << po6::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const double secs = double(end - start) / PO6_SECONDS;
+    const double records = double(b.groups) * b.group_size;
+    std::cout << name << ": "
+              << b.groups / secs << " groups/s, "
+              << records / secs << " records/s, "
+              << records * b.record_size / secs / (1024. * 1024.) << " MiB/s, "
+              << double(end - start) / b.groups / PO6_MICROS << " us/group" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    log_benchmark b;
+    e::argparser ap;
+    ap.autohelp();
+    ap.arg().name('d', "dir")
+            .description("directory on the disk to benchmark (default: .)")
+            .metavar("dir").as_string(&b.dir);
+    ap.arg().name('s', "record-size")
+            .description("size of each log record in bytes (default: 128)")
+            .metavar("bytes").as_long(&b.record_size);
+    ap.arg().name('g', "group-size")
+            .description("records made durable together (default: 16)")
+            .metavar("records").as_long(&b.group_size);
+    ap.arg().name('n', "groups")
+            .description("number of groups to write (default: 1000)")
+            .metavar("groups").as_long(&b.groups);
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 0)
+    {
+        std::cerr << "command requires no positional arguments\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (b.record_size <= 0 || b.group_size <= 0 || b.groups <= 0)
+    {
+        std::cerr << "record-size, group-size, and groups must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (run("pwritev+fdatasync", run_pwritev, b) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+
+#ifdef REPL_IO_URING
+    if (run("io_uring", run_uring, b) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+#else
+    std::cout << "io_uring: not built; configure with --enable-io-uring" << std::endl;
+#endif
+
+    return EXIT_SUCCESS;
+}
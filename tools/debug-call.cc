@@ -28,6 +28,7 @@
 #define __STDC_LIMIT_MACROS
 
 // e
+#include <e/endian.h>
 #include <e/strescape.h>
 
 // Replicant
@@ -41,6 +42,9 @@ main(int argc, const char* argv[])
     const char* func = "nop";
     bool idempotent = false;
     bool robust = false;
+    bool readonly = false;
+    bool uint64 = false;
+    long stale = -1;
     connect_opts conn;
     e::argparser ap;
     ap.autohelp();
@@ -57,6 +61,15 @@ main(int argc, const char* argv[])
     ap.arg().name('r', "robust")
             .description("use the robust method")
             .set_true(&robust);
+    ap.arg().name('R', "readonly")
+            .description("call a read-only function without consensus")
+            .set_true(&readonly);
+    ap.arg().long_name("stale")
+            .description("call a read-only function on any server that heard from the leader within this bound, and print the slot it read before each output")
+            .metavar("ms").as_long(&stale);
+    ap.arg().name('u', "uint64")
+            .description("print each output as a big-endian 64-bit integer")
+            .set_true(&uint64);
     ap.add("Connect to a cluster:", conn.parser());
 
     if (!ap.parse(argc, argv))
@@ -81,6 +94,7 @@ main(int argc, const char* argv[])
     unsigned flags = 0;
     flags |= idempotent ? REPLICANT_CALL_IDEMPOTENT : 0;
     flags |= robust ? REPLICANT_CALL_ROBUST : 0;
+    flags |= readonly ? REPLICANT_CALL_READONLY : 0;
 
     try
     {
@@ -92,14 +106,31 @@ main(int argc, const char* argv[])
             replicant_returncode re = REPLICANT_GARBAGE;
             char* output = NULL;
             size_t output_sz = 0;
-            int64_t rid = replicant_client_call(r, obj, func, s.data(), s.size(), flags, &re, &output, &output_sz);
+            uint64_t slot = 0;
+            int64_t rid = stale >= 0
+                        ? replicant_client_call_stale(r, obj, func, s.data(), s.size(), stale, &re, &output, &output_sz, &slot)
+                        : replicant_client_call(r, obj, func, s.data(), s.size(), flags, &re, &output, &output_sz);
 
             if (!cli_finish(r, rid, &re))
             {
                 return EXIT_FAILURE;
             }
 
-            std::cout << e::strescape(std::string(output, output_sz)) << std::endl;
+            if (stale >= 0)
+            {
+                std::cout << slot << " ";
+            }
+
+            if (uint64 && output_sz == sizeof(uint64_t))
+            {
+                uint64_t x;
+                e::unpack64be(output, &x);
+                std::cout << x << std::endl;
+            }
+            else
+            {
+                std::cout << e::strescape(std::string(output, output_sz)) << std::endl;
+            }
 
             if (output)
             {
@@ -34,10 +34,14 @@
 int
 main(int argc, const char* argv[])
 {
+    bool in_process = false;
     connect_opts conn;
     e::argparser ap;
     ap.autohelp();
     ap.option_string("[OPTIONS] <object> <library-path>");
+    ap.arg().long_name("in-process")
+            .description("run the library inside the servers instead of a child process (trusted libraries only)")
+            .set_true(&in_process);
     ap.add("Connect to a cluster:", conn.parser());
 
     if (!ap.parse(argc, argv))
@@ -61,7 +65,9 @@ main(int argc, const char* argv[])
 
     replicant_client* r = replicant_client_create(conn.host(), conn.port());
     replicant_returncode re = REPLICANT_GARBAGE;
-    int64_t rid = replicant_client_new_object(r, ap.args()[0], ap.args()[1], &re);
+    int64_t rid = in_process
+                ? replicant_client_new_object_in_process(r, ap.args()[0], ap.args()[1], &re)
+                : replicant_client_new_object(r, ap.args()[0], ap.args()[1], &re);
     int ret = cli_finish(r, rid, &re) ? EXIT_SUCCESS : EXIT_FAILURE;
     replicant_client_destroy(r);
     return ret;
@@ -0,0 +1,112 @@
+// Copyright (c) 2015, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Replicant nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <vector>
+
+// e
+#include <e/endian.h>
+
+// Replicant
+#include <replicant.h>
+#include "tools/common.h"
+
+int
+main(int argc, const char* argv[])
+{
+    connect_opts conn;
+    e::argparser ap;
+    ap.autohelp();
+    ap.option_string("[OPTIONS] <setting> <value>");
+    ap.add("Connect to a cluster:", conn.parser());
+
+    if (!ap.parse(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (ap.args_sz() != 2)
+    {
+        std::cerr << "command requires the setting's name and its new value\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!conn.validate())
+    {
+        std::cerr << "invalid host:port specification\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    char* end = NULL;
+    errno = 0;
+    uint64_t value = strtoull(ap.args()[1], &end, 10);
+
+    if (errno != 0 || *end != '\0')
+    {
+        std::cerr << "invalid value\n" << std::endl;
+        ap.usage();
+        return EXIT_FAILURE;
+    }
+
+    const char* name = ap.args()[0];
+    const size_t name_sz = strlen(name);
+    std::vector<char> input(name_sz + 1 + sizeof(uint64_t));
+    memmove(&input[0], name, name_sz + 1);
+    e::pack64be(value, &input[name_sz + 1]);
+
+    try
+    {
+        replicant_client* r = replicant_client_create(conn.host(), conn.port());
+        replicant_returncode re = REPLICANT_GARBAGE;
+        int64_t rid = replicant_client_call(r, "replicant", "set_setting",
+                                            &input[0], input.size(),
+                                            REPLICANT_CALL_ROBUST,
+                                            &re, NULL, NULL);
+
+        if (!cli_finish(r, rid, &re))
+        {
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}